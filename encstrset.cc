@@ -1,227 +1,1054 @@
-#include "encstrset.h"
-#include <iostream>
-#include <vector>
-#include <cstring>
-#include <unordered_set>
-#include <unordered_map>
-#include <iomanip>
-#include <cassert>
-
-using namespace std;
-
-#define SET_NOT_EXIST(x) ": set #" << x << " does not exist"
-
-#define STRING_OR_NULL(x) (x == nullptr ? "NULL" : "\"" + string(x) + "\"")
-
-#define HEX_CIPHER(x)                                                     \
-    for (size_t i = 0; i < x.length(); i++)                               \
-    {                                                                     \
-        unsigned char casted = x[i];                                      \
-        cerr << hex << uppercase << setw(2)                               \
-             << setfill('0') << (unsigned int)casted;                     \
-        if (i != x.length() - 1)                                          \
-        {                                                                 \
-            cerr << " ";                                                  \
-        }                                                                 \
-    }
-
-#define DEBUG_WITH_CYPHER(x, cypher, y) \
-    do                                  \
-    {                                   \
-        if (debug)                      \
-        {                               \
-            cerr << __func__ << x;      \
-            HEX_CIPHER(cypher);         \
-            cerr << y << "\n";          \
-        }                               \
-    } while (0);
-
-#define DEBUG(x)                           \
-    do                                     \
-    {                                      \
-        if (debug)                         \
-            cerr << __func__ << x << "\n"; \
-    } while (0)
-
-namespace {
-
-#ifdef NDEBUG
-    const bool debug = false;
-#else
-    const bool debug = true;
-#endif
-
-    using encodedString = string;
-    using SetNumber = unsigned long;
-    using StrSet = unordered_set<encodedString>;
-    using Sets = unordered_map<SetNumber, StrSet>;
-
-    const unsigned long startingSetNumber = 0;
-    unsigned long nextSetNumber = startingSetNumber;
-
-    Sets &allSets() {
-        static Sets sets;
-        return sets;
-    }
-
-    bool setExist(Sets::iterator setIterator) {
-        return setIterator != allSets().end();
-    }
-
-    StrSet &getSetReference(Sets::iterator setIterator) {
-        return setIterator->second;
-    }
-
-    string encode(const char *value, const char *key) {
-        string encodeResult = value;
-        if (key != nullptr && strlen(key) > 0) {
-            for (size_t i = 0; i < encodeResult.length(); i++) {
-                encodeResult[i] ^= key[i % strlen(key)];
-            }
-        }
-        return encodeResult;
-    }
-} // namespace
-
-namespace jnp1 {
-    unsigned long encstrset_new() {
-        assert(nextSetNumber < numeric_limits<unsigned long>::max());
-        DEBUG("()");
-        StrSet newSet;
-        allSets()[nextSetNumber] = newSet;
-        DEBUG(": set #" << nextSetNumber << " created");
-        return nextSetNumber++;
-    }
-
-    void encstrset_clear(unsigned long id) {
-        DEBUG("(" << id << ")");
-        auto setIterator = allSets().find(id);
-        if (setExist(setIterator)) {
-            getSetReference(setIterator).clear();
-            DEBUG(": set #" << id << " cleared");
-        } else {
-            DEBUG(SET_NOT_EXIST(id));
-        }
-    }
-
-    void encstrset_delete(unsigned long id) {
-        DEBUG("(" << id << ")");
-        auto setIterator = allSets().find(id);
-        if (setExist(setIterator)) {
-            allSets().erase(setIterator);
-            DEBUG(": set #" << id << " deleted");
-        } else {
-            DEBUG(SET_NOT_EXIST(id));
-        }
-    }
-
-    size_t encstrset_size(unsigned long id) {
-        DEBUG("(" << id << ")");
-        auto setIterator = allSets().find(id);
-        if (setExist(setIterator)) {
-            DEBUG(": set #" << id << " contains " << getSetReference(setIterator).size() << " element(s)");
-            return getSetReference(setIterator).size();
-        } else {
-            DEBUG(SET_NOT_EXIST(id));
-            return 0;
-        }
-    }
-
-    bool encstrset_insert(unsigned long id, const char *value, const char *key) {
-        DEBUG("(" << id << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(key) << ")");
-        if (value == nullptr) {
-            DEBUG(": invalid value (NULL)");
-            return false;
-        }
-        auto setIterator = allSets().find(id);
-        if (setExist(setIterator)) {
-            string encodedValue = encode(value, key);
-            if (getSetReference(setIterator).find(encodedValue) ==
-                getSetReference(setIterator).end()) {
-                getSetReference(setIterator).insert(encodedValue);
-                DEBUG_WITH_CYPHER(": set #" << id << ", cypher \"", encodedValue, "\" inserted");
-                return true;
-            } else {
-                DEBUG_WITH_CYPHER(": set #" << id << ", cypher \"", encodedValue, "\" was already present");
-            }
-        } else {
-            DEBUG(SET_NOT_EXIST(id));
-        }
-
-        return false;
-    }
-
-    bool encstrset_remove(unsigned long id, const char *value, const char *key) {
-        DEBUG("(" << id << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(key) << ")");
-        if (value == nullptr) {
-            DEBUG(": invalid value (NULL)");
-            return false;
-        }
-        auto setIterator = allSets().find(id);
-        if (setExist(setIterator)) {
-            string encodedValue = encode(value, key);
-            auto encodedValueIterator = getSetReference(setIterator).find(encodedValue);
-            if (encodedValueIterator != getSetReference(setIterator).end()) {
-                DEBUG_WITH_CYPHER(": set #" << id << ", cypher \"", encodedValue, "\" removed");
-                getSetReference(setIterator).erase(encodedValueIterator);
-                return true;
-            } else {
-                DEBUG_WITH_CYPHER(": set #" << id << ", cypher \"", encodedValue, "\" was not present");
-            }
-        } else {
-            DEBUG(SET_NOT_EXIST(id));
-        }
-
-        return false;
-    }
-
-    bool encstrset_test(unsigned long id, const char *value, const char *key) {
-        DEBUG("(" << id << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(key) << ")");
-
-        if (value == nullptr) {
-            DEBUG(": invalid value (NULL)");
-            return false;
-        }
-
-        auto setIterator = allSets().find(id);
-        if (setExist(setIterator)) {
-            string encodedValue = encode(value, key);
-            if (getSetReference(setIterator).find(encodedValue) !=
-                getSetReference(setIterator).end()) {
-                DEBUG_WITH_CYPHER(": set #" << id << ", cypher \"", encodedValue, "\" is present");
-                return true;
-            } else {
-                DEBUG_WITH_CYPHER(": set #" << id << ", cypher \"", encodedValue, "\" is not present");
-                return false;
-            }
-        } else {
-            DEBUG(SET_NOT_EXIST(id));
-        }
-        return false;
-    }
-
-    void encstrset_copy(unsigned long src_id, unsigned long dst_id) {
-        DEBUG("(" << src_id << ", " << dst_id << ")");
-        auto srcSetIterator = allSets().find(src_id);
-        auto dstSetIterator = allSets().find(dst_id);
-        if (setExist(srcSetIterator) && setExist(dstSetIterator)) {
-
-            for (auto element : getSetReference(srcSetIterator)) {
-
-                if (getSetReference(dstSetIterator).find(element) ==
-                    getSetReference(dstSetIterator).end()) {
-                    DEBUG_WITH_CYPHER(": cypher \"", element,
-                                      "\" copied from set #" << src_id << " to set #" << dst_id);
-                    getSetReference(dstSetIterator).insert(element);
-                } else {
-                    DEBUG_WITH_CYPHER(": copied cypher \"", element, "\" was already present in set #" << dst_id);
-                }
-            }
-        }
-        if (!setExist(srcSetIterator)) {
-            DEBUG(SET_NOT_EXIST(src_id));
-        } else if (!setExist(dstSetIterator)) {
-            DEBUG(SET_NOT_EXIST(dst_id));
-        }
-    }
-} // namespace jnp1
\ No newline at end of file
+#include "encstrset.h"
+#include "encstrset_common.h"
+#include "encstrset_memory.h"
+#include "encstrset_table.h"
+#include "encstrset_bloom.h"
+#include "encstrset_stats.h"
+#include "encstrset_sets.h"
+#include "encstrset_encode.h"
+#include "encstrset_algebra.h"
+#include "encstrset_trace.h"
+#include "encstrset_snapshot.h"
+#include "encstrset_journal.h"
+#include "encstrset_ops.h"
+#include "encstrset_load.h"
+#include "encstrset_queue.h"
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <string_view>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <utility>
+
+#ifdef ENCSTRSET_POSIX_FILES
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+using namespace encstrset_detail;
+
+namespace jnp1 {
+    // A set resolved once by encstrset_open. It holds the set itself, so
+    // that calls through it skip the registry; once the set is deleted they
+    // find it marked as such.
+    struct encstrset_handle {
+        SetNumber id;
+        SetPointer set;
+    };
+
+    // A cursor over the elements a set held when it was created. Holding
+    // them keeps them unchanged: the set copies them on its next change
+    // instead (see ownedElements).
+    struct encstrset_iter {
+        SetNumber id;
+        ElementsPointer elements;
+        size_t slot;
+    };
+
+    struct encstrset_queue {
+        WorkQueue work;
+    };
+} // namespace jnp1
+
+namespace {
+    struct HandleOrNull {
+        const jnp1::encstrset_handle *handle;
+    };
+
+    ostream &operator<<(ostream &stream, HandleOrNull value) {
+        if (value.handle == nullptr) {
+            return stream << "NULL";
+        }
+        return stream << "handle of set #" << value.handle->id;
+    }
+
+    bool validHandle(const char *function, const jnp1::encstrset_handle *handle) {
+        if (handle == nullptr) {
+            DEBUG_AS(function, ": invalid handle (NULL)");
+            return false;
+        }
+        return true;
+    }
+
+    struct CursorOrNull {
+        const jnp1::encstrset_iter *cursor;
+    };
+
+    ostream &operator<<(ostream &stream, CursorOrNull value) {
+        if (value.cursor == nullptr) {
+            return stream << "NULL";
+        }
+        return stream << "cursor over set #" << value.cursor->id;
+    }
+
+    bool validCursor(const char *function, const jnp1::encstrset_iter *cursor) {
+        if (cursor == nullptr) {
+            DEBUG_AS(function, ": invalid cursor (NULL)");
+            return false;
+        }
+        return true;
+    }
+
+    // Chunks hold each ciphertext after its length, as 4 bytes, least
+    // significant first.
+    const size_t chunkLengthBytes = 4;
+
+    void writeChunkLength(unsigned char *buffer, size_t length) {
+        for (size_t i = 0; i < chunkLengthBytes; i++) {
+            buffer[i] = static_cast<unsigned char>(length >> (8 * i));
+        }
+    }
+} // namespace
+
+namespace jnp1 {
+    unsigned long encstrset_new() {
+        DEBUG("()");
+        JournalScope journal;
+        SetNumber id = registerSet(newElements());
+        journal.append(JournalRecord::Create, {id});
+        trace(TraceOperation::New, id, true);
+        DEBUG(": set #" << id << " created");
+        return id;
+    }
+
+    void encstrset_clear(unsigned long id) {
+        DEBUG("(" << id << ")");
+        clearSet(__func__, id, findSet(id).get());
+    }
+
+    void encstrset_delete(unsigned long id) {
+        DEBUG("(" << id << ")");
+        SetPointer set;
+        ElementsPointer retired;
+        {
+            JournalScope journal;
+            set = unregisterSet(id);
+            if (set != nullptr) {
+                retired = set->retire();
+                journal.append(JournalRecord::Delete, {id});
+                recycleSlot(id);
+            }
+        }
+        trace(TraceOperation::Delete, id, set != nullptr);
+        if (set != nullptr) {
+            DEBUG(": set #" << id << " deleted");
+        } else {
+            DEBUG(SET_NOT_EXIST(id));
+        }
+    }
+
+    size_t encstrset_size(unsigned long id) {
+        DEBUG("(" << id << ")");
+        return setSize(__func__, id, findSet(id).get());
+    }
+
+    bool encstrset_insert(unsigned long id, const char *value, const char *key) {
+        DEBUG("(" << id << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(key) << ")");
+        size_t valueLength = lengthOrZero(value);
+        return insertValue(__func__, id, findSet(id).get(), value, valueLength, KeyStream(key, valueLength));
+    }
+
+    bool encstrset_remove(unsigned long id, const char *value, const char *key) {
+        DEBUG("(" << id << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(key) << ")");
+        size_t valueLength = lengthOrZero(value);
+        return removeValue(__func__, id, findSet(id).get(), value, valueLength, KeyStream(key, valueLength));
+    }
+
+    bool encstrset_test(unsigned long id, const char *value, const char *key) {
+        DEBUG("(" << id << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(key) << ")");
+        size_t valueLength = lengthOrZero(value);
+        return testValue(__func__, id, findSet(id).get(), value, valueLength, KeyStream(key, valueLength));
+    }
+
+    bool encstrset_insert_n(unsigned long id, const char *value, size_t value_length, const char *key,
+                            size_t key_length) {
+        DEBUG("(" << id << ", " << BYTES_OR_NULL(value, value_length) << ", " << BYTES_OR_NULL(key, key_length)
+                  << ")");
+        return insertValue(__func__, id, findSet(id).get(), value, value_length,
+                           KeyStream(key, lengthOrZero(key, key_length), value_length));
+    }
+
+    bool encstrset_remove_n(unsigned long id, const char *value, size_t value_length, const char *key,
+                            size_t key_length) {
+        DEBUG("(" << id << ", " << BYTES_OR_NULL(value, value_length) << ", " << BYTES_OR_NULL(key, key_length)
+                  << ")");
+        return removeValue(__func__, id, findSet(id).get(), value, value_length,
+                           KeyStream(key, lengthOrZero(key, key_length), value_length));
+    }
+
+    bool encstrset_test_n(unsigned long id, const char *value, size_t value_length, const char *key,
+                          size_t key_length) {
+        DEBUG("(" << id << ", " << BYTES_OR_NULL(value, value_length) << ", " << BYTES_OR_NULL(key, key_length)
+                  << ")");
+        return testValue(__func__, id, findSet(id).get(), value, value_length,
+                         KeyStream(key, lengthOrZero(key, key_length), value_length));
+    }
+
+    void encstrset_copy(unsigned long src_id, unsigned long dst_id) {
+        DEBUG("(" << src_id << ", " << dst_id << ")");
+        SetPointer srcSet = findSet(src_id);
+        SetPointer dstSet = findSet(dst_id);
+        if (srcSet != nullptr && dstSet != nullptr) {
+            JournalScope journal(true);
+            // Both locks are taken in set number order, so that copies in
+            // opposite directions cannot deadlock.
+            shared_lock<shared_mutex> srcLock(srcSet->mutex, defer_lock);
+            unique_lock<shared_mutex> dstLock(dstSet->mutex, defer_lock);
+            if (srcSet == dstSet) {
+                srcLock.lock();
+            } else if (src_id < dst_id) {
+                srcLock.lock();
+                dstLock.lock();
+            } else {
+                dstLock.lock();
+                srcLock.lock();
+            }
+            if (srcSet->deleted || dstSet->deleted) {
+                SetNumber missingId = srcSet->deleted ? src_id : dst_id;
+                srcLock.unlock();
+                if (dstLock.owns_lock()) {
+                    dstLock.unlock();
+                }
+                DEBUG(SET_NOT_EXIST(missingId));
+                return;
+            }
+
+            const char *function = __func__;
+            // A budgeted destination is checked with the elements it would
+            // end up with before taking them: the source's, or a merge.
+            ElementsPointer merged;
+            if (srcSet != dstSet && dstSet->isBudgeted()) {
+                merged = dstSet->elements->size() == 0
+                         ? srcSet->elements : combine(SetOperation::Union, dstSet->elements, srcSet->elements);
+                if (!dstSet->admitsReplacement(*merged)) {
+                    dstSet->budgetRejects++;
+                    srcLock.unlock();
+                    dstLock.unlock();
+                    threadStats().count(BudgetRejectCount);
+                    trace(TraceOperation::Copy, dst_id, false, src_id);
+                    DEBUG(": set #" << dst_id << " would exceed the memory budget");
+                    return;
+                }
+            }
+            if (srcSet == dstSet) {
+                if (debug) {
+                    srcSet->elements->forEach([&](string_view element) {
+                        DEBUG_WITH_CYPHER_AS(function, ": copied cypher \"", element,
+                                             "\" was already present in set #" << dst_id);
+                    });
+                }
+            } else if (dstSet->elements->size() == 0) {
+                // A copy into an empty set shares the source's elements until
+                // either set is modified.
+                dstSet->replaceElements(srcSet->elements);
+                if (debug) {
+                    srcSet->elements->forEach([&](string_view element) {
+                        DEBUG_WITH_CYPHER_AS(function, ": cypher \"", element,
+                                             "\" copied from set #" << src_id << " to set #" << dst_id);
+                    });
+                }
+            } else if (merged != nullptr) {
+                if (debug) {
+                    srcSet->elements->forEach([&](string_view element) {
+                        if (dstSet->elements->contains(element)) {
+                            DEBUG_WITH_CYPHER_AS(function, ": copied cypher \"", element,
+                                                 "\" was already present in set #" << dst_id);
+                        } else {
+                            DEBUG_WITH_CYPHER_AS(function, ": cypher \"", element,
+                                                 "\" copied from set #" << src_id << " to set #" << dst_id);
+                        }
+                    });
+                }
+                dstSet->replaceElements(move(merged));
+            } else if (srcSet->elements->size() > 0) {
+                StrSet &dstElements = dstSet->mutableElements();
+                dstElements.reserve(dstElements.size() + srcSet->elements->size());
+                srcSet->elements->forEach([&](string_view element) {
+                    if (dstElements.insert(element)) {
+                        DEBUG_WITH_CYPHER_AS(function, ": cypher \"", element,
+                                             "\" copied from set #" << src_id << " to set #" << dst_id);
+                    } else {
+                        DEBUG_WITH_CYPHER_AS(function, ": copied cypher \"", element,
+                                             "\" was already present in set #" << dst_id);
+                    }
+                });
+                dstSet->rebuildFilter();
+            }
+            journal.append(JournalRecord::Copy, {src_id, dst_id});
+            trace(TraceOperation::Copy, dst_id, true, src_id);
+        }
+        if (srcSet == nullptr) {
+            DEBUG(SET_NOT_EXIST(src_id));
+        } else if (dstSet == nullptr) {
+            DEBUG(SET_NOT_EXIST(dst_id));
+        }
+    }
+
+    size_t encstrset_insert_batch(unsigned long id, const char *const *values, size_t count,
+                                  const char *key, unsigned char *results) {
+        DEBUG("(" << id << ", " << count << " value(s), " << STRING_OR_NULL(key) << ")");
+        return insertBatch(__func__, id, findSet(id).get(), values, count, key, results);
+    }
+
+    size_t encstrset_remove_batch(unsigned long id, const char *const *values, size_t count,
+                                  const char *key, unsigned char *results) {
+        DEBUG("(" << id << ", " << count << " value(s), " << STRING_OR_NULL(key) << ")");
+        return removeBatch(__func__, id, findSet(id).get(), values, count, key, results);
+    }
+
+    size_t encstrset_test_batch(unsigned long id, const char *const *values, size_t count,
+                                const char *key, unsigned char *results) {
+        DEBUG("(" << id << ", " << count << " value(s), " << STRING_OR_NULL(key) << ")");
+        return testBatch(__func__, id, findSet(id).get(), values, count, key, results);
+    }
+
+    encstrset_key *encstrset_key_prepare(const char *key) {
+        DEBUG("(" << STRING_OR_NULL(key) << ")");
+        auto *preparedKey = new encstrset_key;
+        size_t keyLength = lengthOrZero(key);
+        if (key != nullptr) {
+            preparedKey->text = key;
+            preparedKey->isNull = false;
+        }
+        if (keyLength > 0) {
+            preparedKey->length = keyStreamLength(keyLength, keyStreamTargetLength);
+            size_t allocated = (preparedKey->length + 63) / 64 * 64;
+            preparedKey->stream = static_cast<char *>(::operator new(allocated, align_val_t(64)));
+            fillKeyStream(preparedKey->stream, preparedKey->length, key, keyLength);
+        }
+        DEBUG(": key stream of " << preparedKey->length << " byte(s) prepared");
+        return preparedKey;
+    }
+
+    void encstrset_key_release(encstrset_key *key) {
+        DEBUG("(" << STRING_OR_NULL(keyText(key)) << ")");
+        delete key;
+    }
+
+    bool encstrset_insert_k(unsigned long id, const char *value, const encstrset_key *key) {
+        DEBUG("(" << id << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(keyText(key)) << ")");
+        return insertValue(__func__, id, findSet(id).get(), value, lengthOrZero(value), KeyStream(key));
+    }
+
+    bool encstrset_remove_k(unsigned long id, const char *value, const encstrset_key *key) {
+        DEBUG("(" << id << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(keyText(key)) << ")");
+        return removeValue(__func__, id, findSet(id).get(), value, lengthOrZero(value), KeyStream(key));
+    }
+
+    bool encstrset_test_k(unsigned long id, const char *value, const encstrset_key *key) {
+        DEBUG("(" << id << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(keyText(key)) << ")");
+        return testValue(__func__, id, findSet(id).get(), value, lengthOrZero(value), KeyStream(key));
+    }
+
+    bool encstrset_set_filter(unsigned long id, bool enabled) {
+        DEBUG("(" << id << ", " << (enabled ? "true" : "false") << ")");
+        SetPointer set = findSet(id);
+        if (set == nullptr) {
+            DEBUG(SET_NOT_EXIST(id));
+            return false;
+        }
+        unique_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            lock.unlock();
+            DEBUG(SET_NOT_EXIST(id));
+            return false;
+        }
+        if (enabled && set->filter == nullptr) {
+            set->filter = make_unique<BloomFilter>(minimumFilterCapacity);
+            set->rebuildFilter();
+        } else if (!enabled) {
+            set->filter.reset();
+        }
+        size_t filterBytes = enabled ? set->filter->bytes() : 0;
+        lock.unlock();
+        if (enabled) {
+            DEBUG(": set #" << id << " filtered with " << filterBytes << " filter byte(s)");
+        } else {
+            DEBUG(": set #" << id << " unfiltered");
+        }
+        return true;
+    }
+
+    bool encstrset_freeze(unsigned long id) {
+        DEBUG("(" << id << ")");
+        return freezeSet(__func__, id, findSet(id).get());
+    }
+
+    size_t encstrset_memory_usage(unsigned long id) {
+        DEBUG("(" << id << ")");
+        SetPointer set = findSet(id);
+        if (set == nullptr) {
+            DEBUG(SET_NOT_EXIST(id));
+            return 0;
+        }
+        shared_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            lock.unlock();
+            DEBUG(SET_NOT_EXIST(id));
+            return 0;
+        }
+        size_t bytes = set->memoryUsage();
+        lock.unlock();
+        DEBUG(": set #" << id << " uses " << bytes << " byte(s)");
+        return bytes;
+    }
+
+    size_t encstrset_total_memory_usage() {
+        DEBUG("()");
+        size_t bytes = BlockCache::inUse();
+        DEBUG(": sets use " << bytes << " byte(s)");
+        return bytes;
+    }
+
+    bool encstrset_set_budget(unsigned long id, size_t bytes) {
+        DEBUG("(" << id << ", " << bytes << ")");
+        SetPointer set = findSet(id);
+        if (set == nullptr) {
+            DEBUG(SET_NOT_EXIST(id));
+            return false;
+        }
+        unique_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            lock.unlock();
+            DEBUG(SET_NOT_EXIST(id));
+            return false;
+        }
+        set->budget = bytes;
+        lock.unlock();
+        if (bytes == 0) {
+            DEBUG(": set #" << id << " unbudgeted");
+        } else {
+            DEBUG(": set #" << id << " budgeted " << bytes << " byte(s)");
+        }
+        return true;
+    }
+
+    void encstrset_set_global_budget(size_t bytes) {
+        DEBUG("(" << bytes << ")");
+        globalBudget.store(bytes, memory_order_relaxed);
+    }
+
+    bool encstrset_compact(unsigned long id) {
+        DEBUG("(" << id << ")");
+        return compactSet(__func__, id, findSet(id).get());
+    }
+
+    bool encstrset_get_footprint(unsigned long id, encstrset_footprint *footprint) {
+        DEBUG("(" << id << ")");
+        return readFootprint(__func__, id, findSet(id).get(), footprint);
+    }
+
+    bool encstrset_get_stats(unsigned long id, encstrset_stats *stats) {
+        DEBUG("(" << id << ")");
+        return readStats(__func__, id, findSet(id).get(), stats);
+    }
+
+    bool encstrset_get_global_stats(encstrset_global_stats *stats) {
+        DEBUG("()");
+        if (stats == nullptr) {
+            DEBUG(": invalid stats (NULL)");
+            return false;
+        }
+        *stats = encstrset_global_stats();
+        forEachSet([&](SetNumber, const SetPointer &set) {
+            shared_lock<shared_mutex> lock(set->mutex);
+            addTableStats(stats->totals, *set);
+            stats->sets++;
+        });
+
+        uint64_t counts[statsCounterCount] = {};
+        uint64_t latencies[statsLatencyCount][ENCSTRSET_LATENCY_BUCKETS] = {};
+        {
+            StatsRegistry &registry = statsRegistry();
+            lock_guard<mutex> lock(registry.lock);
+            for (size_t i = 0; i < statsCounterCount; i++) {
+                counts[i] = registry.retiredCounts[i];
+            }
+            memcpy(latencies, registry.retiredLatencies, sizeof(latencies));
+            for (const ThreadStats *threadStats : registry.live) {
+                threadStats->addTo(counts, latencies);
+            }
+        }
+        stats->totals.inserted = counts[InsertedCount];
+        stats->totals.insert_duplicates = counts[DuplicateCount];
+        stats->totals.test_hits = counts[TestHitCount];
+        stats->totals.test_misses = counts[TestMissCount];
+        stats->totals.removed = counts[RemovedCount];
+        stats->totals.remove_misses = counts[RemoveMissCount];
+        stats->totals.filter_rejects = counts[FilterRejectCount];
+        stats->totals.filter_false_positives = counts[FilterFalsePositiveCount];
+        stats->totals.budget_rejects = counts[BudgetRejectCount];
+        memcpy(stats->insert_latency, latencies[InsertLatency], sizeof(stats->insert_latency));
+        memcpy(stats->test_latency, latencies[TestLatency], sizeof(stats->test_latency));
+        memcpy(stats->remove_latency, latencies[RemoveLatency], sizeof(stats->remove_latency));
+        finishStats(stats->totals);
+        DEBUG(": " << stats->sets << " set(s) hold " << stats->totals.elements << " element(s)");
+        return true;
+    }
+
+    encstrset_handle *encstrset_open(unsigned long id) {
+        DEBUG("(" << id << ")");
+        SetPointer set = findSet(id);
+        if (set == nullptr) {
+            DEBUG(SET_NOT_EXIST(id));
+            return nullptr;
+        }
+        auto *handle = new encstrset_handle{id, move(set)};
+        DEBUG(": set #" << id << " opened");
+        return handle;
+    }
+
+    void encstrset_close(encstrset_handle *handle) {
+        DEBUG("(" << HandleOrNull{handle} << ")");
+        delete handle;
+    }
+
+    size_t encstrset_size_h(const encstrset_handle *handle) {
+        DEBUG("(" << HandleOrNull{handle} << ")");
+        return validHandle(__func__, handle) ? setSize(__func__, handle->id, handle->set.get()) : 0;
+    }
+
+    void encstrset_clear_h(const encstrset_handle *handle) {
+        DEBUG("(" << HandleOrNull{handle} << ")");
+        if (validHandle(__func__, handle)) {
+            clearSet(__func__, handle->id, handle->set.get());
+        }
+    }
+
+    bool encstrset_insert_h(const encstrset_handle *handle, const char *value, const char *key) {
+        DEBUG("(" << HandleOrNull{handle} << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(key) << ")");
+        size_t valueLength = lengthOrZero(value);
+        return validHandle(__func__, handle) &&
+               insertValue(__func__, handle->id, handle->set.get(), value, valueLength, KeyStream(key, valueLength));
+    }
+
+    bool encstrset_remove_h(const encstrset_handle *handle, const char *value, const char *key) {
+        DEBUG("(" << HandleOrNull{handle} << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(key) << ")");
+        size_t valueLength = lengthOrZero(value);
+        return validHandle(__func__, handle) &&
+               removeValue(__func__, handle->id, handle->set.get(), value, valueLength, KeyStream(key, valueLength));
+    }
+
+    bool encstrset_test_h(const encstrset_handle *handle, const char *value, const char *key) {
+        DEBUG("(" << HandleOrNull{handle} << ", " << STRING_OR_NULL(value) << ", " << STRING_OR_NULL(key) << ")");
+        size_t valueLength = lengthOrZero(value);
+        return validHandle(__func__, handle) &&
+               testValue(__func__, handle->id, handle->set.get(), value, valueLength, KeyStream(key, valueLength));
+    }
+
+    bool encstrset_insert_hk(const encstrset_handle *handle, const char *value, const encstrset_key *key) {
+        DEBUG("(" << HandleOrNull{handle} << ", " << STRING_OR_NULL(value) << ", "
+                  << STRING_OR_NULL(keyText(key)) << ")");
+        return validHandle(__func__, handle) &&
+               insertValue(__func__, handle->id, handle->set.get(), value, lengthOrZero(value), KeyStream(key));
+    }
+
+    bool encstrset_remove_hk(const encstrset_handle *handle, const char *value, const encstrset_key *key) {
+        DEBUG("(" << HandleOrNull{handle} << ", " << STRING_OR_NULL(value) << ", "
+                  << STRING_OR_NULL(keyText(key)) << ")");
+        return validHandle(__func__, handle) &&
+               removeValue(__func__, handle->id, handle->set.get(), value, lengthOrZero(value), KeyStream(key));
+    }
+
+    bool encstrset_test_hk(const encstrset_handle *handle, const char *value, const encstrset_key *key) {
+        DEBUG("(" << HandleOrNull{handle} << ", " << STRING_OR_NULL(value) << ", "
+                  << STRING_OR_NULL(keyText(key)) << ")");
+        return validHandle(__func__, handle) &&
+               testValue(__func__, handle->id, handle->set.get(), value, lengthOrZero(value), KeyStream(key));
+    }
+
+    size_t encstrset_insert_batch_h(const encstrset_handle *handle, const char *const *values, size_t count,
+                                    const char *key, unsigned char *results) {
+        DEBUG("(" << HandleOrNull{handle} << ", " << count << " value(s), " << STRING_OR_NULL(key) << ")");
+        if (!validHandle(__func__, handle)) {
+            clearResultBits(results, count);
+            return 0;
+        }
+        return insertBatch(__func__, handle->id, handle->set.get(), values, count, key, results);
+    }
+
+    size_t encstrset_remove_batch_h(const encstrset_handle *handle, const char *const *values, size_t count,
+                                    const char *key, unsigned char *results) {
+        DEBUG("(" << HandleOrNull{handle} << ", " << count << " value(s), " << STRING_OR_NULL(key) << ")");
+        if (!validHandle(__func__, handle)) {
+            clearResultBits(results, count);
+            return 0;
+        }
+        return removeBatch(__func__, handle->id, handle->set.get(), values, count, key, results);
+    }
+
+    size_t encstrset_test_batch_h(const encstrset_handle *handle, const char *const *values, size_t count,
+                                  const char *key, unsigned char *results) {
+        DEBUG("(" << HandleOrNull{handle} << ", " << count << " value(s), " << STRING_OR_NULL(key) << ")");
+        if (!validHandle(__func__, handle)) {
+            clearResultBits(results, count);
+            return 0;
+        }
+        return testBatch(__func__, handle->id, handle->set.get(), values, count, key, results);
+    }
+
+    bool encstrset_get_footprint_h(const encstrset_handle *handle, encstrset_footprint *footprint) {
+        DEBUG("(" << HandleOrNull{handle} << ")");
+        return validHandle(__func__, handle) && readFootprint(__func__, handle->id, handle->set.get(), footprint);
+    }
+
+    bool encstrset_get_stats_h(const encstrset_handle *handle, encstrset_stats *stats) {
+        DEBUG("(" << HandleOrNull{handle} << ")");
+        return validHandle(__func__, handle) && readStats(__func__, handle->id, handle->set.get(), stats);
+    }
+
+    bool encstrset_save_h(const encstrset_handle *handle, const char *path) {
+        DEBUG("(" << HandleOrNull{handle} << ", " << STRING_OR_NULL(path) << ")");
+        return validHandle(__func__, handle) && saveSet(__func__, handle->id, handle->set.get(), path);
+    }
+
+    encstrset_iter *encstrset_iter_begin(unsigned long id) {
+        DEBUG("(" << id << ")");
+        SetPointer set = findSet(id);
+        ElementsPointer elements;
+        if (set != nullptr) {
+            shared_lock<shared_mutex> lock(set->mutex);
+            if (!set->deleted) {
+                elements = set->elements;
+            }
+        }
+        if (elements == nullptr) {
+            DEBUG(SET_NOT_EXIST(id));
+            return nullptr;
+        }
+        size_t size = elements->size();
+        auto *cursor = new encstrset_iter{id, move(elements), 0};
+        DEBUG(": cursor over set #" << id << " with " << size << " element(s)");
+        return cursor;
+    }
+
+    bool encstrset_iter_next(encstrset_iter *iter, const char **cipher, size_t *length) {
+        DEBUG("(" << CursorOrNull{iter} << ")");
+        if (!validCursor(__func__, iter)) {
+            return false;
+        }
+        if (cipher == nullptr || length == nullptr) {
+            DEBUG(": invalid cypher or length (NULL)");
+            return false;
+        }
+        string_view element;
+        if (!iter->elements->nextElement(iter->slot, element)) {
+            DEBUG(": set #" << iter->id << " has no more elements");
+            return false;
+        }
+        *cipher = element.data();
+        *length = element.size();
+        DEBUG_WITH_CYPHER(": set #" << iter->id << ", cypher \"", element, "\"");
+        return true;
+    }
+
+    size_t encstrset_iter_next_chunk(encstrset_iter *iter, void *buffer, size_t capacity) {
+        DEBUG("(" << CursorOrNull{iter} << ", " << capacity << " byte(s))");
+        if (!validCursor(__func__, iter)) {
+            return 0;
+        }
+        if (buffer == nullptr) {
+            DEBUG(": invalid buffer (NULL)");
+            return 0;
+        }
+        auto *bytes = static_cast<unsigned char *>(buffer);
+        size_t used = 0;
+        size_t count = 0;
+        string_view element;
+        for (size_t slot = iter->slot; iter->elements->nextElement(slot, element); iter->slot = slot) {
+            if (chunkLengthBytes + element.size() > capacity - used) {
+                if (count == 0) {
+                    DEBUG(": set #" << iter->id << ", the next cypher needs " << chunkLengthBytes + element.size()
+                                    << " byte(s)");
+                    return chunkLengthBytes + element.size();
+                }
+                break;
+            }
+            writeChunkLength(bytes + used, element.size());
+            memcpy(bytes + used + chunkLengthBytes, element.data(), element.size());
+            used += chunkLengthBytes + element.size();
+            count++;
+        }
+        DEBUG(": set #" << iter->id << ", " << count << " cypher(s) in " << used << " byte(s)");
+        return used;
+    }
+
+    void encstrset_iter_end(encstrset_iter *iter) {
+        DEBUG("(" << CursorOrNull{iter} << ")");
+        delete iter;
+    }
+
+    void encstrset_union(unsigned long a_id, unsigned long b_id, unsigned long dst_id) {
+        DEBUG("(" << a_id << ", " << b_id << ", " << dst_id << ")");
+        combineInto(__func__, SetOperation::Union, a_id, b_id, dst_id);
+    }
+
+    void encstrset_intersect(unsigned long a_id, unsigned long b_id, unsigned long dst_id) {
+        DEBUG("(" << a_id << ", " << b_id << ", " << dst_id << ")");
+        combineInto(__func__, SetOperation::Intersection, a_id, b_id, dst_id);
+    }
+
+    void encstrset_difference(unsigned long a_id, unsigned long b_id, unsigned long dst_id) {
+        DEBUG("(" << a_id << ", " << b_id << ", " << dst_id << ")");
+        combineInto(__func__, SetOperation::Difference, a_id, b_id, dst_id);
+    }
+
+    void encstrset_symdiff(unsigned long a_id, unsigned long b_id, unsigned long dst_id) {
+        DEBUG("(" << a_id << ", " << b_id << ", " << dst_id << ")");
+        combineInto(__func__, SetOperation::SymmetricDifference, a_id, b_id, dst_id);
+    }
+
+    size_t encstrset_union_count(unsigned long a_id, unsigned long b_id) {
+        DEBUG("(" << a_id << ", " << b_id << ")");
+        size_t aSize, bSize, commonSize;
+        if (!measureOverlap(__func__, a_id, b_id, aSize, bSize, commonSize)) {
+            return 0;
+        }
+        DEBUG(": union of sets #" << a_id << " and #" << b_id << " has " << aSize + bSize - commonSize
+                                  << " element(s)");
+        return aSize + bSize - commonSize;
+    }
+
+    size_t encstrset_intersect_count(unsigned long a_id, unsigned long b_id) {
+        DEBUG("(" << a_id << ", " << b_id << ")");
+        size_t aSize, bSize, commonSize;
+        if (!measureOverlap(__func__, a_id, b_id, aSize, bSize, commonSize)) {
+            return 0;
+        }
+        DEBUG(": intersection of sets #" << a_id << " and #" << b_id << " has " << commonSize << " element(s)");
+        return commonSize;
+    }
+
+    size_t encstrset_difference_count(unsigned long a_id, unsigned long b_id) {
+        DEBUG("(" << a_id << ", " << b_id << ")");
+        size_t aSize, bSize, commonSize;
+        if (!measureOverlap(__func__, a_id, b_id, aSize, bSize, commonSize)) {
+            return 0;
+        }
+        DEBUG(": difference of sets #" << a_id << " and #" << b_id << " has " << aSize - commonSize
+                                       << " element(s)");
+        return aSize - commonSize;
+    }
+
+    size_t encstrset_symdiff_count(unsigned long a_id, unsigned long b_id) {
+        DEBUG("(" << a_id << ", " << b_id << ")");
+        size_t aSize, bSize, commonSize;
+        if (!measureOverlap(__func__, a_id, b_id, aSize, bSize, commonSize)) {
+            return 0;
+        }
+        DEBUG(": symmetric difference of sets #" << a_id << " and #" << b_id << " has "
+                                                 << aSize + bSize - 2 * commonSize << " element(s)");
+        return aSize + bSize - 2 * commonSize;
+    }
+
+    bool encstrset_save(unsigned long id, const char *path) {
+        DEBUG("(" << id << ", " << STRING_OR_NULL(path) << ")");
+        return saveSet(__func__, id, findSet(id).get(), path);
+    }
+
+    unsigned long encstrset_load(const char *path, bool verify) {
+        DEBUG("(" << STRING_OR_NULL(path) << ", " << (verify ? "true" : "false") << ")");
+        if (path == nullptr) {
+            DEBUG(": invalid path (NULL)");
+            return ENCSTRSET_INVALID_ID;
+        }
+        ElementsPointer elements = readSnapshot(path, verify);
+        if (elements == nullptr) {
+            DEBUG(": \"" << path << "\" is not a valid snapshot");
+            return ENCSTRSET_INVALID_ID;
+        }
+        size_t size = elements->size();
+        JournalScope journal;
+        SetNumber id = registerSet(move(elements));
+        journal.append(JournalRecord::Load, {id, verify}, path);
+        trace(TraceOperation::Load, id, true, size);
+        DEBUG(": set #" << id << " loaded with " << size << " element(s)");
+        return id;
+    }
+
+    bool encstrset_share(unsigned long id, const char *name) {
+        DEBUG("(" << id << ", " << STRING_OR_NULL(name) << ")");
+        return shareSet(__func__, id, findSet(id).get(), name);
+    }
+
+    unsigned long encstrset_attach(const char *name, bool verify) {
+        DEBUG("(" << STRING_OR_NULL(name) << ", " << (verify ? "true" : "false") << ")");
+        if (name == nullptr) {
+            DEBUG(": invalid name (NULL)");
+            return ENCSTRSET_INVALID_ID;
+        }
+        ElementsPointer elements = readShared(name, verify);
+        if (elements == nullptr) {
+            DEBUG(": \"" << name << "\" is not a valid shared set");
+            return ENCSTRSET_INVALID_ID;
+        }
+        size_t size = elements->size();
+        JournalScope journal;
+        SetNumber id = registerSet(move(elements));
+        journal.append(JournalRecord::Attach, {id, verify}, name);
+        trace(TraceOperation::Attach, id, true, size);
+        DEBUG(": set #" << id << " attached with " << size << " element(s)");
+        return id;
+    }
+
+    bool encstrset_unshare(const char *name) {
+        DEBUG("(" << STRING_OR_NULL(name) << ")");
+        if (name == nullptr) {
+            DEBUG(": invalid name (NULL)");
+            return false;
+        }
+#ifdef ENCSTRSET_POSIX_FILES
+        bool removed = shm_unlink(name) == 0;
+#else
+        bool removed = false;
+#endif
+        if (removed) {
+            DEBUG(": \"" << name << "\" removed");
+        } else {
+            DEBUG(": \"" << name << "\" is not shared");
+        }
+        return removed;
+    }
+
+    size_t encstrset_load_lines(unsigned long id, const char *path, const char *key, char delimiter) {
+        DEBUG("(" << id << ", " << STRING_OR_NULL(path) << ", " << STRING_OR_NULL(key) << ", delimiter "
+                  << int(static_cast<unsigned char>(delimiter)) << ")");
+        if (path == nullptr) {
+            DEBUG(": invalid path (NULL)");
+            return 0;
+        }
+        return loadLines(__func__, id, findSet(id).get(), path, -1, key, delimiter);
+    }
+
+    size_t encstrset_load_lines_fd(unsigned long id, int fd, const char *key, char delimiter) {
+        DEBUG("(" << id << ", descriptor " << fd << ", " << STRING_OR_NULL(key) << ", delimiter "
+                  << int(static_cast<unsigned char>(delimiter)) << ")");
+        return loadLines(__func__, id, findSet(id).get(), nullptr, fd, key, delimiter);
+    }
+
+    encstrset_queue *encstrset_queue_create(unsigned workers, size_t capacity, encstrset_completion_callback callback,
+                                            void *context) {
+        DEBUG("(" << workers << ", " << capacity << ", " << (callback == nullptr ? "no callback" : "callback")
+                  << ")");
+        if (capacity == 0) {
+            DEBUG(": invalid capacity (0)");
+            return nullptr;
+        }
+        size_t workerCount = workers != 0 ? workers : max(1u, thread::hardware_concurrency());
+        encstrset_queue *queue = new encstrset_queue{{workerCount, capacity, callback, context}};
+        DEBUG(": queue with " << workerCount << " worker(s) created");
+        return queue;
+    }
+
+    size_t encstrset_queue_submit(encstrset_queue *queue, const encstrset_request *requests, size_t count) {
+        DEBUG("(" << count << " request(s))");
+        if (queue == nullptr) {
+            DEBUG(": invalid queue (NULL)");
+            return 0;
+        }
+        if (requests == nullptr && count > 0) {
+            DEBUG(": invalid requests (NULL)");
+            return 0;
+        }
+        size_t accepted = queue->work.submit(requests, count);
+        DEBUG(": " << accepted << " request(s) submitted");
+        return accepted;
+    }
+
+    size_t encstrset_queue_poll(encstrset_queue *queue, encstrset_completion *completions, size_t capacity,
+                                bool wait) {
+        DEBUG("(" << capacity << ", " << (wait ? "wait" : "no wait") << ")");
+        if (queue == nullptr) {
+            DEBUG(": invalid queue (NULL)");
+            return 0;
+        }
+        if (completions == nullptr && capacity > 0) {
+            DEBUG(": invalid completions (NULL)");
+            return 0;
+        }
+        size_t polled = queue->work.poll(completions, capacity, wait);
+        DEBUG(": " << polled << " completion(s)");
+        return polled;
+    }
+
+    void encstrset_queue_destroy(encstrset_queue *queue) {
+        DEBUG("()");
+        delete queue;
+    }
+
+    bool encstrset_journal_open(const char *path, encstrset_durability durability) {
+        DEBUG("(" << STRING_OR_NULL(path) << ", "
+                  << (durability == ENCSTRSET_GROUP_COMMIT ? "group commit" : "sync each") << ")");
+        if (path == nullptr) {
+            DEBUG(": invalid path (NULL)");
+            return false;
+        }
+        unique_lock<shared_mutex> lock(journalOrder);
+        if (openJournal != nullptr) {
+            DEBUG(": a journal is already open");
+            return false;
+        }
+
+        // An existing journal is continued after its last intact record; a
+        // new one starts with an empty checkpoint.
+        uint64_t generation = 0;
+        vector<string> restoreFiles;
+        size_t size = 0;
+        shared_ptr<const void> existing = mapFile(path, size);
+        string_view bytes(static_cast<const char *>(existing.get()), existing == nullptr ? 0 : size);
+        size_t intact = parseJournal(bytes, [&](const JournalEntry &entry) {
+            if (entry.type == JournalRecord::Checkpoint) {
+                generation = entry.numbers[0];
+            } else if (entry.type == JournalRecord::Restore) {
+                restoreFiles.emplace_back(entry.text);
+            }
+            return true;
+        });
+        if (intact == 0 && !bytes.empty()) {
+            DEBUG(": \"" << path << "\" is not a journal");
+            return false;
+        }
+        bool ready = intact == 0 ? replaceFile(path, journalRecord(JournalRecord::Checkpoint, {0}))
+                                 : intact == bytes.size() || replaceFile(path, bytes.substr(0, intact));
+        existing.reset();
+        FILE *file = ready ? fopen(path, "ab") : nullptr;
+        if (file == nullptr) {
+            DEBUG(": \"" << path << "\" could not be opened");
+            return false;
+        }
+        openJournal = make_shared<Journal>(path, file, durability, generation, move(restoreFiles));
+        journaling.store(true, memory_order_release);
+        lock.unlock();
+        DEBUG(": journal \"" << path << "\" opened");
+        return true;
+    }
+
+    bool encstrset_journal_checkpoint() {
+        DEBUG("()");
+        unique_lock<shared_mutex> lock(journalOrder);
+        if (openJournal == nullptr) {
+            DEBUG(": no journal is open");
+            return false;
+        }
+        vector<pair<SetNumber, ElementsPointer>> sets;
+        forEachSet([&](SetNumber id, const SetPointer &set) {
+            shared_lock<shared_mutex> setLock(set->mutex);
+            sets.emplace_back(id, set->elements);
+        });
+        sort(sets.begin(), sets.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        if (!openJournal->checkpoint(sets)) {
+            DEBUG(": checkpoint failed");
+            return false;
+        }
+        lock.unlock();
+        DEBUG(": " << sets.size() << " set(s) saved");
+        return true;
+    }
+
+    bool encstrset_journal_close() {
+        DEBUG("()");
+        shared_ptr<Journal> journal;
+        {
+            unique_lock<shared_mutex> lock(journalOrder);
+            journal = move(openJournal);
+            journaling.store(false, memory_order_release);
+        }
+        if (journal == nullptr) {
+            DEBUG(": no journal is open");
+            return false;
+        }
+        if (!journal->close()) {
+            DEBUG(": some records could not be written");
+            return false;
+        }
+        DEBUG(": journal closed");
+        return true;
+    }
+
+    bool encstrset_journal_replay(const char *path) {
+        DEBUG("(" << STRING_OR_NULL(path) << ")");
+        if (path == nullptr) {
+            DEBUG(": invalid path (NULL)");
+            return false;
+        }
+        if (journaling.load(memory_order_acquire)) {
+            DEBUG(": cannot replay while a journal is open");
+            return false;
+        }
+        size_t size = 0;
+        shared_ptr<const void> file = mapFile(path, size);
+        if (file == nullptr) {
+            DEBUG(": \"" << path << "\" could not be read");
+            return false;
+        }
+        size_t records = 0;
+        bool complete = true;
+        parseJournal(string_view(static_cast<const char *>(file.get()), size), [&](const JournalEntry &entry) {
+            complete = replayRecord(entry);
+            records += complete;
+            return complete;
+        });
+        if (records == 0) {
+            DEBUG(": \"" << path << "\" is not a journal");
+            return false;
+        }
+        if (!complete) {
+            DEBUG(": record " << records << " of \"" << path << "\" could not be replayed");
+            return false;
+        }
+        DEBUG(": " << records << " record(s) replayed");
+        return true;
+    }
+
+    bool encstrset_trace_start(const char *path) {
+        DEBUG("(" << STRING_OR_NULL(path) << ")");
+        if (path == nullptr) {
+            DEBUG(": invalid path (NULL)");
+            return false;
+        }
+        lock_guard<mutex> lock(tracerMutex);
+        if (tracer != nullptr) {
+            DEBUG(": a trace is already running");
+            return false;
+        }
+        FILE *file = fopen(path, "wb");
+        if (file == nullptr || !writeTraceHeader(file)) {
+            if (file != nullptr) {
+                fclose(file);
+            }
+            DEBUG(": \"" << path << "\" could not be written");
+            return false;
+        }
+        traceStartStamp = traceStamp();
+        traceStartClock = traceClock();
+        tracer = make_unique<TraceDrainer>(file);
+        tracing.store(true, memory_order_release);
+        DEBUG(": tracing to \"" << path << "\"");
+        return true;
+    }
+
+    bool encstrset_trace_stop() {
+        DEBUG("()");
+        lock_guard<mutex> lock(tracerMutex);
+        if (tracer == nullptr) {
+            DEBUG(": no trace is running");
+            return false;
+        }
+        tracing.store(false, memory_order_release);
+        bool written = tracer->stop();
+        tracer.reset();
+        if (!written) {
+            DEBUG(": some records could not be written");
+            return false;
+        }
+        DEBUG(": trace stopped");
+        return true;
+    }
+} // namespace jnp1
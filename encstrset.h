@@ -4,17 +4,26 @@
 #ifdef __cplusplus
 
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 
 #else
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 #endif
 
+// Returned by functions that create a set when they fail.
+#define ENCSTRSET_INVALID_ID (~0UL)
+
+// Number of buckets of the latency histograms in encstrset_global_stats.
+#define ENCSTRSET_LATENCY_BUCKETS 32
+
 #ifdef __cplusplus
 namespace jnp1 {
     extern "C" {
 #endif
+    // Numbers of deleted sets are never handed out again.
     unsigned long encstrset_new();
 
     void encstrset_delete(unsigned long id);
@@ -27,9 +36,340 @@ namespace jnp1 {
 
     bool encstrset_test(unsigned long id, const char *value, const char *key);
 
+    // Value and key as value_length and key_length bytes, which may include
+    // NUL bytes. A NULL key is empty whatever key_length says; value must not
+    // be NULL, even if value_length is 0. Values longer than 2^32 - 1 bytes
+    // are not inserted.
+    bool encstrset_insert_n(unsigned long id, const char *value, size_t value_length, const char *key,
+                            size_t key_length);
+
+    bool encstrset_remove_n(unsigned long id, const char *value, size_t value_length, const char *key,
+                            size_t key_length);
+
+    bool encstrset_test_n(unsigned long id, const char *value, size_t value_length, const char *key,
+                          size_t key_length);
+
     void encstrset_clear(unsigned long id);
 
     void encstrset_copy(unsigned long src_id, unsigned long dst_id);
+
+    // Apply the operation to values[0..count) with one key. Bit i of results
+    // (LSB first, may be NULL) is the outcome for values[i]; returns the
+    // number of successful operations.
+    size_t encstrset_insert_batch(unsigned long id, const char *const *values, size_t count,
+                                  const char *key, unsigned char *results);
+
+    size_t encstrset_remove_batch(unsigned long id, const char *const *values, size_t count,
+                                  const char *key, unsigned char *results);
+
+    size_t encstrset_test_batch(unsigned long id, const char *const *values, size_t count,
+                                const char *key, unsigned char *results);
+
+    // A key expanded once for reuse across calls. A NULL handle acts as a
+    // NULL key.
+    typedef struct encstrset_key encstrset_key;
+
+    encstrset_key *encstrset_key_prepare(const char *key);
+
+    void encstrset_key_release(encstrset_key *key);
+
+    bool encstrset_insert_k(unsigned long id, const char *value, const encstrset_key *key);
+
+    bool encstrset_remove_k(unsigned long id, const char *value, const encstrset_key *key);
+
+    bool encstrset_test_k(unsigned long id, const char *value, const encstrset_key *key);
+
+    // Memory held by a set. mapped_bytes is a snapshot or segment used in
+    // place until the set is first modified; frozen_bytes replaces the table
+    // and arena of a frozen set.
+    typedef struct encstrset_footprint {
+        size_t table_bytes;
+        size_t arena_reserved;
+        size_t arena_used;
+        size_t arena_free;
+        size_t arena_abandoned;
+        size_t mapped_bytes;
+        size_t filter_bytes;
+        size_t frozen_bytes;
+    } encstrset_footprint;
+
+    bool encstrset_get_footprint(unsigned long id, encstrset_footprint *footprint);
+
+    // A filtered set keeps a Bloom filter of its ciphertexts (about 12 bits
+    // per element) that tests and removes consult first. It is rebuilt after
+    // clear, copy and set operations, and is not kept in snapshots or the
+    // journal. Sets start unfiltered.
+    bool encstrset_set_filter(unsigned long id, bool enabled);
+
+    // Rebuilds a set in a read-only form for fast tests. Any change first
+    // turns it back into a table; copies and set operations equal to it share
+    // the frozen form. Snapshots and the journal do not record it. Returns
+    // false, leaving the set unchanged, if it does not exist, could not be
+    // frozen or changed meanwhile.
+    bool encstrset_freeze(unsigned long id);
+
+    // encstrset_memory_usage returns the heap memory of a set, or 0 if it
+    // does not exist; shared elements count in full for each set, elements
+    // used in place for none. encstrset_total_memory_usage counts shared
+    // elements once.
+    //
+    // Budgets: an insert (single, batch, queued or loaded line) that would
+    // take a set past its budget, or all sets past the global budget, fails
+    // and counts in budget_rejects. So does a copy or set operation, leaving
+    // its destination as it was. Changes taking no more memory, loads and
+    // journal replay always succeed. A budget of 0, the default, means none.
+    // Concurrent inserts into different sets may overshoot the global budget
+    // slightly. encstrset_set_budget returns false if the set does not exist.
+    //
+    // encstrset_compact rebuilds a set without the memory left behind by
+    // removes, while calls on it go on. Returns false if the set does not
+    // exist or kept changing.
+    size_t encstrset_memory_usage(unsigned long id);
+
+    size_t encstrset_total_memory_usage();
+
+    bool encstrset_set_budget(unsigned long id, size_t bytes);
+
+    void encstrset_set_global_budget(size_t bytes);
+
+    bool encstrset_compact(unsigned long id);
+
+    // Outcomes of the operations on a set and the state of its table. Counts
+    // start when the set is created; copies and set operations do not carry
+    // them over.
+    typedef struct encstrset_stats {
+        uint64_t inserted;                  // inserts that added a ciphertext
+        uint64_t insert_duplicates;         // inserts that found it present
+        uint64_t test_hits;
+        uint64_t test_misses;
+        uint64_t removed;
+        uint64_t remove_misses;
+        uint64_t filter_rejects;            // test misses the filter answered alone
+        uint64_t filter_false_positives;    // test misses the filter let through
+        double filter_false_positive_rate;  // share of misses let through
+        size_t elements;
+        size_t cipher_bytes;                // total length of the ciphertexts
+        size_t slots;
+        double load_factor;                 // elements per slot
+        uint64_t rehashes;                  // times the table was rebuilt
+        size_t filter_bytes;
+        uint64_t budget_rejects;            // inserts turned away by a memory budget
+    } encstrset_stats;
+
+    bool encstrset_get_stats(unsigned long id, encstrset_stats *stats);
+
+    // Counts of all calls since the start, table state summed over existing
+    // sets, and latency histograms: bucket i counts calls that took 2^i to
+    // 2^(i+1) - 1 ns (the last, anything longer). One in 16 single-value
+    // calls of each thread is timed.
+    typedef struct encstrset_global_stats {
+        encstrset_stats totals;
+        size_t sets;
+        uint64_t insert_latency[ENCSTRSET_LATENCY_BUCKETS];
+        uint64_t test_latency[ENCSTRSET_LATENCY_BUCKETS];
+        uint64_t remove_latency[ENCSTRSET_LATENCY_BUCKETS];
+    } encstrset_global_stats;
+
+    bool encstrset_get_global_stats(encstrset_global_stats *stats);
+
+    // A set looked up once. After the set is deleted, calls through the
+    // handle behave as for a set that does not exist until encstrset_close.
+    // encstrset_open returns NULL if the set does not exist.
+    typedef struct encstrset_handle encstrset_handle;
+
+    encstrset_handle *encstrset_open(unsigned long id);
+
+    void encstrset_close(encstrset_handle *handle);
+
+    size_t encstrset_size_h(const encstrset_handle *handle);
+
+    void encstrset_clear_h(const encstrset_handle *handle);
+
+    bool encstrset_insert_h(const encstrset_handle *handle, const char *value, const char *key);
+
+    bool encstrset_remove_h(const encstrset_handle *handle, const char *value, const char *key);
+
+    bool encstrset_test_h(const encstrset_handle *handle, const char *value, const char *key);
+
+    bool encstrset_insert_hk(const encstrset_handle *handle, const char *value, const encstrset_key *key);
+
+    bool encstrset_remove_hk(const encstrset_handle *handle, const char *value, const encstrset_key *key);
+
+    bool encstrset_test_hk(const encstrset_handle *handle, const char *value, const encstrset_key *key);
+
+    size_t encstrset_insert_batch_h(const encstrset_handle *handle, const char *const *values, size_t count,
+                                    const char *key, unsigned char *results);
+
+    size_t encstrset_remove_batch_h(const encstrset_handle *handle, const char *const *values, size_t count,
+                                    const char *key, unsigned char *results);
+
+    size_t encstrset_test_batch_h(const encstrset_handle *handle, const char *const *values, size_t count,
+                                  const char *key, unsigned char *results);
+
+    bool encstrset_get_footprint_h(const encstrset_handle *handle, encstrset_footprint *footprint);
+
+    bool encstrset_get_stats_h(const encstrset_handle *handle, encstrset_stats *stats);
+
+    bool encstrset_save_h(const encstrset_handle *handle, const char *path);
+
+    // A cursor over the ciphertexts a set held at encstrset_iter_begin, in no
+    // particular order. encstrset_iter_next points cipher into the set's
+    // storage; later changes to the set copy it instead, so the pointers stay
+    // valid until encstrset_iter_end. encstrset_iter_begin returns NULL if
+    // the set does not exist.
+    //
+    // encstrset_iter_next_chunk copies as many of the following ciphertexts
+    // as fit into buffer, each after its length as 4 bytes, least significant
+    // first, and returns the number of bytes used. It returns 0 only at the
+    // end. If the next ciphertext alone does not fit, it copies nothing and
+    // returns the capacity that would fit it, which is more than capacity;
+    // the next call, or encstrset_iter_next, still returns that ciphertext.
+    typedef struct encstrset_iter encstrset_iter;
+
+    encstrset_iter *encstrset_iter_begin(unsigned long id);
+
+    bool encstrset_iter_next(encstrset_iter *iter, const char **cipher, size_t *length);
+
+    size_t encstrset_iter_next_chunk(encstrset_iter *iter, void *buffer, size_t capacity);
+
+    void encstrset_iter_end(encstrset_iter *iter);
+
+    // dst_id is replaced by the union, intersection, difference (a minus b)
+    // or symmetric difference of a_id and b_id, and may be either operand.
+    // The _count variants return the size of the result without building it.
+    void encstrset_union(unsigned long a_id, unsigned long b_id, unsigned long dst_id);
+
+    void encstrset_intersect(unsigned long a_id, unsigned long b_id, unsigned long dst_id);
+
+    void encstrset_difference(unsigned long a_id, unsigned long b_id, unsigned long dst_id);
+
+    void encstrset_symdiff(unsigned long a_id, unsigned long b_id, unsigned long dst_id);
+
+    size_t encstrset_union_count(unsigned long a_id, unsigned long b_id);
+
+    size_t encstrset_intersect_count(unsigned long a_id, unsigned long b_id);
+
+    size_t encstrset_difference_count(unsigned long a_id, unsigned long b_id);
+
+    size_t encstrset_symdiff_count(unsigned long a_id, unsigned long b_id);
+
+    // encstrset_save writes a set to path, replacing it atomically.
+    // encstrset_load maps such a file into a new set, used in place until
+    // modified. Files of incompatible builds are rejected; with verify the
+    // whole payload is checksummed too. encstrset_load returns
+    // ENCSTRSET_INVALID_ID on failure.
+    bool encstrset_save(unsigned long id, const char *path);
+
+    unsigned long encstrset_load(const char *path, bool verify);
+
+    // encstrset_share writes a set in the snapshot format to the POSIX shared
+    // memory segment name (as for shm_open), replacing any earlier one; sets
+    // attached before keep the old segment. encstrset_attach makes a new set
+    // using a segment in place until modified, and returns
+    // ENCSTRSET_INVALID_ID on failure. encstrset_unshare removes the name.
+    // Replaying a journal needs the segments of its attached sets.
+    bool encstrset_share(unsigned long id, const char *name);
+
+    unsigned long encstrset_attach(const char *name, bool verify);
+
+    bool encstrset_unshare(const char *name);
+
+    // Inserts every line of a file, or of fd until its end, as
+    // encstrset_insert would with key, and returns the number of values
+    // inserted. Lines end at delimiter (a final line needs none) and, like
+    // values, at a NUL byte. Each block of lines is inserted at once, so
+    // concurrent calls see whole blocks.
+    size_t encstrset_load_lines(unsigned long id, const char *path, const char *key, char delimiter);
+
+    size_t encstrset_load_lines_fd(unsigned long id, int fd, const char *key, char delimiter);
+
+    // Runs requests on worker threads (one per core if workers is 0).
+    // encstrset_queue_submit copies the requests but not their values and
+    // keys, which must stay valid until the requests complete. Each completes
+    // with its cookie and the result of the matching _n call: through
+    // callback, called by a worker, if given, and otherwise to be taken with
+    // encstrset_queue_poll. With wait, poll blocks until a completion is
+    // ready or none is outstanding.
+    //
+    // At most capacity requests are outstanding until polled or passed to
+    // callback; submit takes as many as fit and returns their number.
+    // encstrset_queue_destroy runs the requests submitted, waits for them and
+    // drops completions not polled; it must not be called from callback.
+    // encstrset_queue_create returns NULL if capacity is 0.
+    typedef enum encstrset_operation {
+        ENCSTRSET_INSERT,
+        ENCSTRSET_REMOVE,
+        ENCSTRSET_TEST
+    } encstrset_operation;
+
+    typedef struct encstrset_request {
+        uint64_t cookie;
+        unsigned long id;
+        encstrset_operation operation;
+        const char *value;
+        size_t value_length;
+        const char *key;
+        size_t key_length;
+    } encstrset_request;
+
+    typedef struct encstrset_completion {
+        uint64_t cookie;
+        bool result;
+    } encstrset_completion;
+
+    typedef void (*encstrset_completion_callback)(void *context, const encstrset_completion *completions,
+                                                  size_t count);
+
+    typedef struct encstrset_queue encstrset_queue;
+
+    encstrset_queue *encstrset_queue_create(unsigned workers, size_t capacity, encstrset_completion_callback callback,
+                                            void *context);
+
+    size_t encstrset_queue_submit(encstrset_queue *queue, const encstrset_request *requests, size_t count);
+
+    size_t encstrset_queue_poll(encstrset_queue *queue, encstrset_completion *completions, size_t capacity,
+                                bool wait);
+
+    void encstrset_queue_destroy(encstrset_queue *queue);
+
+    // While a journal is open, every change to the sets is appended to it
+    // before the call returns, synced by each call (ENCSTRSET_SYNC_EACH) or
+    // by a background thread for all waiting calls at once
+    // (ENCSTRSET_GROUP_COMMIT). A checkpoint saves every set next to the
+    // journal and restarts it. encstrset_journal_replay restores the sets,
+    // with their numbers, from the last checkpoint and the records after it;
+    // call it before any other call, then reopen the journal to continue it.
+    typedef enum encstrset_durability {
+        ENCSTRSET_SYNC_EACH,
+        ENCSTRSET_GROUP_COMMIT
+    } encstrset_durability;
+
+    bool encstrset_journal_open(const char *path, encstrset_durability durability);
+
+    bool encstrset_journal_checkpoint();
+
+    bool encstrset_journal_close();
+
+    bool encstrset_journal_replay(const char *path);
+
+    // While a trace runs, calls on existing sets append a record to a ring of
+    // the calling thread, drained into the file by a background thread;
+    // records finding the ring full are dropped and counted. Formatted by
+    // encstrset_trace_decode.
+    typedef struct encstrset_trace_record {
+        uint64_t time;                   // nanoseconds since the trace started
+        uint64_t set_id;
+        uint64_t detail;                 // ciphertext length, size, set number or count
+        uint32_t cipher_hash;            // zero unless the call had a ciphertext
+        unsigned char cipher_prefix[4];  // first bytes of the ciphertext
+        uint16_t thread;
+        uint8_t operation;               // index into the names in the header
+        uint8_t result;
+    } encstrset_trace_record;
+
+    bool encstrset_trace_start(const char *path);
+
+    bool encstrset_trace_stop();
 #ifdef __cplusplus
     }
 }
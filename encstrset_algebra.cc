@@ -0,0 +1,139 @@
+#include "encstrset_algebra.h"
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace {
+    using namespace encstrset_detail;
+
+    // Inputs with at least this many elements to walk are split across
+    // threads by set algebra.
+    const size_t parallelAlgebraThreshold = 1 << 16;
+
+    // Elements of one set split by whether another set contains them. Only
+    // the requested lists are filled; presentCount is always computed.
+    struct Membership {
+        size_t presentCount = 0;
+        vector<CipherReference> present;
+        vector<CipherReference> absent;
+    };
+
+    Membership classify(const StrSet &walked, const StrSet &probed, bool keepPresent, bool keepAbsent) {
+        size_t threadCount = 1;
+        if (walked.size() >= parallelAlgebraThreshold) {
+            threadCount = min<size_t>(max(1u, thread::hardware_concurrency()),
+                                      walked.size() / parallelAlgebraThreshold);
+        }
+
+        vector<Membership> parts(threadCount);
+        auto classifyPart = [&](size_t part) {
+            Membership &membership = parts[part];
+            size_t begin = walked.slotCapacity() * part / threadCount;
+            size_t end = walked.slotCapacity() * (part + 1) / threadCount;
+            walked.forEachInRange(begin, end, [&](string_view cipher) {
+                size_t cipherHash = StrSet::hash(cipher);
+                if (probed.contains(cipher, cipherHash)) {
+                    membership.presentCount++;
+                    if (keepPresent) {
+                        membership.present.push_back({cipher, cipherHash});
+                    }
+                } else if (keepAbsent) {
+                    membership.absent.push_back({cipher, cipherHash});
+                }
+            });
+        };
+
+        runInParallel(threadCount, classifyPart);
+
+        Membership &result = parts[0];
+        for (size_t part = 1; part < threadCount; part++) {
+            result.presentCount += parts[part].presentCount;
+            result.present.insert(result.present.end(), parts[part].present.begin(), parts[part].present.end());
+            result.absent.insert(result.absent.end(), parts[part].absent.begin(), parts[part].absent.end());
+        }
+        return move(result);
+    }
+} // namespace
+
+namespace encstrset_detail {
+    size_t intersectionSize(const StrSet &a, const StrSet &b) {
+        return a.size() <= b.size() ? classify(a, b, false, false).presentCount
+                                    : classify(b, a, false, false).presentCount;
+    }
+
+    ElementsPointer combine(SetOperation operation, const ElementsPointer &a, const ElementsPointer &b) {
+        bool aIsSmaller = a->size() <= b->size();
+        const ElementsPointer &smaller = aIsSmaller ? a : b;
+        const ElementsPointer &larger = aIsSmaller ? b : a;
+        ElementsPointer result;
+
+        switch (operation) {
+            case SetOperation::Union: {
+                Membership membership = classify(*smaller, *larger, false, true);
+                result = larger;
+                if (!membership.absent.empty()) {
+                    StrSet &elements = ownedElements(result);
+                    elements.reserve(elements.size() + membership.absent.size());
+                    for (const auto &reference : membership.absent) {
+                        elements.insert(reference.cipher, reference.cipherHash);
+                    }
+                }
+                break;
+            }
+            case SetOperation::Intersection: {
+                Membership membership = classify(*smaller, *larger, true, false);
+                if (membership.presentCount == smaller->size()) {
+                    result = smaller;
+                    break;
+                }
+                result = newElements();
+                result->reserve(membership.presentCount);
+                for (const auto &reference : membership.present) {
+                    result->insert(reference.cipher, reference.cipherHash);
+                }
+                break;
+            }
+            case SetOperation::Difference: {
+                if (aIsSmaller) {
+                    Membership membership = classify(*a, *b, false, true);
+                    if (membership.presentCount == 0) {
+                        result = a;
+                        break;
+                    }
+                    result = newElements();
+                    result->reserve(membership.absent.size());
+                    for (const auto &reference : membership.absent) {
+                        result->insert(reference.cipher, reference.cipherHash);
+                    }
+                } else {
+                    Membership membership = classify(*b, *a, true, false);
+                    result = a;
+                    if (!membership.present.empty()) {
+                        StrSet &elements = ownedElements(result);
+                        for (const auto &reference : membership.present) {
+                            elements.erase(reference.cipher, reference.cipherHash);
+                        }
+                    }
+                }
+                break;
+            }
+            case SetOperation::SymmetricDifference: {
+                Membership membership = classify(*smaller, *larger, true, true);
+                result = larger;
+                if (smaller->size() > 0) {
+                    StrSet &elements = ownedElements(result);
+                    for (const auto &reference : membership.present) {
+                        elements.erase(reference.cipher, reference.cipherHash);
+                    }
+                    elements.reserve(elements.size() + membership.absent.size());
+                    for (const auto &reference : membership.absent) {
+                        elements.insert(reference.cipher, reference.cipherHash);
+                    }
+                }
+                break;
+            }
+        }
+        return result;
+    }
+} // namespace encstrset_detail
@@ -0,0 +1,46 @@
+#ifndef ENCSTRSET_ENCSTRSET_ALGEBRA_H
+#define ENCSTRSET_ENCSTRSET_ALGEBRA_H
+
+#include "encstrset_common.h"
+#include "encstrset_table.h"
+#include <thread>
+#include <vector>
+#include <string_view>
+#include <cstddef>
+
+namespace encstrset_detail {
+    // Runs work(0), ..., work(count - 1), each on a thread of its own except
+    // work(0), which runs on the calling thread.
+    template<typename Work>
+    void runInParallel(size_t count, Work work) {
+        vector<thread> threads;
+        for (size_t part = 1; part < count; part++) {
+            threads.emplace_back(work, part);
+        }
+        work(0);
+        for (auto &worker : threads) {
+            worker.join();
+        }
+    }
+
+    struct CipherReference {
+        string_view cipher;
+        size_t cipherHash;
+    };
+
+    size_t intersectionSize(const StrSet &a, const StrSet &b);
+
+    enum class SetOperation {
+        Union,
+        Intersection,
+        Difference,
+        SymmetricDifference
+    };
+
+    // Walks the smaller operand and probes the larger one. Where the result
+    // is mostly the larger operand it starts out sharing its elements and is
+    // only copied if something has to change.
+    ElementsPointer combine(SetOperation operation, const ElementsPointer &a, const ElementsPointer &b);
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_ALGEBRA_H
@@ -0,0 +1,44 @@
+#include "encstrset_arena.h"
+#include <utility>
+
+using namespace std;
+
+namespace encstrset_detail {
+    ByteArena::ByteArena(const ByteArena &other)
+            : bufferCapacity(other.top), top(other.top), freeBytes(other.freeBytes),
+              abandonedBytes(other.abandonedBytes) {
+        if (top > 0) {
+            ownedBuffer = PooledBytes(top);
+            memcpy(ownedBuffer.get(), other.buffer, top);
+            buffer = ownedBuffer.get();
+        }
+        if (other.freeHeads != nullptr) {
+            ownedFreeHeads = PooledBytes(freeListBytes);
+            memcpy(ownedFreeHeads.get(), other.freeHeads, freeListBytes);
+            freeHeads = reinterpret_cast<uint64_t *>(ownedFreeHeads.get());
+        }
+    }
+
+    void ByteArena::reset() {
+        ownedBuffer.reset();
+        ownedFreeHeads.reset();
+        buffer = nullptr;
+        freeHeads = nullptr;
+        bufferCapacity = 0;
+        top = 0;
+        freeBytes = 0;
+        abandonedBytes = 0;
+        borrowed = false;
+    }
+
+    void ByteArena::grow(size_t needed) {
+        size_t newCapacity = grownCapacity(needed);
+        PooledBytes newBuffer(newCapacity);
+        if (top > 0) {
+            memcpy(newBuffer.get(), buffer, top);
+        }
+        ownedBuffer = move(newBuffer);
+        buffer = ownedBuffer.get();
+        bufferCapacity = newCapacity;
+    }
+} // namespace encstrset_detail
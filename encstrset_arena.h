@@ -0,0 +1,167 @@
+#ifndef ENCSTRSET_ENCSTRSET_ARENA_H
+#define ENCSTRSET_ENCSTRSET_ARENA_H
+
+#include "encstrset_common.h"
+#include "encstrset_memory.h"
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include <cstddef>
+
+namespace encstrset_detail {
+    // Bump allocator for the bytes of long ciphertexts of one set. Blocks
+    // are addressed by offset, so growing the buffer never invalidates them,
+    // and released blocks of up to maxListedBlock bytes are kept on per-size
+    // free lists for reuse. Everything is returned to the system at once by
+    // reset().
+    class ByteArena {
+    public:
+        static constexpr size_t granularity = 8;
+        static constexpr size_t maxListedBlock = 1024;
+        static constexpr size_t freeListCount = maxListedBlock / granularity + 1;
+
+        ByteArena() = default;
+
+        // The copy owns a buffer just large enough for the bytes in use.
+        ByteArena(const ByteArena &other);
+
+        // Borrows bytes and free lists kept elsewhere, such as in a mapped
+        // snapshot. A borrowed arena must be copied before it is modified.
+        ByteArena(const char *bytes, size_t used, size_t free, size_t abandoned, const uint64_t *lists)
+                : buffer(const_cast<char *>(bytes)), freeHeads(const_cast<uint64_t *>(lists)),
+                  bufferCapacity(used), top(used), freeBytes(free), abandonedBytes(abandoned), borrowed(true) {
+        }
+
+        ByteArena &operator=(const ByteArena &) = delete;
+
+        uint64_t allocate(size_t length) {
+            assert(!borrowed);
+            size_t block = blockSize(length);
+            if (block <= maxListedBlock && freeHeads != nullptr && freeHeads[block / granularity] != 0) {
+                uint64_t offset = freeHeads[block / granularity] - 1;
+                memcpy(&freeHeads[block / granularity], buffer + offset, sizeof(uint64_t));
+                freeBytes -= block;
+                return offset;
+            }
+            if (top + block > bufferCapacity) {
+                grow(top + block);
+            }
+            uint64_t offset = top;
+            top += block;
+            return offset;
+        }
+
+        void release(uint64_t offset, size_t length) {
+            assert(!borrowed);
+            size_t block = blockSize(length);
+            if (block > maxListedBlock) {
+                abandonedBytes += block;
+                return;
+            }
+            if (freeHeads == nullptr) {
+                ownedFreeHeads = PooledBytes(freeListBytes);
+                memset(ownedFreeHeads.get(), 0, freeListBytes);
+                freeHeads = reinterpret_cast<uint64_t *>(ownedFreeHeads.get());
+            }
+            memcpy(buffer + offset, &freeHeads[block / granularity], sizeof(uint64_t));
+            freeHeads[block / granularity] = offset + 1;
+            freeBytes += block;
+        }
+
+        char *at(uint64_t offset) {
+            return buffer + offset;
+        }
+
+        const char *at(uint64_t offset) const {
+            return buffer + offset;
+        }
+
+        // Null when no block has been released yet.
+        const uint64_t *freeLists() const {
+            return freeHeads;
+        }
+
+        void reset();
+
+        bool isBorrowed() const {
+            return borrowed;
+        }
+
+        size_t reserved() const {
+            return borrowed ? 0 : bufferCapacity;
+        }
+
+        // Heap memory of the buffer and free lists; zero if borrowed.
+        size_t heapBytes() const {
+            return reserved() + (ownedFreeHeads.get() != nullptr ? freeListBytes : 0);
+        }
+
+        // Bytes of the blocks in use.
+        size_t live() const {
+            return top - freeBytes - abandonedBytes;
+        }
+
+        // How much heapBytes() would grow by if a block for length bytes
+        // were allocated.
+        size_t growthFor(size_t length) const {
+            size_t block = blockSize(length);
+            if (block <= maxListedBlock && freeHeads != nullptr && freeHeads[block / granularity] != 0) {
+                return 0;
+            }
+            return top + block > bufferCapacity ? grownCapacity(top + block) - bufferCapacity : 0;
+        }
+
+        // Makes the buffer of an empty arena exactly capacity bytes long.
+        void reserveExactly(size_t capacity) {
+            assert(!borrowed && top == 0);
+            if (capacity > bufferCapacity) {
+                ownedBuffer = PooledBytes(capacity);
+                buffer = ownedBuffer.get();
+                bufferCapacity = capacity;
+            }
+        }
+
+        size_t used() const {
+            return top;
+        }
+
+        size_t freeListed() const {
+            return freeBytes;
+        }
+
+        size_t abandoned() const {
+            return abandonedBytes;
+        }
+
+    private:
+        static constexpr size_t minimumCapacity = 4096;
+        static constexpr size_t freeListBytes = freeListCount * sizeof(uint64_t);
+
+        PooledBytes ownedBuffer;
+        PooledBytes ownedFreeHeads;
+        char *buffer = nullptr;
+        uint64_t *freeHeads = nullptr;
+        size_t bufferCapacity = 0;
+        size_t top = 0;
+        size_t freeBytes = 0;
+        size_t abandonedBytes = 0;
+        bool borrowed = false;
+
+        static size_t blockSize(size_t length) {
+            return (length + granularity - 1) / granularity * granularity;
+        }
+
+        size_t grownCapacity(size_t needed) const {
+            size_t newCapacity = max(minimumCapacity, bufferCapacity * 2);
+            while (newCapacity < needed) {
+                newCapacity *= 2;
+            }
+            return newCapacity;
+        }
+
+        void grow(size_t needed);
+    };
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_ARENA_H
@@ -0,0 +1,955 @@
+#include "encstrset.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace ::jnp1;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // Throughput of a hit in encstrset_test (or encstrset_test_k with a
+    // prepared key), dominated by encoding once the value is long enough.
+    double testThroughput(size_t valueLength, size_t keyLength, bool prepared) {
+        std::string value(valueLength, 'v'), key(keyLength, 'k');
+        for (size_t i = 0; i < valueLength; i++) {
+            value[i] = static_cast<char>('a' + i % 26);
+        }
+        for (size_t i = 0; i < keyLength; i++) {
+            key[i] = static_cast<char>('A' + i % 23);
+        }
+
+        unsigned long id = encstrset_new();
+        encstrset_insert(id, value.c_str(), key.c_str());
+        encstrset_key *preparedKey = encstrset_key_prepare(key.c_str());
+
+        const size_t bytesPerRound = size_t(1) << 28;
+        size_t rounds = bytesPerRound / valueLength + 1;
+        size_t hits = 0;
+        auto start = Clock::now();
+        for (size_t i = 0; i < rounds; i++) {
+            hits += prepared ? encstrset_test_k(id, value.c_str(), preparedKey)
+                             : encstrset_test(id, value.c_str(), key.c_str());
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        encstrset_key_release(preparedKey);
+        encstrset_delete(id);
+
+        if (hits != rounds) {
+            std::fprintf(stderr, "unexpected miss\n");
+        }
+        return double(rounds) * double(valueLength) / elapsed.count() / 1e9;
+    }
+}
+
+// Bytes currently allocated from the heap; falls back to the resident set
+// size where the allocator cannot report it.
+size_t heapBytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    long pages = 0, resident = 0;
+    if (FILE *statm = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        std::fclose(statm);
+    }
+    return size_t(resident) * size_t(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+// Memory per element, encstrset_test latency for hits and misses, the time
+// to copy a large set into an empty one and to write to it afterwards, and
+// the time to delete it, for short (inline) and long ciphertexts.
+void printLargeSet(size_t elementCount) {
+    std::printf("%-12s%12s%14s%14s%14s%14s%14s   (%zu elements)\n", "value", "bytes/elem", "hit ns",
+                "miss ns", "copy ms", "write ms", "delete ms", elementCount);
+    for (size_t valueLength : {8, 40}) {
+        auto valueFor = [valueLength](size_t i, char tag) {
+            std::string value(valueLength, tag);
+            std::string number = std::to_string(i);
+            value.replace(value.size() - number.size(), number.size(), number);
+            return value;
+        };
+
+        size_t before = heapBytes();
+        unsigned long id = encstrset_new();
+        for (size_t i = 0; i < elementCount; i++) {
+            encstrset_insert(id, valueFor(i, 'h').c_str(), "key");
+        }
+        size_t after = heapBytes();
+
+        const size_t lookups = 1 << 21;
+        std::vector<std::string> hits, misses;
+        for (size_t i = 0; i < 4096; i++) {
+            hits.push_back(valueFor(i * 2654435761u % elementCount, 'h'));
+            misses.push_back(valueFor(i * 2654435761u % elementCount, 'm'));
+        }
+        double latency[2];
+        for (int miss = 0; miss < 2; miss++) {
+            const std::vector<std::string> &probes = miss ? misses : hits;
+            auto start = Clock::now();
+            for (size_t i = 0; i < lookups; i++) {
+                encstrset_test(id, probes[i % probes.size()].c_str(), "key");
+            }
+            std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+            latency[miss] = elapsed.count() / lookups;
+        }
+        // A snapshot into an empty set, then the first write to the source.
+        unsigned long snapshot = encstrset_new();
+        auto start = Clock::now();
+        encstrset_copy(id, snapshot);
+        std::chrono::duration<double, std::milli> copy = Clock::now() - start;
+        start = Clock::now();
+        encstrset_insert(id, "first write after the snapshot", "key");
+        std::chrono::duration<double, std::milli> write = Clock::now() - start;
+        encstrset_delete(snapshot);
+
+        start = Clock::now();
+        encstrset_delete(id);
+        std::chrono::duration<double, std::milli> deletion = Clock::now() - start;
+
+        std::printf("%-12zu%12.1f%14.1f%14.1f%14.2f%14.2f%14.2f\n", valueLength,
+                    double(after - before) / elementCount, latency[0], latency[1], copy.count(), write.count(),
+                    deletion.count());
+    }
+}
+
+// Memory per element and encstrset_test latency of a large set as a table
+// and once frozen, and the time encstrset_freeze takes.
+void printFrozen(size_t elementCount) {
+    std::printf("%-12s%-8s%12s%14s%14s%14s   (%zu elements)\n", "value", "form", "bytes/elem", "hit ns",
+                "miss ns", "freeze ms", elementCount);
+    for (size_t valueLength : {8, 40}) {
+        auto valueFor = [valueLength](size_t i, char tag) {
+            std::string value(valueLength, tag);
+            std::string number = std::to_string(i);
+            value.replace(value.size() - number.size(), number.size(), number);
+            return value;
+        };
+        unsigned long id = encstrset_new();
+        for (size_t i = 0; i < elementCount; i++) {
+            encstrset_insert(id, valueFor(i, 'f').c_str(), "key");
+        }
+        std::vector<std::string> hits, misses;
+        for (size_t i = 0; i < (size_t(1) << 16); i++) {
+            hits.push_back(valueFor(i * 2654435761u % elementCount, 'f'));
+            misses.push_back(valueFor(i * 2654435761u % elementCount, 'm'));
+        }
+
+        for (bool frozen : {false, true}) {
+            std::chrono::duration<double, std::milli> freeze{0};
+            if (frozen) {
+                auto start = Clock::now();
+                encstrset_freeze(id);
+                freeze = Clock::now() - start;
+            }
+            encstrset_footprint footprint;
+            encstrset_get_footprint(id, &footprint);
+            size_t bytes = footprint.table_bytes + footprint.arena_reserved + footprint.frozen_bytes;
+
+            const size_t lookups = 1 << 21;
+            double latency[2];
+            for (int miss = 0; miss < 2; miss++) {
+                const std::vector<std::string> &probes = miss ? misses : hits;
+                size_t found = 0;
+                auto start = Clock::now();
+                for (size_t i = 0; i < lookups; i++) {
+                    found += encstrset_test(id, probes[i % probes.size()].c_str(), "key");
+                }
+                std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+                if (found != (miss ? 0 : lookups)) {
+                    std::fprintf(stderr, "unexpected result\n");
+                }
+                latency[miss] = elapsed.count() / lookups;
+            }
+            std::printf("%-12zu%-8s%12.1f%14.1f%14.1f%14.1f\n", valueLength, frozen ? "frozen" : "table",
+                        double(bytes) / elementCount, latency[0], latency[1], freeze.count());
+        }
+        encstrset_delete(id);
+    }
+}
+
+// Memory of a set of 40-byte values after most of them are removed,
+// before and after encstrset_compact, and how long compaction takes.
+void printCompaction(size_t elementCount) {
+    std::printf("%-12s%16s%16s%14s   (%zu elements)\n", "kept", "bytes before", "bytes after", "compact ms",
+                elementCount);
+    for (size_t keptShare : {50, 10, 1}) {
+        auto valueFor = [](size_t i) {
+            std::string value(40, 'c');
+            std::string number = std::to_string(i);
+            value.replace(value.size() - number.size(), number.size(), number);
+            return value;
+        };
+        unsigned long id = encstrset_new();
+        for (size_t i = 0; i < elementCount; i++) {
+            encstrset_insert(id, valueFor(i).c_str(), "key");
+        }
+        for (size_t i = 0; i < elementCount; i++) {
+            if (i % 100 >= keptShare) {
+                encstrset_remove(id, valueFor(i).c_str(), "key");
+            }
+        }
+        size_t before = encstrset_memory_usage(id);
+        auto start = Clock::now();
+        encstrset_compact(id);
+        std::chrono::duration<double, std::milli> compact = Clock::now() - start;
+        std::printf("%-12s%16zu%16zu%14.1f\n", (std::to_string(keptShare) + "%").c_str(), before,
+                    encstrset_memory_usage(id), compact.count());
+        encstrset_delete(id);
+    }
+}
+
+// Sustained rate and latency of a mix of 90% tests, 5% inserts and 5%
+// removes on a large set, called directly and through an encstrset_queue
+// fed by one thread in bursts, as an event loop would. Queued latency runs
+// from submission until the completion is polled.
+void printQueue(size_t elementCount) {
+    const size_t operationCount = 1 << 21;
+    const size_t burst = 64;
+    unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    std::printf("%-12s%14s%14s%14s%14s   (%zu elements, %u workers)\n", "calls", "Mops/s", "p50 ns", "p99 ns",
+                "p99.9 ns", elementCount, workers);
+
+    std::vector<std::string> values;
+    for (size_t i = 0; i < 2 * elementCount; i++) {
+        values.push_back("queued-value-" + std::to_string(i * 2654435761u % (2 * elementCount)));
+    }
+    std::vector<encstrset_request> requests(operationCount);
+    for (size_t i = 0; i < operationCount; i++) {
+        const std::string &value = values[i * 40503u % values.size()];
+        encstrset_operation operation = i % 20 == 0 ? ENCSTRSET_INSERT : i % 20 == 1 ? ENCSTRSET_REMOVE
+                                                                                      : ENCSTRSET_TEST;
+        requests[i] = {i, 0, operation, value.data(), value.size(), "key", 3};
+    }
+
+    for (bool queued : {false, true}) {
+        unsigned long id = encstrset_new();
+        for (size_t i = 0; i < elementCount; i++) {
+            encstrset_insert(id, values[i].c_str(), "key");
+        }
+        for (auto &request : requests) {
+            request.id = id;
+        }
+        std::vector<double> latencies(operationCount);
+        auto start = Clock::now();
+        if (!queued) {
+            for (size_t i = 0; i < operationCount; i++) {
+                const encstrset_request &request = requests[i];
+                auto begin = Clock::now();
+                switch (request.operation) {
+                    case ENCSTRSET_INSERT:
+                        encstrset_insert_n(id, request.value, request.value_length, "key", 3);
+                        break;
+                    case ENCSTRSET_REMOVE:
+                        encstrset_remove_n(id, request.value, request.value_length, "key", 3);
+                        break;
+                    default:
+                        encstrset_test_n(id, request.value, request.value_length, "key", 3);
+                        break;
+                }
+                latencies[i] = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+            }
+        } else {
+            encstrset_queue *queue = encstrset_queue_create(workers, 4 * burst * workers, nullptr, nullptr);
+            std::vector<Clock::time_point> submitted(operationCount);
+            std::vector<encstrset_completion> completions(burst);
+            size_t next = 0, completed = 0;
+            while (completed < operationCount) {
+                size_t count = std::min(burst, operationCount - next);
+                Clock::time_point now = Clock::now();
+                for (size_t i = next; i < next + count; i++) {
+                    submitted[i] = now;
+                }
+                size_t accepted = encstrset_queue_submit(queue, &requests[next], count);
+                next += accepted;
+                // Blocks only once the queue is full, or nothing is left.
+                size_t polled = encstrset_queue_poll(queue, completions.data(), completions.size(),
+                                                     accepted < count || next == operationCount);
+                now = Clock::now();
+                for (size_t i = 0; i < polled; i++) {
+                    size_t cookie = completions[i].cookie;
+                    latencies[cookie] = std::chrono::duration<double, std::nano>(now - submitted[cookie]).count();
+                }
+                completed += polled;
+            }
+            encstrset_queue_destroy(queue);
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        encstrset_delete(id);
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) {
+            return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))];
+        };
+        std::printf("%-12s%14.2f%14.0f%14.0f%14.0f\n", queued ? "queued" : "direct",
+                    operationCount / elapsed.count() / 1e6, percentile(0.5), percentile(0.99), percentile(0.999));
+    }
+}
+
+// Saving a set, loading it back from the snapshot and answering the first
+// queries, against rebuilding it by inserting every value again.
+void printSnapshot(size_t elementCount) {
+    const char *path = "encstrset_bench.snapshot";
+    std::printf("%-12s%14s%14s%14s%14s   (%zu elements)\n", "value", "rebuild ms", "save ms", "load ms",
+                "1k tests ms", elementCount);
+    for (size_t valueLength : {8, 40}) {
+        std::vector<std::string> values;
+        for (size_t i = 0; i < elementCount; i++) {
+            std::string value(valueLength, 's');
+            std::string number = std::to_string(i);
+            values.push_back(value.replace(value.size() - number.size(), number.size(), number));
+        }
+
+        auto start = Clock::now();
+        unsigned long id = encstrset_new();
+        for (const auto &value : values) {
+            encstrset_insert(id, value.c_str(), "key");
+        }
+        std::chrono::duration<double, std::milli> rebuild = Clock::now() - start;
+        start = Clock::now();
+        encstrset_save(id, path);
+        std::chrono::duration<double, std::milli> save = Clock::now() - start;
+        encstrset_delete(id);
+
+        start = Clock::now();
+        id = encstrset_load(path, false);
+        std::chrono::duration<double, std::milli> load = Clock::now() - start;
+        start = Clock::now();
+        for (size_t i = 0; i < 1000; i++) {
+            encstrset_test(id, values[i * 2654435761u % elementCount].c_str(), "key");
+        }
+        std::chrono::duration<double, std::milli> tests = Clock::now() - start;
+        encstrset_delete(id);
+        std::remove(path);
+
+        std::printf("%-12zu%14.2f%14.2f%14.3f%14.3f\n", valueLength, rebuild.count(), save.count(), load.count(),
+                    tests.count());
+    }
+}
+
+// Inserts per second with each thread inserting into a set of its own,
+// without a journal and with either durability mode.
+void printJournal() {
+    const char *path = "encstrset_bench.journal";
+    const int insertsPerThread = 2000;
+    std::printf("%-12s%14s%14s%14s   (kops/s)\n", "threads", "no journal", "sync each", "group commit");
+    for (unsigned int threadCount : {1u, 4u, 16u}) {
+        std::printf("%-12u", threadCount);
+        for (int mode = -1; mode <= ENCSTRSET_GROUP_COMMIT; mode++) {
+            if (mode >= 0) {
+                encstrset_journal_open(path, encstrset_durability(mode));
+            }
+            std::vector<unsigned long> ids;
+            for (unsigned int t = 0; t < threadCount; t++) {
+                ids.push_back(encstrset_new());
+            }
+            std::vector<std::thread> threads;
+            auto start = Clock::now();
+            for (unsigned int t = 0; t < threadCount; t++) {
+                threads.emplace_back([&, t] {
+                    for (int i = 0; i < insertsPerThread; i++) {
+                        encstrset_insert(ids[t], ("value-" + std::to_string(i)).c_str(), "key");
+                    }
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+            std::chrono::duration<double> elapsed = Clock::now() - start;
+            std::printf("%14.1f", double(threadCount) * insertsPerThread / elapsed.count() / 1e3);
+            for (unsigned long id : ids) {
+                encstrset_delete(id);
+            }
+            if (mode >= 0) {
+                encstrset_journal_close();
+                std::remove(path);
+            }
+        }
+        std::printf("\n");
+    }
+}
+
+// Cost of tracing: inserts and tests per second with no trace running
+// and with every call traced.
+void printTracing() {
+    const char *path = "encstrset_bench.trace";
+    const int valueCount = 1 << 16;
+    const int rounds = 16;
+    std::vector<std::string> values;
+    for (int i = 0; i < valueCount; i++) {
+        values.push_back("value-" + std::to_string(i));
+    }
+    std::printf("%-12s%14s%14s   (Mops/s)\n", "tracing", "insert", "test");
+    for (bool traced : {false, true, false, true}) {
+        if (traced) {
+            encstrset_trace_start(path);
+        }
+        double rates[2];
+        for (int test = 0; test < 2; test++) {
+            unsigned long id = encstrset_new();
+            if (test) {
+                for (const auto &value : values) {
+                    encstrset_insert(id, value.c_str(), "key");
+                }
+            }
+            auto start = Clock::now();
+            for (int round = 0; round < rounds; round++) {
+                for (const auto &value : values) {
+                    if (test) {
+                        encstrset_test(id, value.c_str(), "key");
+                    } else {
+                        encstrset_insert(id, value.c_str(), "key");
+                    }
+                }
+            }
+            std::chrono::duration<double> elapsed = Clock::now() - start;
+            rates[test] = double(rounds) * valueCount / elapsed.count() / 1e6;
+            encstrset_delete(id);
+        }
+        if (traced) {
+            encstrset_trace_stop();
+            std::remove(path);
+        }
+        std::printf("%-12s%14.2f%14.2f\n", traced ? "on" : "off", rates[0], rates[1]);
+    }
+}
+
+// Rate of encstrset_test_k on a small set by set number and through a
+// handle, with few or many other sets in the registry.
+void printHandles() {
+    const int valueCount = 16;
+    const int lookups = 1 << 23;
+    std::printf("%-12s%14s%14s   (Mops/s)\n", "other sets", "by number", "by handle");
+    encstrset_key *key = encstrset_key_prepare("key");
+    for (int otherCount : {0, 1 << 18}) {
+        std::vector<unsigned long> others;
+        for (int i = 0; i < otherCount; i++) {
+            others.push_back(encstrset_new());
+        }
+        unsigned long id = encstrset_new();
+        std::vector<std::string> values;
+        for (int i = 0; i < valueCount; i++) {
+            values.push_back("value-" + std::to_string(i));
+            encstrset_insert_k(id, values.back().c_str(), key);
+        }
+        encstrset_handle *handle = encstrset_open(id);
+
+        std::printf("%-12d", otherCount);
+        for (bool byHandle : {false, true}) {
+            size_t hits = 0;
+            auto start = Clock::now();
+            for (int i = 0; i < lookups; i++) {
+                const char *value = values[i % valueCount].c_str();
+                hits += byHandle ? encstrset_test_hk(handle, value, key) : encstrset_test_k(id, value, key);
+            }
+            std::chrono::duration<double> elapsed = Clock::now() - start;
+            if (hits != size_t(lookups)) {
+                std::fprintf(stderr, "unexpected miss\n");
+            }
+            std::printf("%14.2f", lookups / elapsed.count() / 1e6);
+        }
+        std::printf("\n");
+
+        encstrset_close(handle);
+        encstrset_delete(id);
+        for (unsigned long other : others) {
+            encstrset_delete(other);
+        }
+    }
+    encstrset_key_release(key);
+}
+
+// Time of a hit in encstrset_test, which finds the lengths of value and
+// key itself, against encstrset_test_n, which is given them.
+void printLengths() {
+    std::printf("%-12s%14s%14s   (ns per test)\n", "value", "terminated", "with length");
+    const std::string key = "key-0123456789";
+    for (size_t valueLength : {8, 64, 1024, 65536}) {
+        std::string value(valueLength, 'v');
+        unsigned long id = encstrset_new();
+        encstrset_insert(id, value.c_str(), key.c_str());
+
+        size_t rounds = (size_t(1) << 28) / (valueLength + 64);
+        std::printf("%-12zu", valueLength);
+        for (bool withLength : {false, true}) {
+            size_t hits = 0;
+            auto start = Clock::now();
+            for (size_t i = 0; i < rounds; i++) {
+                hits += withLength ? encstrset_test_n(id, value.data(), value.size(), key.data(), key.size())
+                                   : encstrset_test(id, value.c_str(), key.c_str());
+            }
+            std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+            if (hits != rounds) {
+                std::fprintf(stderr, "unexpected miss\n");
+            }
+            std::printf("%14.1f", elapsed.count() / double(rounds));
+        }
+        std::printf("\n");
+        encstrset_delete(id);
+    }
+}
+
+// Loading a file of lines with encstrset_load_lines, reading included,
+// against inserting the same lines from memory one by one, where every
+// value appears on two lines.
+void printLoadLines(size_t lineCount) {
+    const char *path = "encstrset_bench.lines";
+    std::printf("%-12s%14s%14s   (Mlines/s, %zu lines, %u threads)\n", "value", "insert", "load_lines",
+                lineCount, std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t valueLength : {8, 40}) {
+        std::vector<std::string> lines;
+        FILE *file = std::fopen(path, "wb");
+        for (size_t i = 0; i < lineCount; i++) {
+            std::string value(valueLength, 'l');
+            std::string number = std::to_string(i * 2654435761u % (lineCount / 2));
+            lines.push_back(value.replace(value.size() - number.size(), number.size(), number));
+            std::fprintf(file, "%s\n", lines.back().c_str());
+        }
+        std::fclose(file);
+
+        unsigned long id = encstrset_new();
+        auto start = Clock::now();
+        for (const auto &line : lines) {
+            encstrset_insert(id, line.c_str(), "key");
+        }
+        std::chrono::duration<double> insert = Clock::now() - start;
+        encstrset_delete(id);
+
+        id = encstrset_new();
+        start = Clock::now();
+        encstrset_load_lines(id, path, "key", '\n');
+        std::chrono::duration<double> load = Clock::now() - start;
+        encstrset_delete(id);
+        std::remove(path);
+
+        std::printf("%-12zu%14.2f%14.2f\n", valueLength, lineCount / insert.count() / 1e6,
+                    lineCount / load.count() / 1e6);
+    }
+}
+
+// Total encstrset_test rate with 1..N threads, all querying one set or
+// each querying a set of its own.
+void printScaling() {
+    const int valuesPerSet = 1 << 14;
+    const int lookupsPerThread = 1 << 21;
+    unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::string> values;
+    for (int i = 0; i < valuesPerSet; i++) {
+        values.push_back("value-" + std::to_string(i));
+    }
+    std::vector<unsigned long> ids;
+    for (unsigned int t = 0; t < maxThreads; t++) {
+        ids.push_back(encstrset_new());
+        for (const auto &value : values) {
+            encstrset_insert(ids.back(), value.c_str(), "key");
+        }
+    }
+
+    std::printf("%-12s%14s%14s   (Mops/s)\n", "threads", "shared set", "own set");
+    for (unsigned int threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+        std::printf("%-12u", threadCount);
+        for (bool ownSet : {false, true}) {
+            std::vector<std::thread> threads;
+            auto start = Clock::now();
+            for (unsigned int t = 0; t < threadCount; t++) {
+                threads.emplace_back([&, t] {
+                    unsigned long id = ownSet ? ids[t] : ids[0];
+                    for (int i = 0; i < lookupsPerThread; i++) {
+                        encstrset_test(id, values[(i * 7 + t) % valuesPerSet].c_str(), "key");
+                    }
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+            std::chrono::duration<double> elapsed = Clock::now() - start;
+            std::printf("%14.2f", double(threadCount) * lookupsPerThread / elapsed.count() / 1e6);
+        }
+        std::printf("\n");
+    }
+
+    for (unsigned long id : ids) {
+        encstrset_delete(id);
+    }
+}
+
+void printTable(bool prepared) {
+    const size_t valueLengths[] = {16, 64, 256, 4096, 65536, 1 << 20};
+    const size_t keyLengths[] = {1, 3, 16, 64, 300};
+
+    std::printf("%-12s", prepared ? "prepared" : "plain");
+    for (size_t keyLength : keyLengths) {
+        std::printf("%10zu", keyLength);
+    }
+    std::printf("   (GB/s, value length \\ key length)\n");
+
+    for (size_t valueLength : valueLengths) {
+        std::printf("%-12zu", valueLength);
+        for (size_t keyLength : keyLengths) {
+            std::printf("%10.2f", testThroughput(valueLength, keyLength, prepared));
+        }
+        std::printf("\n");
+    }
+}
+
+// The suite: one CSV row per measurement, for comparing releases. Every
+// row gives the operation, the set size, the value length distribution,
+// the key length (-1 for NULL), the share of lookups that hit, the thread
+// count, the number of timed operations, their rate, their median and
+// 99th percentile latency, and the peak resident set size while the row
+// was measured.
+namespace suite {
+    using Nanoseconds = std::chrono::duration<double, std::nano>;
+
+    // Latencies are taken for at most this many operations of a row, spread
+    // evenly over them; the rate always covers all of them.
+    const size_t maxSamples = size_t(1) << 20;
+
+    enum class Values {
+        Short,  // 8 bytes, stored inline
+        Long,   // 40 bytes, stored in the arena
+        Mixed   // 4 to 67 bytes, and 1 in 16 of 256 bytes
+    };
+
+    const char *valuesName(Values values) {
+        switch (values) {
+            case Values::Short:
+                return "short8";
+            case Values::Long:
+                return "long40";
+            default:
+                return "mixed";
+        }
+    }
+
+    // Writes the i-th value of a distribution into buffer (of at least 300
+    // bytes). Values with different tags never collide.
+    const char *valueFor(Values values, size_t i, char tag, char *buffer) {
+        size_t length;
+        uint64_t mixed = (i + 1) * 0x9E3779B97F4A7C15ull;
+        switch (values) {
+            case Values::Short:
+                length = 8;
+                break;
+            case Values::Long:
+                length = 40;
+                break;
+            default:
+                length = (mixed >> 60) == 0 ? 256 : 4 + (mixed >> 32) % 64;
+                break;
+        }
+        int digits = std::snprintf(buffer, 32, "%c%zx", tag, i);
+        length = std::max(length, size_t(digits));
+        for (size_t j = size_t(digits); j < length; j++) {
+            buffer[j] = static_cast<char>('a' + (i + j) % 26);
+        }
+        buffer[length] = '\0';
+        return buffer;
+    }
+
+    // Linux lets a process reset its peak resident set size; elsewhere the
+    // peak since the start is reported.
+    void resetPeakRss() {
+        if (FILE *clearRefs = std::fopen("/proc/self/clear_refs", "w")) {
+            std::fputs("5", clearRefs);
+            std::fclose(clearRefs);
+        }
+    }
+
+    long peakRssKilobytes() {
+        long peak = -1;
+        if (FILE *status = std::fopen("/proc/self/status", "r")) {
+            char line[256];
+            while (std::fgets(line, sizeof(line), status) != nullptr) {
+                if (std::sscanf(line, "VmHWM: %ld kB", &peak) == 1) {
+                    break;
+                }
+            }
+            std::fclose(status);
+        }
+#ifdef RUSAGE_SELF
+        if (peak < 0) {
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            peak = usage.ru_maxrss;
+        }
+#endif
+        return peak;
+    }
+
+    // Cost of reading the clock twice, taken off every latency sample.
+    double timerOverhead() {
+        static const double overhead = [] {
+            double best = 1e9;
+            for (int i = 0; i < 1000; i++) {
+                auto start = Clock::now();
+                Nanoseconds elapsed = Clock::now() - start;
+                best = std::min(best, elapsed.count());
+            }
+            return best;
+        }();
+        return overhead;
+    }
+
+    struct Row {
+        const char *operation;
+        size_t elements;
+        Values values;
+        long keyLength;
+        double hitRatio;
+        unsigned threads;
+    };
+
+    // Times operation(i) for i in [0, count) on each of threads threads
+    // (each thread t calling operation(t, i)) and prints the row.
+    template<typename Operation>
+    void measure(const Row &row, size_t count, Operation operation) {
+        size_t stride = std::max<size_t>(1, count * row.threads / maxSamples);
+        std::vector<std::vector<double>> samples(row.threads);
+        resetPeakRss();
+        std::vector<std::thread> threads;
+        auto start = Clock::now();
+        for (unsigned t = 0; t < row.threads; t++) {
+            auto work = [&, t] {
+                samples[t].reserve(count / stride + 1);
+                for (size_t i = 0; i < count; i++) {
+                    if (i % stride != 0) {
+                        operation(t, i);
+                        continue;
+                    }
+                    auto begin = Clock::now();
+                    operation(t, i);
+                    Nanoseconds elapsed = Clock::now() - begin;
+                    samples[t].push_back(std::max(0.0, elapsed.count() - timerOverhead()));
+                }
+            };
+            if (row.threads == 1) {
+                work();
+            } else {
+                threads.emplace_back(work);
+            }
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+
+        std::vector<double> latencies;
+        for (const auto &threadSamples : samples) {
+            latencies.insert(latencies.end(), threadSamples.begin(), threadSamples.end());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) {
+            return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))];
+        };
+        size_t operations = count * row.threads;
+        std::printf("%s,%zu,%s,%ld,%.2f,%u,%zu,%.0f,%.0f,%.0f,%ld\n", row.operation, row.elements,
+                    valuesName(row.values), row.keyLength, row.hitRatio, row.threads, operations,
+                    operations / elapsed.count(), percentile(0.5), percentile(0.99), peakRssKilobytes());
+        std::fflush(stdout);
+    }
+
+    const char *keyOf(const std::string &key, long keyLength) {
+        return keyLength < 0 ? nullptr : key.c_str();
+    }
+
+    void insertAll(unsigned long id, Values values, size_t count, const char *key, char tag = 'h') {
+        char buffer[300];
+        for (size_t i = 0; i < count; i++) {
+            encstrset_insert(id, valueFor(values, i, tag, buffer), key);
+        }
+    }
+
+    // Lookups of a set of the given size: every operation hits with
+    // probability hitRatio, spread evenly.
+    void measureTests(const Row &row, unsigned long id, const char *key, size_t lookups) {
+        size_t hitsPer64 = size_t(row.hitRatio * 64 + 0.5);
+        measure(row, lookups, [&](unsigned t, size_t i) {
+            thread_local char buffer[300];
+            size_t index = (i * 2654435761u + t * 40503u) % row.elements;
+            bool hit = (i * 37 + t) % 64 < hitsPer64;
+            encstrset_test(id, valueFor(row.values, index, hit ? 'h' : 'm', buffer), key);
+        });
+    }
+
+    // Every operation on a set of the given size, for one value distribution
+    // and key.
+    void measureSize(size_t elements, Values values, long keyLength, bool allOperations) {
+        std::string key(std::max(keyLength, 0L), 'k');
+        const char *keyText = keyOf(key, keyLength);
+        size_t lookups = std::min<size_t>(std::max<size_t>(elements, 100000), 2000000);
+        size_t repeats = std::min<size_t>(std::max<size_t>(1, 1000000 / elements), 100);
+
+        unsigned long id = encstrset_new();
+        measure({"insert", elements, values, keyLength, 1, 1}, elements, [&](unsigned, size_t i) {
+            char buffer[300];
+            encstrset_insert(id, valueFor(values, i, 'h', buffer), keyText);
+        });
+        for (double hitRatio : {1.0, 0.5, 0.0}) {
+            measureTests({"test", elements, values, keyLength, hitRatio, 1}, id, keyText, lookups);
+            if (!allOperations) {
+                break;
+            }
+        }
+        if (!allOperations) {
+            encstrset_delete(id);
+            return;
+        }
+
+        // A copy into an empty set shares the elements; a copy into a set
+        // that already has some merges them.
+        std::vector<unsigned long> copies(repeats);
+        measure({"copy_share", elements, values, keyLength, 1, 1}, repeats, [&](unsigned, size_t i) {
+            copies[i] = encstrset_new();
+            encstrset_copy(id, copies[i]);
+        });
+        measure({"delete_shared", elements, values, keyLength, 1, 1}, repeats, [&](unsigned, size_t i) {
+            encstrset_delete(copies[i]);
+        });
+        // The first write to either side of a shared copy copies the
+        // elements; the second does not.
+        for (auto &copy : copies) {
+            copy = encstrset_new();
+            encstrset_copy(id, copy);
+        }
+        measure({"write_shared", elements, values, keyLength, 0, 1}, repeats, [&](unsigned, size_t i) {
+            char buffer[300];
+            encstrset_insert(copies[i], valueFor(values, i, 'w', buffer), keyText);
+        });
+        measure({"write_owned", elements, values, keyLength, 0, 1}, repeats, [&](unsigned, size_t i) {
+            char buffer[300];
+            encstrset_insert(copies[i], valueFor(values, repeats + i, 'w', buffer), keyText);
+        });
+        for (auto &copy : copies) {
+            encstrset_delete(copy);
+            copy = encstrset_new();
+            encstrset_insert(copy, "already there", keyText);
+        }
+        measure({"copy_merge", elements, values, keyLength, 1, 1}, repeats, [&](unsigned, size_t i) {
+            encstrset_copy(id, copies[i]);
+        });
+        measure({"clear", elements, values, keyLength, 1, 1}, repeats / 2 + 1, [&](unsigned, size_t i) {
+            encstrset_clear(copies[i]);
+        });
+        measure({"delete", elements, values, keyLength, 1, 1}, repeats - (repeats / 2 + 1), [&](unsigned, size_t i) {
+            encstrset_delete(copies[repeats / 2 + 1 + i]);
+        });
+        for (size_t i = 0; i < repeats / 2 + 1; i++) {
+            encstrset_delete(copies[i]);
+        }
+        measure({"remove", elements, values, keyLength, 1, 1}, elements, [&](unsigned, size_t i) {
+            char buffer[300];
+            encstrset_remove(id, valueFor(values, i, 'h', buffer), keyText);
+        });
+        encstrset_delete(id);
+    }
+
+    void measureThreads(size_t elements, unsigned maxThreads) {
+        const size_t lookups = 500000;
+        unsigned long shared = encstrset_new();
+        insertAll(shared, Values::Long, elements, "key");
+        for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+            measureTests({"test", elements, Values::Long, 3, 1, threads}, shared, "key", lookups / threads);
+
+            std::vector<unsigned long> own(threads);
+            for (auto &id : own) {
+                id = encstrset_new();
+            }
+            measure({"insert", elements, Values::Long, 3, 1, threads}, elements, [&](unsigned t, size_t i) {
+                thread_local char buffer[300];
+                encstrset_insert(own[t], valueFor(Values::Long, i, 'h', buffer), "key");
+            });
+            for (unsigned long id : own) {
+                encstrset_delete(id);
+            }
+        }
+        encstrset_delete(shared);
+    }
+
+    void measureLifecycle(size_t count) {
+        std::vector<unsigned long> ids(count);
+        measure({"new", 0, Values::Short, 3, 1, 1}, count, [&](unsigned, size_t i) {
+            ids[i] = encstrset_new();
+        });
+        measure({"delete", 0, Values::Short, 3, 1, 1}, count, [&](unsigned, size_t i) {
+            encstrset_delete(ids[i]);
+        });
+    }
+
+    // Short-lived sets: each operation creates a set, inserts a few values
+    // and deletes it again.
+    void measureChurn(size_t count, unsigned maxThreads) {
+        const size_t valuesPerSet = 4;
+        for (Values values : {Values::Short, Values::Long}) {
+            for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+                measure({"cycle", valuesPerSet, values, 3, 1, threads}, count / threads, [&](unsigned, size_t i) {
+                    thread_local char buffer[300];
+                    unsigned long id = encstrset_new();
+                    for (size_t j = 0; j < valuesPerSet; j++) {
+                        encstrset_insert(id, valueFor(values, i * valuesPerSet + j, 'h', buffer), "key");
+                    }
+                    encstrset_delete(id);
+                });
+            }
+        }
+    }
+
+    void run(size_t maxElements) {
+        std::printf("operation,elements,values,key_length,hit_ratio,threads,ops,ops_per_s,p50_ns,p99_ns,"
+                    "peak_rss_kb\n");
+        measureLifecycle(100000);
+        measureChurn(200000, std::max(4u, std::thread::hardware_concurrency()));
+        for (size_t elements = 1000; elements <= maxElements; elements *= 10) {
+            for (Values values : {Values::Short, Values::Long, Values::Mixed}) {
+                measureSize(elements, values, 3, true);
+            }
+        }
+        size_t keyElements = std::min<size_t>(maxElements, 100000);
+        for (long keyLength : {-1L, 1L, 16L, 64L, 300L}) {
+            measureSize(keyElements, Values::Long, keyLength, false);
+        }
+        measureThreads(keyElements, std::max(4u, std::thread::hardware_concurrency()));
+    }
+}
+
+// Without arguments prints the tables above; with --suite prints the
+// suite as CSV, for sets of up to max_elements (10^6 by default).
+int main(int argc, char **argv) {
+    if (argc >= 2 && std::string(argv[1]) == "--suite") {
+        suite::run(argc >= 3 ? std::strtoull(argv[2], nullptr, 10) : 1000000);
+        return 0;
+    }
+    if (argc != 1) {
+        std::fprintf(stderr, "usage: %s [--suite [max_elements]]\n", argv[0]);
+        return 2;
+    }
+    printTable(false);
+    printTable(true);
+    printScaling();
+    printLargeSet(1000000);
+    printSnapshot(1000000);
+    printJournal();
+    printTracing();
+    printHandles();
+    printLoadLines(4000000);
+    printLengths();
+    printFrozen(4000000);
+    printQueue(1000000);
+    printCompaction(1000000);
+}
@@ -0,0 +1,18 @@
+#include "encstrset_bloom.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace encstrset_detail {
+    BloomFilter::BloomFilter(size_t capacity)
+            : blocks(blockCountFor(capacity)), capacity(capacity) {
+    }
+
+    size_t BloomFilter::bytesFor(size_t capacity) {
+        return blockCountFor(capacity) * sizeof(Block);
+    }
+
+    size_t BloomFilter::blockCountFor(size_t capacity) {
+        return max<size_t>(1, capacity * bitsPerElement / (8 * sizeof(Block)));
+    }
+} // namespace encstrset_detail
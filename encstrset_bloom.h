@@ -0,0 +1,87 @@
+#ifndef ENCSTRSET_ENCSTRSET_BLOOM_H
+#define ENCSTRSET_ENCSTRSET_BLOOM_H
+
+#include "encstrset_common.h"
+#include "encstrset_memory.h"
+#include <vector>
+#include <cstdint>
+#include <new>
+#include <cstddef>
+
+namespace encstrset_detail {
+    // Split-block Bloom filter over ciphertext hashes: a hash picks one
+    // 32-byte block and one bit in each of its eight words, so a lookup
+    // reads a single block. At bitsPerElement bits per element it passes
+    // under 1% of the values it was not given. Bits cannot be taken out,
+    // so the owner rebuilds it once too many of its elements are gone.
+    class BloomFilter {
+    public:
+        static constexpr size_t bitsPerElement = 12;
+
+        // Room for capacity elements before false positives grow.
+        explicit BloomFilter(size_t capacity);
+
+        static void *operator new(size_t size) {
+            return BlockCache::take(size);
+        }
+
+        static void operator delete(void *block, size_t size) {
+            BlockCache::give(block, size);
+        }
+
+        void add(size_t cipherHash) {
+            Block &block = blocks[blockIndex(cipherHash)];
+            auto key = static_cast<uint32_t>(cipherHash);
+            for (size_t i = 0; i < wordCount; i++) {
+                block.words[i] |= bitFor(key, i);
+            }
+        }
+
+        bool mayContain(size_t cipherHash) const {
+            const Block &block = blocks[blockIndex(cipherHash)];
+            auto key = static_cast<uint32_t>(cipherHash);
+            uint32_t missing = 0;
+            for (size_t i = 0; i < wordCount; i++) {
+                missing |= ~block.words[i] & bitFor(key, i);
+            }
+            return missing == 0;
+        }
+
+        size_t designCapacity() const {
+            return capacity;
+        }
+
+        size_t bytes() const {
+            return blocks.size() * sizeof(Block);
+        }
+
+        static size_t bytesFor(size_t capacity);
+
+    private:
+        static constexpr size_t wordCount = 8;
+
+        struct alignas(32) Block {
+            uint32_t words[wordCount] = {};
+        };
+
+        vector<Block, PooledAllocator<Block>> blocks;
+        size_t capacity;
+
+        static size_t blockCountFor(size_t capacity);
+
+        // The mixed hash picks the block and its low half the bits, each
+        // word with its own odd multiplier.
+        size_t blockIndex(size_t cipherHash) const {
+            uint64_t high = (static_cast<uint64_t>(cipherHash) * 0x9E3779B97F4A7C15ULL) >> 32;
+            return static_cast<size_t>((high * blocks.size()) >> 32);
+        }
+
+        static uint32_t bitFor(uint32_t key, size_t word) {
+            static const uint32_t salts[wordCount] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                                      0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+            return uint32_t(1) << ((key * salts[word]) >> 27);
+        }
+    };
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_BLOOM_H
@@ -0,0 +1,34 @@
+#include "encstrset_common.h"
+
+using namespace std;
+
+namespace encstrset_detail {
+    ostream &operator<<(ostream &stream, QuotedOrNull value) {
+        if (value.text == nullptr) {
+            return stream << "NULL";
+        }
+        if (value.length == string_view::npos) {
+            return stream << '"' << value.text << '"';
+        }
+        return stream << '"' << string_view(value.text, value.length) << '"';
+    }
+
+    void writeHexCipher(ostream &stream, string_view cipher) {
+        static const char digits[] = "0123456789ABCDEF";
+        char buffer[3 * 64];
+        size_t used = 0;
+        for (size_t i = 0; i < cipher.size(); i++) {
+            auto byte = static_cast<unsigned char>(cipher[i]);
+            if (i > 0) {
+                buffer[used++] = ' ';
+            }
+            buffer[used++] = digits[byte >> 4];
+            buffer[used++] = digits[byte & 0xF];
+            if (used > sizeof(buffer) - 3) {
+                stream.write(buffer, static_cast<streamsize>(used));
+                used = 0;
+            }
+        }
+        stream.write(buffer, static_cast<streamsize>(used));
+    }
+} // namespace encstrset_detail
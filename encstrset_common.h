@@ -0,0 +1,117 @@
+#ifndef ENCSTRSET_ENCSTRSET_COMMON_H
+#define ENCSTRSET_ENCSTRSET_COMMON_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+#include <sstream>
+#include <ostream>
+#include <iostream>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ENCSTRSET_X86_DISPATCH 1
+#endif
+
+#if __has_include(<sys/mman.h>) && __has_include(<unistd.h>)
+#define ENCSTRSET_POSIX_FILES 1
+#endif
+
+#define SET_NOT_EXIST(x) ": set #" << x << " does not exist"
+
+#define STRING_OR_NULL(x) QuotedOrNull{x}
+
+#define BYTES_OR_NULL(x, length) (QuotedOrNull{x, length})
+
+// Each line is formatted into a per-thread buffer and written to cerr at
+// once, so that lines of concurrent calls do not interleave and cerr's
+// flags are never changed.
+#define DEBUG_WITH_CYPHER_AS(function, x, cypher, y) \
+    do                                              \
+    {                                               \
+        if (debug)                                  \
+        {                                           \
+            DebugLine line;                         \
+            line.stream << function << x;           \
+            writeHexCipher(line.stream, cypher);    \
+            line.stream << y;                       \
+        }                                           \
+    } while (0);
+
+#define DEBUG_WITH_CYPHER(x, cypher, y) DEBUG_WITH_CYPHER_AS(__func__, x, cypher, y)
+
+#define DEBUG_AS(function, x)                       \
+    do                                              \
+    {                                               \
+        if (debug)                                  \
+        {                                           \
+            DebugLine line;                         \
+            line.stream << function << x;           \
+        }                                           \
+    } while (0)
+
+#define DEBUG(x) DEBUG_AS(__func__, x)
+
+// Internals of the library, shared by its translation units.
+namespace encstrset_detail {
+    using namespace std;
+
+#ifdef NDEBUG
+    const bool debug = false;
+#else
+    const bool debug = true;
+#endif
+
+    // Text up to its NUL byte, or length bytes of it if given.
+    struct QuotedOrNull {
+        const char *text;
+        size_t length = string_view::npos;
+    };
+
+    ostream &operator<<(ostream &stream, QuotedOrNull value);
+
+    // Bytes as space-separated pairs of uppercase hex digits.
+    void writeHexCipher(ostream &stream, string_view cipher);
+
+    class DebugLine {
+    public:
+        ostringstream &stream;
+
+        DebugLine() : stream(buffer()) {
+            stream.str(string());
+        }
+
+        DebugLine(const DebugLine &) = delete;
+
+        DebugLine &operator=(const DebugLine &) = delete;
+
+        ~DebugLine() {
+            stream << '\n';
+            string text = stream.str();
+            cerr.write(text.data(), static_cast<streamsize>(text.size()));
+        }
+
+    private:
+        static ostringstream &buffer() {
+            thread_local ostringstream stream;
+            return stream;
+        }
+    };
+
+    using SetNumber = unsigned long;
+
+    inline size_t lowestBit(uint32_t mask) {
+#ifdef __GNUC__
+        return static_cast<size_t>(__builtin_ctz(mask));
+#else
+        size_t bit = 0;
+        while ((mask & 1u) == 0) {
+            mask >>= 1;
+            bit++;
+        }
+        return bit;
+#endif
+    }
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_COMMON_H
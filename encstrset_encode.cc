@@ -0,0 +1,146 @@
+#include "encstrset_encode.h"
+#include "encstrset_hash.h"
+#include <cstdint>
+#include <algorithm>
+
+#ifdef ENCSTRSET_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+    using namespace encstrset_detail;
+
+    using XorKernel = void (*)(char *bytes, const char *keyStream, size_t length);
+
+    void xorScalar(char *bytes, const char *keyStream, size_t length) {
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+            uint64_t block, keyBlock;
+            memcpy(&block, bytes + i, sizeof(block));
+            memcpy(&keyBlock, keyStream + i, sizeof(keyBlock));
+            block ^= keyBlock;
+            memcpy(bytes + i, &block, sizeof(block));
+        }
+        for (; i < length; i++) {
+            bytes[i] ^= keyStream[i];
+        }
+    }
+
+#ifdef ENCSTRSET_X86_DISPATCH
+    __attribute__((target("sse2")))
+    void xorSse2(char *bytes, const char *keyStream, size_t length) {
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i));
+            __m128i keyBlock = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keyStream + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(bytes + i), _mm_xor_si128(block, keyBlock));
+        }
+        xorScalar(bytes + i, keyStream + i, length - i);
+    }
+
+    __attribute__((target("avx2")))
+    void xorAvx2(char *bytes, const char *keyStream, size_t length) {
+        size_t i = 0;
+        for (; i + 32 <= length; i += 32) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i));
+            __m256i keyBlock = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keyStream + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(bytes + i), _mm256_xor_si256(block, keyBlock));
+        }
+        xorSse2(bytes + i, keyStream + i, length - i);
+    }
+
+    __attribute__((target("avx512f")))
+    void xorAvx512(char *bytes, const char *keyStream, size_t length) {
+        size_t i = 0;
+        for (; i + 64 <= length; i += 64) {
+            __m512i block = _mm512_loadu_si512(bytes + i);
+            __m512i keyBlock = _mm512_loadu_si512(keyStream + i);
+            _mm512_storeu_si512(bytes + i, _mm512_xor_si512(block, keyBlock));
+        }
+        xorAvx2(bytes + i, keyStream + i, length - i);
+    }
+#endif
+
+    XorKernel selectXorKernel() {
+#ifdef ENCSTRSET_X86_DISPATCH
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return xorAvx512;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return xorAvx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return xorSse2;
+        }
+#endif
+        return xorScalar;
+    }
+
+    // Picked once, on first use, so that sets created during static
+    // initialization of other translation units still get a kernel.
+    XorKernel xorKernel() {
+        static const XorKernel kernel = selectXorKernel();
+        return kernel;
+    }
+
+    // Values are encoded and hashed a chunk at a time, so that each chunk is
+    // hashed right after it is encoded, while it is still in the L1 cache.
+    const size_t encodeChunkBytes = 128 * CipherHasher::blockBytes;
+} // namespace
+
+namespace encstrset_detail {
+    size_t keyStreamLength(size_t keyLength, size_t valueLength) {
+        if (keyLength == 0 || keyLength >= keyStreamTargetLength) {
+            return keyLength;
+        }
+        size_t periods = (min(valueLength, keyStreamTargetLength) + keyLength - 1) / keyLength;
+        return max<size_t>(periods, 1) * keyLength;
+    }
+
+    void fillKeyStream(char *stream, size_t length, const char *key, size_t keyLength) {
+        memcpy(stream, key, min(keyLength, length));
+        for (size_t filled = keyLength; filled < length; filled *= 2) {
+            memcpy(stream + filled, stream, min(filled, length - filled));
+        }
+    }
+
+    const char *keyText(const jnp1::encstrset_key *preparedKey) {
+        return preparedKey == nullptr || preparedKey->isNull ? nullptr : preparedKey->text.c_str();
+    }
+
+    void applyKeyStream(char *bytes, size_t length, size_t position, const KeyStream &keyStream) {
+        if (keyStream.size() == 0 || length == 0) {
+            return;
+        }
+        XorKernel kernel = xorKernel();
+        size_t phase = position < keyStream.size() ? position : position % keyStream.size();
+        size_t first = min(length, keyStream.size() - phase);
+        kernel(bytes, keyStream.data() + phase, first);
+        for (size_t offset = first; offset < length; offset += keyStream.size()) {
+            kernel(bytes + offset, keyStream.data(), min(keyStream.size(), length - offset));
+        }
+    }
+
+    size_t encodeAndHash(char *bytes, size_t length, const KeyStream &keyStream) {
+        CipherHasher hasher(length);
+        for (size_t offset = 0;; offset += encodeChunkBytes) {
+            size_t chunkLength = min(encodeChunkBytes, length - offset);
+            applyKeyStream(bytes + offset, chunkLength, offset, keyStream);
+            if (offset + chunkLength == length) {
+                size_t blocksLength = chunkLength / CipherHasher::blockBytes * CipherHasher::blockBytes;
+                hasher.addBlocks(bytes + offset, blocksLength);
+                return static_cast<size_t>(hasher.finish(bytes + offset + blocksLength,
+                                                         chunkLength - blocksLength));
+            }
+            hasher.addBlocks(bytes + offset, chunkLength);
+        }
+    }
+
+    size_t encodeInto(string &encodeResult, string_view value, const KeyStream &keyStream) {
+        encodeResult.assign(value);
+        return encodeAndHash(encodeResult.data(), encodeResult.size(), keyStream);
+    }
+} // namespace encstrset_detail
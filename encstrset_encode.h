@@ -0,0 +1,152 @@
+#ifndef ENCSTRSET_ENCSTRSET_ENCODE_H
+#define ENCSTRSET_ENCSTRSET_ENCODE_H
+
+#include "encstrset.h"
+#include "encstrset_common.h"
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <new>
+#include <cstddef>
+#include <utility>
+
+namespace jnp1 {
+    // Key stream expanded once by encstrset_key_prepare and kept, 64-byte
+    // aligned, for the lifetime of the handle.
+    struct encstrset_key {
+        std::string text;
+        bool isNull = true;
+        char *stream = nullptr;
+        size_t length = 0;
+
+        encstrset_key() = default;
+
+        encstrset_key(const encstrset_key &) = delete;
+
+        encstrset_key &operator=(const encstrset_key &) = delete;
+
+        ~encstrset_key() {
+            if (stream != nullptr) {
+                ::operator delete(stream, std::align_val_t(64));
+            }
+        }
+    };
+} // namespace jnp1
+
+namespace encstrset_detail {
+    // Bytes of key stream prepared per call; shorter keys are repeated up to
+    // a whole number of periods so that the XOR kernel gets long runs.
+    const size_t keyStreamTargetLength = 256;
+
+    inline size_t lengthOrZero(const char *text) {
+        return text == nullptr ? 0 : strlen(text);
+    }
+
+    inline size_t lengthOrZero(const char *bytes, size_t length) {
+        return bytes == nullptr ? 0 : length;
+    }
+
+    // Length of the key stream needed to cover valueLength bytes at once:
+    // a whole number of key periods, or the key itself once it is long.
+    size_t keyStreamLength(size_t keyLength, size_t valueLength);
+
+    void fillKeyStream(char *stream, size_t length, const char *key, size_t keyLength);
+
+    // The key repeated back to back, long enough to cover a whole block of
+    // the value at once. Keys at least as long as the target are used as is.
+    class KeyStream {
+    public:
+        KeyStream(const char *key, size_t valueLength) : KeyStream(key, lengthOrZero(key), valueLength) {
+        }
+
+        KeyStream(const char *key, size_t keyLength, size_t valueLength) {
+            length = keyStreamLength(keyLength, valueLength);
+            if (length == keyLength) {
+                stream = key;
+                return;
+            }
+            fillKeyStream(buffer, length, key, keyLength);
+            stream = buffer;
+        }
+
+        explicit KeyStream(const jnp1::encstrset_key *preparedKey) {
+            if (preparedKey != nullptr) {
+                stream = preparedKey->stream;
+                length = preparedKey->length;
+            }
+        }
+
+        KeyStream(const KeyStream &) = delete;
+
+        KeyStream &operator=(const KeyStream &) = delete;
+
+        const char *data() const {
+            return stream;
+        }
+
+        size_t size() const {
+            return length;
+        }
+
+    private:
+        alignas(64) char buffer[2 * keyStreamTargetLength];
+        const char *stream = nullptr;
+        size_t length = 0;
+    };
+
+    const char *keyText(const jnp1::encstrset_key *preparedKey);
+
+    // Encodes bytes found at position of a value.
+    void applyKeyStream(char *bytes, size_t length, size_t position, const KeyStream &keyStream);
+
+    // Encodes length bytes of a value in place and returns the hash of the
+    // ciphertext, the same as CipherTable::hash.
+    size_t encodeAndHash(char *bytes, size_t length, const KeyStream &keyStream);
+
+    // Returns the hash of the ciphertext, see encodeAndHash.
+    size_t encodeInto(string &encodeResult, string_view value, const KeyStream &keyStream);
+
+    // The ciphertext of a single value, encoded into a buffer kept by the
+    // calling thread rather than a string of its own, so that probing the
+    // table with it does not allocate once the thread has seen a value as
+    // long. A buffer grown past scratchRetainBytes is released again. Only
+    // one may exist per thread at a time.
+    const size_t scratchRetainBytes = size_t(1) << 20;
+
+    class ScratchCipher {
+    public:
+        ScratchCipher(string_view value, const KeyStream &keyStream) : buffer(threadBuffer()) {
+            buffer.assign(value);
+            cipherHash = encodeAndHash(buffer.data(), buffer.size(), keyStream);
+        }
+
+        ScratchCipher(const ScratchCipher &) = delete;
+
+        ScratchCipher &operator=(const ScratchCipher &) = delete;
+
+        ~ScratchCipher() {
+            if (buffer.capacity() > scratchRetainBytes) {
+                string().swap(buffer);
+            }
+        }
+
+        string_view cipher() const {
+            return buffer;
+        }
+
+        size_t hash() const {
+            return cipherHash;
+        }
+
+    private:
+        string &buffer;
+        size_t cipherHash;
+
+        static string &threadBuffer() {
+            thread_local string buffer;
+            return buffer;
+        }
+    };
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_ENCODE_H
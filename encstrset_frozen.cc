@@ -0,0 +1,90 @@
+#include "encstrset_frozen.h"
+
+using namespace std;
+
+namespace encstrset_detail {
+    bool FrozenCiphers::place(const vector<uint64_t> &keys, vector<uint32_t> &positions) {
+        vector<uint32_t> bucketStarts(bucketCount + 1, 0);
+        for (uint64_t key : keys) {
+            bucketStarts[bucketOf(key) + 1]++;
+        }
+        size_t largestBucket = 0;
+        for (size_t bucket = 0; bucket < bucketCount; bucket++) {
+            largestBucket = max<size_t>(largestBucket, bucketStarts[bucket + 1]);
+            bucketStarts[bucket + 1] += bucketStarts[bucket];
+        }
+        vector<uint32_t> members(keys.size());
+        vector<uint32_t> filled(bucketStarts.begin(), bucketStarts.end() - 1);
+        for (size_t i = 0; i < keys.size(); i++) {
+            members[filled[bucketOf(keys[i])]++] = uint32_t(i);
+        }
+        // Buckets by decreasing size, by counting sort.
+        vector<uint32_t> sizeStarts(largestBucket + 2, 0);
+        for (size_t bucket = 0; bucket < bucketCount; bucket++) {
+            sizeStarts[largestBucket - (bucketStarts[bucket + 1] - bucketStarts[bucket]) + 1]++;
+        }
+        for (size_t i = 1; i < sizeStarts.size(); i++) {
+            sizeStarts[i] += sizeStarts[i - 1];
+        }
+        vector<uint32_t> order(bucketCount);
+        for (size_t bucket = 0; bucket < bucketCount; bucket++) {
+            order[sizeStarts[largestBucket - (bucketStarts[bucket + 1] - bucketStarts[bucket])]++] =
+                    uint32_t(bucket);
+        }
+
+        vector<bool> taken(positionRange, false);
+        vector<size_t> trial;
+        for (uint32_t bucket : order) {
+            size_t begin = bucketStarts[bucket], end = bucketStarts[bucket + 1];
+            if (begin == end) {
+                break;
+            }
+            bool found = false;
+            for (uint32_t pilot = 0; pilot <= maxPilot && !found; pilot++) {
+                trial.clear();
+                found = true;
+                for (size_t member = begin; member < end && found; member++) {
+                    size_t position = positionOf(keys[members[member]], pilot);
+                    found = !taken[position] && find(trial.begin(), trial.end(), position) == trial.end();
+                    trial.push_back(position);
+                }
+                if (found) {
+                    pilots[bucket] = uint16_t(pilot);
+                    for (size_t member = begin; member < end; member++) {
+                        taken[trial[member - begin]] = true;
+                        positions[members[member]] = uint32_t(trial[member - begin]);
+                    }
+                }
+            }
+            if (!found) {
+                return false;
+            }
+        }
+
+        // Every position taken past count has a free one below it.
+        size_t freePosition = 0;
+        for (size_t position = count; position < positionRange; position++) {
+            if (taken[position]) {
+                while (taken[freePosition]) {
+                    freePosition++;
+                }
+                remap[position - count] = uint32_t(freePosition++);
+            }
+        }
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (positions[i] >= count) {
+                positions[i] = remap[positions[i] - count];
+            }
+        }
+        return true;
+    }
+
+    FrozenCiphers::FrozenCiphers(size_t count)
+            : count(count), bucketCount(count / 3 + 1), positionRange(count + count / 32 + 1),
+              arrays(arrayBytes()) {
+        memset(arrays.get(), 0, arrayBytes());
+        entries = reinterpret_cast<uint64_t *>(arrays.get());
+        remap = reinterpret_cast<uint32_t *>(entries + count);
+        pilots = reinterpret_cast<uint16_t *>(remap + (positionRange - count));
+    }
+} // namespace encstrset_detail
@@ -0,0 +1,218 @@
+#ifndef ENCSTRSET_ENCSTRSET_FROZEN_H
+#define ENCSTRSET_ENCSTRSET_FROZEN_H
+
+#include "encstrset_common.h"
+#include "encstrset_memory.h"
+#include "encstrset_hash.h"
+#include <vector>
+#include <string_view>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <new>
+#include <cstddef>
+
+namespace encstrset_detail {
+    // Read-only form of a set's ciphertexts (see encstrset_freeze), in the
+    // style of PTHash. A minimal perfect hash gives each of the n
+    // ciphertexts a position of its own in [0, n): the hash picks one of
+    // about n / 3 buckets, and the bucket's pilot, chosen when the hash is
+    // built, picks a position for each ciphertext in it. Positions are drawn
+    // from a range slightly wider than n, so that the last buckets still
+    // find free ones quickly, and the few past n are remapped to those left
+    // free below it. A position holds a 16-bit fingerprint of the hash and
+    // the offset of the ciphertext in a blob of length-prefixed ciphertexts
+    // kept in position order, so a test reads the pilot and the position
+    // and only reads the ciphertext if the fingerprint matches.
+    class FrozenCiphers {
+    public:
+        FrozenCiphers(const FrozenCiphers &) = delete;
+
+        FrozenCiphers &operator=(const FrozenCiphers &) = delete;
+
+        // The object itself comes from the caches too, like all memory of
+        // a set.
+        static void *operator new(size_t size) {
+            return BlockCache::take(size);
+        }
+
+        static void operator delete(void *block, size_t size) {
+            BlockCache::give(block, size);
+        }
+
+        // visitElements(visitor) calls visitor(cipher) for each of the count
+        // ciphertexts, in the same order every time. Null if no perfect hash
+        // was found, which in practice only happens if two ciphertexts share
+        // a hash.
+        template<typename ElementsVisitor>
+        static unique_ptr<FrozenCiphers> build(size_t count, ElementsVisitor visitElements) {
+            if (count > maxCount) {
+                return nullptr;
+            }
+            vector<uint64_t> keys;
+            keys.reserve(count);
+            visitElements([&](string_view cipher) {
+                keys.push_back(static_cast<size_t>(CipherHasher::hash(cipher.data(), cipher.size())));
+            });
+            unique_ptr<FrozenCiphers> frozen(new FrozenCiphers(count));
+            vector<uint32_t> positions(count);
+            bool placed = false;
+            for (uint64_t attempt = 1; attempt <= maxAttempts && !placed; attempt++) {
+                frozen->seed = mixBits(attempt);
+                placed = frozen->place(keys, positions);
+            }
+            if (!placed) {
+                return nullptr;
+            }
+            frozen->fillBlob(keys, positions, visitElements);
+            return frozen;
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        // cipherHash is the hash the table uses (see CipherTable::hash).
+        bool contains(string_view cipher, uint64_t cipherHash) const {
+            if (count == 0) {
+                return false;
+            }
+            size_t position = positionOf(cipherHash, pilots[bucketOf(cipherHash)]);
+            if (position >= count) {
+                position = remap[position - count];
+            }
+            return entries[position] >> offsetBits == fingerprintOf(cipherHash) && cipherAt(position) == cipher;
+        }
+
+        void prefetch(uint64_t cipherHash) const {
+#ifdef __GNUC__
+            if (count > 0) {
+                __builtin_prefetch(&pilots[bucketOf(cipherHash)]);
+            }
+#else
+            (void) cipherHash;
+#endif
+        }
+
+        // The ciphertext at position, in [0, size()).
+        string_view cipherAt(size_t position) const {
+            const char *record = blob.get() + (entries[position] & offsetMask);
+            size_t length = 0;
+            for (unsigned shift = 0;; shift += 7) {
+                uint8_t byte = uint8_t(*record++);
+                length |= size_t(byte & 0x7F) << shift;
+                if (byte < 0x80) {
+                    break;
+                }
+            }
+            return string_view(record, length);
+        }
+
+        // Heap memory of the pilots, positions and blob.
+        size_t bytes() const {
+            return sizeof(*this) + arrayBytes() + max<size_t>(1, blobBytes);
+        }
+
+    private:
+        static constexpr size_t maxCount = size_t(0xF0000000);
+        static constexpr uint64_t maxAttempts = 8;
+        static constexpr uint32_t maxPilot = numeric_limits<uint16_t>::max();
+        static constexpr unsigned offsetBits = 48;
+        static constexpr uint64_t offsetMask = (uint64_t(1) << offsetBits) - 1;
+
+        size_t count;
+        size_t bucketCount;
+        size_t positionRange;
+        uint64_t seed = 0;
+        // The entries, remap and pilots, in this order.
+        PooledBytes arrays;
+        uint64_t *entries;
+        uint32_t *remap;
+        uint16_t *pilots;
+        PooledBytes blob;
+        size_t blobBytes = 0;
+
+        explicit FrozenCiphers(size_t count);
+
+        size_t arrayBytes() const {
+            return count * sizeof(uint64_t) + (positionRange - count) * sizeof(uint32_t) +
+                   bucketCount * sizeof(uint16_t);
+        }
+
+        // The finalizer of MurmurHash3.
+        static uint64_t mixBits(uint64_t bits) {
+            bits ^= bits >> 33;
+            bits *= 0xff51afd7ed558ccd;
+            bits ^= bits >> 33;
+            bits *= 0xc4ceb9fe1a85ec53;
+            return bits ^ (bits >> 33);
+        }
+
+        // Maps the high half of bits onto [0, range), for range < 2^32.
+        static size_t reduce(uint64_t bits, size_t range) {
+            return size_t((bits >> 32) * range >> 32);
+        }
+
+        // The ciphertext hash is uniform already, so its high bits pick the
+        // bucket and its low bits are the fingerprint; positions depend on
+        // the seed as well, which changes if a hash has to be built again.
+        static uint64_t fingerprintOf(uint64_t key) {
+            return uint16_t(key);
+        }
+
+        size_t bucketOf(uint64_t key) const {
+            return reduce(key, bucketCount);
+        }
+
+        size_t positionOf(uint64_t key, uint32_t pilot) const {
+            return reduce(mixBits(key ^ seed ^ (pilot + 1) * 0x9e3779b97f4a7c15), positionRange);
+        }
+
+        // Finds a pilot for every bucket, biggest buckets first, and then
+        // the final position of every key; false if a bucket has no pilot
+        // that places all of its keys on free positions.
+        bool place(const vector<uint64_t> &keys, vector<uint32_t> &positions);
+
+        // Lays the ciphertexts out in position order, each after its length
+        // as a varint.
+        template<typename ElementsVisitor>
+        void fillBlob(const vector<uint64_t> &keys, const vector<uint32_t> &positions,
+                      ElementsVisitor visitElements) {
+            size_t index = 0;
+            visitElements([&](string_view cipher) {
+                entries[positions[index++]] = varintBytes(cipher.size()) + cipher.size();
+            });
+            for (size_t position = 0; position < count; position++) {
+                size_t recordBytes = entries[position];
+                entries[position] = blobBytes;
+                blobBytes += recordBytes;
+            }
+            blob = PooledBytes(max<size_t>(1, blobBytes));
+            index = 0;
+            visitElements([&](string_view cipher) {
+                size_t position = positions[index];
+                char *record = blob.get() + entries[position];
+                size_t length = cipher.size();
+                for (; length >= 0x80; length >>= 7) {
+                    *record++ = char((length & 0x7F) | 0x80);
+                }
+                *record++ = char(length);
+                memcpy(record, cipher.data(), cipher.size());
+                entries[position] |= fingerprintOf(keys[index]) << offsetBits;
+                index++;
+            });
+        }
+
+        static size_t varintBytes(size_t length) {
+            size_t bytes = 1;
+            for (; length >= 0x80; length >>= 7) {
+                bytes++;
+            }
+            return bytes;
+        }
+    };
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_FROZEN_H
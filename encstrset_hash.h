@@ -0,0 +1,100 @@
+#ifndef ENCSTRSET_ENCSTRSET_HASH_H
+#define ENCSTRSET_ENCSTRSET_HASH_H
+
+#include "encstrset_common.h"
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+namespace encstrset_detail {
+    // Hash of ciphertexts, in the style of wyhash: three lanes each fold
+    // 16 bytes at a time into their state with a 64x64->128-bit multiply,
+    // so that long inputs are hashed at several bytes per cycle. Input is
+    // fed in whole blocks and then the rest, which lets encoding and hashing
+    // alternate over a long value a chunk at a time (see encodeInto).
+    class CipherHasher {
+    public:
+        static constexpr size_t blockBytes = 48;
+
+        explicit CipherHasher(size_t length) : length(length) {
+            lanes[0] = lanes[1] = lanes[2] = mix(length ^ secrets[0], secrets[1]);
+        }
+
+        // length must be a multiple of blockBytes.
+        void addBlocks(const char *bytes, size_t blocksLength) {
+            uint64_t lane0 = lanes[0], lane1 = lanes[1], lane2 = lanes[2];
+            for (const char *end = bytes + blocksLength; bytes != end; bytes += blockBytes) {
+                lane0 = mix(load(bytes) ^ secrets[1], load(bytes + 8) ^ lane0);
+                lane1 = mix(load(bytes + 16) ^ secrets[2], load(bytes + 24) ^ lane1);
+                lane2 = mix(load(bytes + 32) ^ secrets[3], load(bytes + 40) ^ lane2);
+            }
+            lanes[0] = lane0;
+            lanes[1] = lane1;
+            lanes[2] = lane2;
+        }
+
+        // The final rest of the input, shorter than blockBytes.
+        uint64_t finish(const char *bytes, size_t restLength) const {
+            uint64_t state = lanes[0] ^ lanes[1] ^ lanes[2];
+            for (; restLength > 16; bytes += 16, restLength -= 16) {
+                state = mix(load(bytes) ^ secrets[1], load(bytes + 8) ^ state);
+            }
+            // The last 1 to 16 bytes, read as two words that may overlap.
+            uint64_t first = 0, second = 0;
+            if (restLength >= 8) {
+                first = load(bytes);
+                second = load(bytes + restLength - 8);
+            } else if (restLength >= 4) {
+                first = load32(bytes);
+                second = load32(bytes + restLength - 4);
+            } else if (restLength > 0) {
+                first = uint64_t(uint8_t(bytes[0])) << 16 | uint64_t(uint8_t(bytes[restLength / 2])) << 8 |
+                        uint8_t(bytes[restLength - 1]);
+            }
+            return mix(secrets[1] ^ length, mix(first ^ secrets[1], second ^ state));
+        }
+
+        static uint64_t hash(const char *bytes, size_t length) {
+            CipherHasher hasher(length);
+            size_t blocksLength = length / blockBytes * blockBytes;
+            hasher.addBlocks(bytes, blocksLength);
+            return hasher.finish(bytes + blocksLength, length - blocksLength);
+        }
+
+    private:
+        static constexpr uint64_t secrets[4] = {
+            0x2d358dccaa6c78a5, 0x8bb84b93962eacc9, 0x4b33a62ed433d4a3, 0x4d5a2da51de1aa47
+        };
+
+        uint64_t lanes[3];
+        size_t length;
+
+        static uint64_t load(const char *bytes) {
+            uint64_t word;
+            memcpy(&word, bytes, sizeof(word));
+            return word;
+        }
+
+        static uint64_t load32(const char *bytes) {
+            uint32_t word;
+            memcpy(&word, bytes, sizeof(word));
+            return word;
+        }
+
+        // The high and low halves of a * b, XORed.
+        static uint64_t mix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+            unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+            return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#else
+            uint64_t aHigh = a >> 32, aLow = uint32_t(a), bHigh = b >> 32, bLow = uint32_t(b);
+            uint64_t middle1 = aHigh * bLow, middle2 = aLow * bHigh, low = aLow * bLow;
+            uint64_t carry = ((low >> 32) + uint32_t(middle1) + uint32_t(middle2)) >> 32;
+            uint64_t high = aHigh * bHigh + (middle1 >> 32) + (middle2 >> 32) + carry;
+            return (low + (middle1 << 32) + (middle2 << 32)) ^ high;
+#endif
+        }
+    };
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_HASH_H
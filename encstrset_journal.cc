@@ -0,0 +1,323 @@
+#include "encstrset_journal.h"
+#include "encstrset_memory.h"
+#include "encstrset_sets.h"
+#include "encstrset_algebra.h"
+#include "encstrset_snapshot.h"
+#include <cassert>
+
+#ifdef ENCSTRSET_POSIX_FILES
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+    using namespace encstrset_detail;
+
+    void appendNumber(string &bytes, uint64_t number) {
+        for (; number >= 0x80; number >>= 7) {
+            bytes += static_cast<char>((number & 0x7F) | 0x80);
+        }
+        bytes += static_cast<char>(number);
+    }
+
+    // Registers elements under a set number read from a journal, replacing
+    // any set with that number, and keeps new sets from reusing it.
+    void restoreSet(SetNumber id, ElementsPointer elements) {
+        SetPointer replaced = placeSet(id, allocate_shared<SetEntry>(PooledAllocator<SetEntry>(), move(elements)));
+        if (replaced != nullptr) {
+            replaced->retire();
+        }
+    }
+
+    // Replays encstrset_copy, locking both sets in set number order as it
+    // does.
+    void replayCopy(SetNumber srcId, SetNumber dstId) {
+        SetPointer src = findSet(srcId);
+        SetPointer dst = findSet(dstId);
+        if (src == nullptr || dst == nullptr || src == dst) {
+            return;
+        }
+        shared_lock<shared_mutex> srcLock(src->mutex, defer_lock);
+        unique_lock<shared_mutex> dstLock(dst->mutex, defer_lock);
+        if (srcId < dstId) {
+            srcLock.lock();
+            dstLock.lock();
+        } else {
+            dstLock.lock();
+            srcLock.lock();
+        }
+        if (src->deleted || dst->deleted) {
+            return;
+        }
+        if (dst->elements->size() == 0) {
+            dst->replaceElements(src->elements);
+        } else if (src->elements->size() > 0) {
+            StrSet &dstElements = dst->mutableElements();
+            dstElements.reserve(dstElements.size() + src->elements->size());
+            src->elements->forEach([&](string_view element) {
+                dstElements.insert(element);
+            });
+            dst->rebuildFilter();
+        }
+    }
+} // namespace
+
+namespace encstrset_detail {
+    size_t journalNumberCount(JournalRecord type) {
+        switch (type) {
+            case JournalRecord::Copy:
+            case JournalRecord::Load:
+            case JournalRecord::Attach:
+                return 2;
+            case JournalRecord::Combine:
+                return 4;
+            default:
+                return 1;
+        }
+    }
+
+    bool readNumber(string_view &bytes, uint64_t &number) {
+        number = 0;
+        for (unsigned shift = 0; !bytes.empty() && shift < 64; shift += 7) {
+            auto byte = static_cast<unsigned char>(bytes.front());
+            bytes.remove_prefix(1);
+            number |= uint64_t(byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t recordChecksum(string_view payload) {
+        return static_cast<uint32_t>(checksum(payload.data(), payload.size(), 0));
+    }
+
+    string journalRecord(JournalRecord type, initializer_list<uint64_t> numbers, string_view text) {
+        assert(numbers.size() == journalNumberCount(type));
+        string payload(1, static_cast<char>(type));
+        for (uint64_t number : numbers) {
+            appendNumber(payload, number);
+        }
+        payload.append(text);
+
+        string record;
+        appendNumber(record, payload.size());
+        record += payload;
+        uint32_t sum = recordChecksum(payload);
+        record.append(reinterpret_cast<const char *>(&sum), sizeof(sum));
+        return record;
+    }
+
+    bool syncFile(FILE *file) {
+        if (fflush(file) != 0) {
+            return false;
+        }
+#ifdef ENCSTRSET_POSIX_FILES
+        return fsync(fileno(file)) == 0;
+#else
+        return true;
+#endif
+    }
+
+    bool replaceFile(const string &path, string_view bytes) {
+        string temporaryPath = path + ".tmp";
+        FILE *file = fopen(temporaryPath.c_str(), "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size() && syncFile(file);
+        written = fclose(file) == 0 && written;
+        if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            remove(temporaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    shared_mutex journalOrder;
+    shared_ptr<Journal> openJournal;
+    atomic<bool> journaling{false};
+
+    bool replayRecord(const JournalEntry &entry) {
+        SetNumber id = entry.numbers[0];
+        switch (entry.type) {
+            case JournalRecord::Checkpoint:
+                return true;
+            case JournalRecord::Create:
+                restoreSet(id, newElements());
+                return true;
+            case JournalRecord::Load:
+            case JournalRecord::Restore: {
+                bool verify = entry.type == JournalRecord::Load && entry.numbers[1] != 0;
+                ElementsPointer elements = readSnapshot(string(entry.text), verify);
+                if (elements == nullptr) {
+                    return false;
+                }
+                restoreSet(id, move(elements));
+                return true;
+            }
+            case JournalRecord::Attach: {
+                ElementsPointer elements = readShared(string(entry.text), entry.numbers[1] != 0);
+                if (elements == nullptr) {
+                    return false;
+                }
+                restoreSet(id, move(elements));
+                return true;
+            }
+            case JournalRecord::Delete: {
+                if (SetPointer set = unregisterSet(id)) {
+                    set->retire();
+                    recycleSlot(id);
+                }
+                return true;
+            }
+            case JournalRecord::Combine: {
+                if (entry.numbers[0] > static_cast<uint64_t>(SetOperation::SymmetricDifference)) {
+                    return false;
+                }
+                SetNumber aId = entry.numbers[1], bId = entry.numbers[2];
+                SetPointer a = findSet(aId);
+                SetPointer b = findSet(bId);
+                SetPointer dst = findSet(entry.numbers[3]);
+                if (a == nullptr || b == nullptr || dst == nullptr) {
+                    return true;
+                }
+                ElementsPointer result;
+                {
+                    PairReadLock lock(aId, *a, bId, *b);
+                    if (a->deleted || b->deleted) {
+                        return true;
+                    }
+                    result = combine(static_cast<SetOperation>(entry.numbers[0]), a->elements, b->elements);
+                }
+                unique_lock<shared_mutex> lock(dst->mutex);
+                if (!dst->deleted) {
+                    dst->replaceElements(move(result));
+                }
+                return true;
+            }
+            case JournalRecord::Copy:
+                replayCopy(id, entry.numbers[1]);
+                return true;
+            default:
+                break;
+        }
+
+        // Changes go through the set's lock, filter and mutableElements,
+        // which thaws a frozen set, as the calls that made them did.
+        SetPointer set = findSet(id);
+        if (set == nullptr) {
+            return true;
+        }
+        unique_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            return true;
+        }
+        size_t cipherHash = StrSet::hash(entry.text);
+        switch (entry.type) {
+            case JournalRecord::Insert:
+                if (set->mutableElements().insert(entry.text, cipherHash)) {
+                    set->filterInserted(cipherHash);
+                }
+                break;
+            case JournalRecord::Remove:
+                if (set->mutableElements().erase(entry.text, cipherHash)) {
+                    set->filterRemoved();
+                }
+                break;
+            case JournalRecord::Clear:
+                set->replaceElements(newElements());
+                break;
+            default:
+                break;
+        }
+        return true;
+    }
+
+    Journal::Journal(string path, FILE *file, jnp1::encstrset_durability durability, uint64_t generation,
+            vector<string> restoreFiles)
+            : path(move(path)), file(file), durability(durability), generation(generation),
+              restoreFiles(move(restoreFiles)) {
+        if (durability == jnp1::ENCSTRSET_GROUP_COMMIT) {
+            flusher = thread([this] { flushLoop(); });
+        }
+    }
+
+    Journal::~Journal() {
+        close();
+    }
+
+    bool Journal::checkpoint(const vector<pair<SetNumber, ElementsPointer>> &sets) {
+        unique_lock<mutex> lock(journalMutex);
+        flushed.wait(lock, [&] { return durable == appended || failed; });
+        if (failed) {
+            return false;
+        }
+        uint64_t nextGeneration = generation + 1;
+        string head = journalRecord(JournalRecord::Checkpoint, {nextGeneration});
+        vector<string> files;
+        bool saved = true;
+        for (const auto &[id, elements] : sets) {
+            files.push_back(path + "." + to_string(nextGeneration) + "." + to_string(id));
+            saved = saved && writeSnapshot(*elements, files.back());
+            head += journalRecord(JournalRecord::Restore, {id}, files.back());
+        }
+        FILE *nextFile = nullptr;
+        if (!saved || !replaceFile(path, head) || (nextFile = fopen(path.c_str(), "ab")) == nullptr) {
+            for (const string &name : files) {
+                remove(name.c_str());
+            }
+            return false;
+        }
+        fclose(file);
+        file = nextFile;
+        for (const string &name : restoreFiles) {
+            remove(name.c_str());
+        }
+        restoreFiles = move(files);
+        generation = nextGeneration;
+        return true;
+    }
+
+    bool Journal::close() {
+        {
+            lock_guard<mutex> lock(journalMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (flusher.joinable()) {
+            flusher.join();
+        }
+        lock_guard<mutex> lock(journalMutex);
+        if (file != nullptr) {
+            failed |= fclose(file) != 0;
+            file = nullptr;
+        }
+        return !failed;
+    }
+
+    void Journal::flushLoop() {
+        unique_lock<mutex> lock(journalMutex);
+        while (true) {
+            wake.wait(lock, [&] { return stopping || !pending.empty(); });
+            if (pending.empty()) {
+                return;
+            }
+            string batch;
+            batch.swap(pending);
+            uint64_t covered = appended;
+            lock.unlock();
+            bool written = fwrite(batch.data(), 1, batch.size(), file) == batch.size() && syncFile(file);
+            lock.lock();
+            if (written) {
+                durable = covered;
+            } else {
+                failed = true;
+                pending.clear();
+            }
+            flushed.notify_all();
+        }
+    }
+} // namespace encstrset_detail
@@ -0,0 +1,252 @@
+#ifndef ENCSTRSET_ENCSTRSET_JOURNAL_H
+#define ENCSTRSET_ENCSTRSET_JOURNAL_H
+
+#include "encstrset.h"
+#include "encstrset_common.h"
+#include "encstrset_table.h"
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cstddef>
+#include <utility>
+#include <initializer_list>
+
+namespace encstrset_detail {
+    // Journal files are a sequence of records, each framed as the varint
+    // length of its payload, the payload and a 32-bit checksum of it. A
+    // payload is the record type, its numbers as varints and, for some
+    // types, a trailing text (a ciphertext or a snapshot path). A journal
+    // always starts with a Checkpoint record, followed by a Restore record
+    // for every set saved by that checkpoint.
+    enum class JournalRecord : unsigned char {
+        Checkpoint = 1, // generation
+        Create,         // id
+        Delete,         // id
+        Insert,         // id, cipher
+        Remove,         // id, cipher
+        Clear,          // id
+        Copy,           // source id, destination id
+        Combine,        // operation, a id, b id, destination id
+        Load,           // id, verify, snapshot path
+        Restore,        // id, snapshot path
+        Attach          // id, verify, shared memory segment name
+    };
+
+    const unsigned char lastJournalRecord = static_cast<unsigned char>(JournalRecord::Attach);
+
+    size_t journalNumberCount(JournalRecord type);
+
+    struct JournalEntry {
+        JournalRecord type;
+        uint64_t numbers[4];
+        string_view text;
+    };
+
+    bool readNumber(string_view &bytes, uint64_t &number);
+
+    uint32_t recordChecksum(string_view payload);
+
+    string journalRecord(JournalRecord type, initializer_list<uint64_t> numbers, string_view text = {});
+
+    // Calls visit for every intact record, stopping at the first incomplete
+    // or damaged one: the tail of a write cut short by a crash. Returns the
+    // length of the intact prefix.
+    template<typename Visitor>
+    size_t parseJournal(string_view bytes, Visitor visit) {
+        size_t intact = 0;
+        string_view rest = bytes;
+        uint64_t length;
+        while (readNumber(rest, length) && length <= rest.size() && rest.size() - length >= sizeof(uint32_t)) {
+            string_view payload = rest.substr(0, length);
+            uint32_t sum;
+            memcpy(&sum, rest.data() + length, sizeof(sum));
+            if (payload.empty() || sum != recordChecksum(payload) ||
+                static_cast<unsigned char>(payload.front()) - 1u >= lastJournalRecord) {
+                break;
+            }
+            JournalEntry entry = {static_cast<JournalRecord>(payload.front()), {}, {}};
+            payload.remove_prefix(1);
+            bool complete = true;
+            for (size_t i = 0; i < journalNumberCount(entry.type) && complete; i++) {
+                complete = readNumber(payload, entry.numbers[i]);
+            }
+            if (!complete) {
+                break;
+            }
+            entry.text = payload;
+            rest.remove_prefix(length + sizeof(uint32_t));
+            intact = bytes.size() - rest.size();
+            if (!visit(entry)) {
+                break;
+            }
+        }
+        return intact;
+    }
+
+    bool syncFile(FILE *file);
+
+    // Writes bytes to a temporary file that replaces path once complete.
+    bool replaceFile(const string &path, string_view bytes);
+
+    // An open journal. Records are appended in the order the changes were
+    // applied; a call returns once its records are durable. With
+    // ENCSTRSET_SYNC_EACH every append is written and synced by its caller.
+    // With ENCSTRSET_GROUP_COMMIT appends are buffered and a flusher thread
+    // writes and syncs everything buffered so far at once, so that callers
+    // arriving while a sync is in progress share the next one.
+    // Once a write or sync fails, nothing more is written: records after a
+    // torn one would be ignored by replay anyway, so no later record is
+    // reported durable.
+    class Journal {
+    public:
+        Journal(string path, FILE *file, jnp1::encstrset_durability durability, uint64_t generation,
+                vector<string> restoreFiles);
+
+        Journal(const Journal &) = delete;
+
+        Journal &operator=(const Journal &) = delete;
+
+        ~Journal();
+
+        // Returns the sequence number to wait for.
+        uint64_t append(const string &record) {
+            lock_guard<mutex> lock(journalMutex);
+            appended++;
+            if (failed) {
+                return appended;
+            }
+            if (durability == jnp1::ENCSTRSET_SYNC_EACH) {
+                failed = fwrite(record.data(), 1, record.size(), file) != record.size() || !syncFile(file);
+                if (!failed) {
+                    durable = appended;
+                }
+            } else {
+                pending += record;
+                wake.notify_one();
+            }
+            return appended;
+        }
+
+        // Returns false if the records up to sequence could not be written.
+        bool waitDurable(uint64_t sequence) {
+            unique_lock<mutex> lock(journalMutex);
+            flushed.wait(lock, [&] { return durable >= sequence || failed; });
+            return durable >= sequence;
+        }
+
+        // Saves every set next to the journal and starts a new journal that
+        // restores them, then removes the snapshots of the previous
+        // checkpoint. No records may be appended meanwhile.
+        bool checkpoint(const vector<pair<SetNumber, ElementsPointer>> &sets);
+
+        // Flushes and closes the journal; returns false if any record could
+        // not be written.
+        bool close();
+
+    private:
+        string path;
+        FILE *file;
+        jnp1::encstrset_durability durability;
+        uint64_t generation;
+        vector<string> restoreFiles;
+
+        mutex journalMutex;
+        condition_variable wake;
+        condition_variable flushed;
+        string pending;
+        uint64_t appended = 0;
+        uint64_t durable = 0;
+        bool stopping = false;
+        bool failed = false;
+        thread flusher;
+
+        void flushLoop();
+    };
+
+    // While a journal is open, every call that changes sets holds
+    // journalOrder: shared if it touches a single set, exclusively if it
+    // reads some sets to change another, so that the journal sees changes
+    // in the order they were applied. Checkpoints hold it exclusively to
+    // save a consistent state of all sets.
+    extern shared_mutex journalOrder;
+    extern shared_ptr<Journal> openJournal;
+    extern atomic<bool> journaling;
+
+    // Journals the records of one call. The destructor releases
+    // journalOrder and then waits until the records are durable, so the
+    // wait happens outside of any set lock taken after the scope. Calls
+    // changing many elements collect their records and commit them, still
+    // under the set lock, as a single append and sync.
+    class JournalScope {
+    public:
+        explicit JournalScope(bool exclusive = false) {
+            if (journaling.load(memory_order_acquire)) {
+                if (exclusive) {
+                    exclusiveLock = unique_lock<shared_mutex>(journalOrder);
+                } else {
+                    sharedLock = shared_lock<shared_mutex>(journalOrder);
+                }
+                journal = openJournal;
+            }
+        }
+
+        JournalScope(const JournalScope &) = delete;
+
+        JournalScope &operator=(const JournalScope &) = delete;
+
+        ~JournalScope() {
+            if (sharedLock.owns_lock()) {
+                sharedLock.unlock();
+            }
+            if (exclusiveLock.owns_lock()) {
+                exclusiveLock.unlock();
+            }
+            if (sequence > 0 && !journal->waitDurable(sequence)) {
+                DEBUG(": journal records could not be written");
+            }
+        }
+
+        void append(JournalRecord type, initializer_list<uint64_t> numbers, string_view text = {}) {
+            if (journal != nullptr) {
+                sequence = journal->append(journalRecord(type, numbers, text));
+            }
+        }
+
+        void collect(JournalRecord type, initializer_list<uint64_t> numbers, string_view text = {}) {
+            if (journal != nullptr) {
+                collected += journalRecord(type, numbers, text);
+            }
+        }
+
+        void commit() {
+            if (!collected.empty()) {
+                sequence = journal->append(collected);
+                collected.clear();
+            }
+        }
+
+    private:
+        shared_lock<shared_mutex> sharedLock;
+        unique_lock<shared_mutex> exclusiveLock;
+        shared_ptr<Journal> journal;
+        string collected;
+        uint64_t sequence = 0;
+    };
+
+    // Applies a journal record to the sets, without journaling it again,
+    // under the same set locks and with the same filter upkeep as the call
+    // that made it. Records for sets that no longer exist are skipped, like
+    // the calls that made them would have been.
+    bool replayRecord(const JournalEntry &entry);
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_JOURNAL_H
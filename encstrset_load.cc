@@ -0,0 +1,328 @@
+#include "encstrset_load.h"
+#include "encstrset_table.h"
+#include "encstrset_stats.h"
+#include "encstrset_encode.h"
+#include "encstrset_algebra.h"
+#include "encstrset_trace.h"
+#include "encstrset_snapshot.h"
+#include "encstrset_journal.h"
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef ENCSTRSET_POSIX_FILES
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+namespace {
+    using namespace encstrset_detail;
+
+    // Bulk loading of delimited lines. The input is taken in blocks of
+    // about loadBlockBytes, each cut just after a delimiter. A block is split
+    // into a chunk per thread, whose lines are encoded, hashed and sorted
+    // into partitions by hash. Each thread then keeps, for partitions of
+    // its own, the lines neither in the set nor earlier in the block, and
+    // those are inserted into the set at the end. A line is the value
+    // encstrset_insert would take, so it ends at a NUL byte, if any.
+    const size_t loadBlockBytes = size_t(64) << 20;
+    const size_t loadChunkBytes = size_t(1) << 20;
+    const int loadPartitionBits = 6;
+    const size_t loadPartitionCount = size_t(1) << loadPartitionBits;
+    const size_t loadPrefetchDistance = 8;
+
+    struct LoadedLine {
+        size_t offset;
+        size_t length;
+        size_t cipherHash;
+    };
+
+    // The ciphertexts of a chunk's lines back to back, and where each is.
+    struct LoadChunk {
+        string_view input;
+        string ciphers;
+        vector<LoadedLine> partitions[loadPartitionCount];
+        size_t lineCount = 0;
+    };
+
+    struct LoadCounts {
+        size_t lines = 0;
+        size_t inserted = 0;
+    };
+
+    // The first line start at or after position: position itself if a line
+    // starts there, otherwise just past the next delimiter.
+    size_t lineBoundary(string_view input, size_t position, char delimiter) {
+        if (position == 0 || position >= input.size()) {
+            return min(position, input.size());
+        }
+        size_t found = input.find(delimiter, position - 1);
+        return found == string_view::npos ? input.size() : found + 1;
+    }
+
+    void encodeChunk(LoadChunk &chunk, char delimiter, const KeyStream &keyStream) {
+        chunk.ciphers.reserve(chunk.input.size());
+        for (size_t position = 0; position < chunk.input.size();) {
+            size_t end = min(chunk.input.find(delimiter, position), chunk.input.size());
+            string_view line = chunk.input.substr(position, end - position);
+            line = line.substr(0, line.find('\0'));
+            size_t offset = chunk.ciphers.size();
+            chunk.ciphers.append(line);
+            size_t cipherHash = encodeAndHash(chunk.ciphers.data() + offset, line.size(), keyStream);
+            size_t partition = cipherHash >> (numeric_limits<size_t>::digits - loadPartitionBits);
+            chunk.partitions[partition].push_back({offset, line.size(), cipherHash});
+            chunk.lineCount++;
+            position = end + 1;
+        }
+    }
+
+    // The lines of one partition, over all chunks in order, that are
+    // neither in elements nor earlier in the partition.
+    vector<CipherReference> newLines(const vector<LoadChunk> &chunks, size_t partition, const StrSet &elements) {
+        size_t count = 0;
+        for (const auto &chunk : chunks) {
+            count += chunk.partitions[partition].size();
+        }
+        StrSet seen;
+        seen.reserve(count);
+        vector<CipherReference> result;
+        for (const auto &chunk : chunks) {
+            for (const auto &line : chunk.partitions[partition]) {
+                string_view cipher(chunk.ciphers.data() + line.offset, line.length);
+                if (!elements.contains(cipher, line.cipherHash) && seen.insert(cipher, line.cipherHash)) {
+                    result.push_back({cipher, line.cipherHash});
+                }
+            }
+        }
+        return result;
+    }
+
+    // Returns false if the set has been deleted.
+    bool loadBlock(SetNumber id, SetEntry &set, string_view block, char delimiter, const KeyStream &keyStream,
+                   LoadCounts &counts) {
+        if (block.empty()) {
+            return true;
+        }
+        size_t threadCount = min<size_t>(max(1u, thread::hardware_concurrency()),
+                                         max<size_t>(1, block.size() / loadChunkBytes));
+        vector<LoadChunk> chunks(threadCount);
+        for (size_t part = 0, begin = 0; part < threadCount; part++) {
+            size_t end = lineBoundary(block, block.size() * (part + 1) / threadCount, delimiter);
+            chunks[part].input = block.substr(begin, max(begin, end) - begin);
+            begin = max(begin, end);
+        }
+        runInParallel(threadCount, [&](size_t part) {
+            encodeChunk(chunks[part], delimiter, keyStream);
+        });
+        size_t lineCount = 0;
+        for (const auto &chunk : chunks) {
+            lineCount += chunk.lineCount;
+        }
+
+        ThreadStats &stats = threadStats();
+        JournalScope journal;
+        // Tests of the set go on while the lines are checked against it;
+        // only merging the new ones in takes the set for itself. Lines
+        // inserted by others in between are found again by the merge.
+        vector<vector<CipherReference>> fresh(loadPartitionCount);
+        {
+            shared_lock<shared_mutex> lock(set.mutex);
+            if (set.deleted) {
+                return false;
+            }
+            const StrSet &current = *set.elements;
+            runInParallel(threadCount, [&](size_t part) {
+                for (size_t partition = part; partition < loadPartitionCount; partition += threadCount) {
+                    fresh[partition] = newLines(chunks, partition, current);
+                }
+            });
+        }
+        size_t freshCount = 0;
+        for (const auto &lines : fresh) {
+            freshCount += lines.size();
+        }
+
+        unique_lock<shared_mutex> lock(set.mutex);
+        if (set.deleted) {
+            return false;
+        }
+        // As in insertBatch, a budgeted set grows one line at a time, and
+        // its budget is checked, copy included, before the set is owned.
+        bool budgeted = set.isBudgeted();
+        if (!budgeted && freshCount > 0) {
+            StrSet &elements = set.mutableElements();
+            elements.reserve(elements.size() + freshCount);
+        }
+        size_t added = 0, rejected = 0;
+        for (const auto &lines : fresh) {
+            for (size_t i = 0; i < lines.size(); i++) {
+                if (i + loadPrefetchDistance < lines.size()) {
+                    set.elements->prefetch(lines[i + loadPrefetchDistance].cipherHash);
+                }
+                if (budgeted && set.elements->contains(lines[i].cipher, lines[i].cipherHash)) {
+                    continue;
+                }
+                if (budgeted && !set.admitsInsert(lines[i].cipher.size())) {
+                    rejected++;
+                    continue;
+                }
+                if (!set.mutableElements().insert(lines[i].cipher, lines[i].cipherHash)) {
+                    continue;
+                }
+                added++;
+                set.filterInserted(lines[i].cipherHash);
+                journal.collect(JournalRecord::Insert, {id}, lines[i].cipher);
+            }
+        }
+        journal.commit();
+        set.inserted += added;
+        set.duplicates += lineCount - added - rejected;
+        set.budgetRejects += rejected;
+        stats.count(InsertedCount, added);
+        stats.count(DuplicateCount, lineCount - added - rejected);
+        stats.count(BudgetRejectCount, rejected);
+        counts.lines += lineCount;
+        counts.inserted += added;
+        return true;
+    }
+
+    bool loadMapped(SetNumber id, SetEntry &set, string_view input, char delimiter, const KeyStream &keyStream,
+                    LoadCounts &counts) {
+        for (size_t begin = 0; begin < input.size();) {
+            size_t end = lineBoundary(input, begin + min(loadBlockBytes, input.size() - begin), delimiter);
+            if (!loadBlock(id, set, input.substr(begin, end - begin), delimiter, keyStream, counts)) {
+                return false;
+            }
+            begin = end;
+        }
+        return true;
+    }
+
+#ifdef ENCSTRSET_POSIX_FILES
+    // Size of the buffer loadStream starts with: what is left of a regular
+    // file, plus a byte to see its end, up to a block, and a chunk for
+    // pipes and devices, whose length is not known.
+    size_t streamBufferBytes(int descriptor) {
+        struct stat status;
+        if (fstat(descriptor, &status) != 0 || !S_ISREG(status.st_mode)) {
+            return loadChunkBytes;
+        }
+        off_t offset = lseek(descriptor, 0, SEEK_CUR);
+        off_t left = status.st_size - min(max<off_t>(offset, 0), status.st_size);
+        return min(loadBlockBytes, size_t(left) + 1);
+    }
+
+    // Reads descriptor to its end, a block at a time. The buffer is left
+    // uninitialized and doubles while it fills up, until it holds a block,
+    // or past that for a line longer than a block. Returns false if reading
+    // fails or the set has been deleted.
+    bool loadStream(SetNumber id, SetEntry &set, int descriptor, char delimiter, const KeyStream &keyStream,
+                    LoadCounts &counts) {
+        size_t capacity = streamBufferBytes(descriptor);
+        unique_ptr<char[]> buffer(new char[capacity]);
+        size_t filled = 0;
+        for (;;) {
+            ssize_t got = read(descriptor, buffer.get() + filled, capacity - filled);
+            if (got < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            filled += size_t(got);
+            bool atEnd = got == 0;
+            if (!atEnd && filled < capacity) {
+                continue;
+            }
+            string_view input(buffer.get(), filled);
+            size_t lastDelimiter = input.rfind(delimiter);
+            if (!atEnd && (capacity < loadBlockBytes || lastDelimiter == string_view::npos)) {
+                unique_ptr<char[]> grown(new char[capacity * 2]);
+                memcpy(grown.get(), buffer.get(), filled);
+                buffer = move(grown);
+                capacity *= 2;
+                continue;
+            }
+            size_t end = atEnd ? filled : lastDelimiter + 1;
+            if (!loadBlock(id, set, input.substr(0, end), delimiter, keyStream, counts)) {
+                return false;
+            }
+            if (atEnd) {
+                return true;
+            }
+            memmove(buffer.get(), buffer.get() + end, filled - end);
+            filled -= end;
+        }
+    }
+#endif
+} // namespace
+
+namespace encstrset_detail {
+    size_t loadLines(const char *function, SetNumber id, SetEntry *set, const char *path, int descriptor,
+                     const char *key, char delimiter) {
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return 0;
+        }
+
+        KeyStream keyStream(key, keyStreamTargetLength);
+        LoadCounts counts;
+        bool complete = false;
+        size_t size = 0;
+        shared_ptr<const void> file = path == nullptr ? nullptr : mapFile(path, size);
+        if (file != nullptr) {
+            string_view input(static_cast<const char *>(file.get()), size);
+            complete = loadMapped(id, *set, input, delimiter, keyStream, counts);
+        } else {
+#ifdef ENCSTRSET_POSIX_FILES
+            // Empty files, pipes and devices cannot be mapped, but are read.
+            int opened = path == nullptr ? descriptor : open(path, O_RDONLY);
+            if (opened < 0) {
+                if (path != nullptr) {
+                    DEBUG_AS(function, ": \"" << path << "\" could not be opened");
+                } else {
+                    DEBUG_AS(function, ": invalid descriptor (" << descriptor << ")");
+                }
+                return 0;
+            }
+            complete = loadStream(id, *set, opened, delimiter, keyStream, counts);
+            if (path != nullptr) {
+                close(opened);
+            }
+#else
+            DEBUG_AS(function, ": the input could not be read");
+            return 0;
+#endif
+        }
+
+        trace(TraceOperation::LoadLines, id, complete, counts.inserted);
+        if (!complete) {
+            bool deleted;
+            {
+                shared_lock<shared_mutex> lock(set->mutex);
+                deleted = set->deleted;
+            }
+            if (deleted) {
+                DEBUG_AS(function, SET_NOT_EXIST(id));
+            } else {
+                DEBUG_AS(function, ": set #" << id << ", reading failed after " << counts.lines << " line(s), "
+                                             << counts.inserted << " inserted");
+            }
+            return counts.inserted;
+        }
+        DEBUG_AS(function, ": set #" << id << ", " << counts.lines << " line(s) read, " << counts.inserted
+                                     << " inserted");
+        return counts.inserted;
+    }
+} // namespace encstrset_detail
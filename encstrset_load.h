@@ -0,0 +1,14 @@
+#ifndef ENCSTRSET_ENCSTRSET_LOAD_H
+#define ENCSTRSET_ENCSTRSET_LOAD_H
+
+#include "encstrset_common.h"
+#include "encstrset_sets.h"
+#include <cstddef>
+
+namespace encstrset_detail {
+    // Loads from path if it is not null, and from descriptor otherwise.
+    size_t loadLines(const char *function, SetNumber id, SetEntry *set, const char *path, int descriptor,
+                     const char *key, char delimiter);
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_LOAD_H
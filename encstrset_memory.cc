@@ -0,0 +1,61 @@
+#include "encstrset_memory.h"
+#include <new>
+
+using namespace std;
+
+namespace encstrset_detail {
+    thread_local BlockCache::State BlockCache::state = BlockCache::State::Unused;
+    atomic<size_t> BlockCache::takenBytes{0};
+
+    BlockCache::BlockCache() {
+        state = State::Live;
+    }
+
+    BlockCache::~BlockCache() {
+        state = State::Destroyed;
+        for (SizeList &list : lists) {
+            while (list.head != nullptr) {
+                ::operator delete(exchange(list.head, list.head->next), align_val_t(blockAlignment));
+            }
+        }
+    }
+
+    void *BlockCache::take(size_t size) {
+        takenBytes.fetch_add(size, memory_order_relaxed);
+        if (SizeList *list = listFor(size)) {
+            if (list->head != nullptr) {
+                list->count--;
+                return exchange(list->head, list->head->next);
+            }
+        }
+        return ::operator new(size, align_val_t(blockAlignment));
+    }
+
+    void BlockCache::give(void *block, size_t size) {
+        takenBytes.fetch_sub(size, memory_order_relaxed);
+        SizeList *list = listFor(size);
+        if (list != nullptr && (list->count + 1) * size <= cachedBytesPerSize) {
+            list->head = new(block) FreeBlock{list->head};
+            list->count++;
+            return;
+        }
+        ::operator delete(block, align_val_t(blockAlignment));
+    }
+
+    BlockCache::SizeList *BlockCache::listFor(size_t size) {
+        if (size > pooledBlockLimit || size < sizeof(FreeBlock) || state == State::Destroyed) {
+            return nullptr;
+        }
+        thread_local BlockCache cache;
+        for (SizeList &list : cache.lists) {
+            if (list.size == size) {
+                return &list;
+            }
+            if (list.size == 0) {
+                list.size = size;
+                return &list;
+            }
+        }
+        return nullptr;
+    }
+} // namespace encstrset_detail
@@ -0,0 +1,152 @@
+#ifndef ENCSTRSET_ENCSTRSET_MEMORY_H
+#define ENCSTRSET_ENCSTRSET_MEMORY_H
+
+#include "encstrset_common.h"
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace encstrset_detail {
+    // Small blocks are recycled through per-thread caches, so that sets
+    // created and deleted in a loop reuse the memory of their tables,
+    // arenas and entries instead of going to the allocator each time.
+    // Blocks are cached by exact size, up to cachedBytesPerSize bytes per
+    // size, and are all aligned alike so that any caller can reuse any
+    // block of its size. All memory of sets is taken from here, so the
+    // bytes taken and not given back are what the sets use (see
+    // encstrset_total_memory_usage).
+    const size_t blockAlignment = 64;
+    const size_t pooledBlockLimit = 16384;
+    const size_t cachedBytesPerSize = 65536;
+    const size_t cachedSizeCount = 16;
+
+    class BlockCache {
+    public:
+        BlockCache();
+
+        BlockCache(const BlockCache &) = delete;
+
+        BlockCache &operator=(const BlockCache &) = delete;
+
+        ~BlockCache();
+
+        static void *take(size_t size);
+
+        static void give(void *block, size_t size);
+
+        // Bytes of the blocks taken and not yet given back, over all threads.
+        static size_t inUse() {
+            return takenBytes.load(memory_order_relaxed);
+        }
+
+    private:
+        // Blocks freed after the cache of their thread is gone, during
+        // thread or program exit, go straight back to the allocator.
+        enum class State {
+            Unused,
+            Live,
+            Destroyed
+        };
+
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        struct SizeList {
+            size_t size = 0;
+            FreeBlock *head = nullptr;
+            size_t count = 0;
+        };
+
+        static thread_local State state;
+        static atomic<size_t> takenBytes;
+
+        SizeList lists[cachedSizeCount];
+
+        static SizeList *listFor(size_t size);
+    };
+
+    // Bytes of a block taken from the caches, given back when released.
+    class PooledBytes {
+    public:
+        PooledBytes() = default;
+
+        explicit PooledBytes(size_t size) : bytes(static_cast<char *>(BlockCache::take(size))), size(size) {
+        }
+
+        PooledBytes(PooledBytes &&other) noexcept
+                : bytes(exchange(other.bytes, nullptr)), size(exchange(other.size, 0)) {
+        }
+
+        PooledBytes &operator=(PooledBytes &&other) noexcept {
+            if (this != &other) {
+                reset();
+                bytes = exchange(other.bytes, nullptr);
+                size = exchange(other.size, 0);
+            }
+            return *this;
+        }
+
+        ~PooledBytes() {
+            reset();
+        }
+
+        char *get() const {
+            return bytes;
+        }
+
+        void reset() {
+            if (bytes != nullptr) {
+                BlockCache::give(bytes, size);
+                bytes = nullptr;
+                size = 0;
+            }
+        }
+
+    private:
+        char *bytes = nullptr;
+        size_t size = 0;
+    };
+
+    // Size of the block holding an object of type Owner made by
+    // allocate_shared with a PooledAllocator, together with its control
+    // block, once one has been made.
+    template<typename Owner>
+    atomic<size_t> sharedBlockBytes{0};
+
+    // Allocator drawing from the caches, for allocate_shared. Rebound
+    // copies keep Owner, the type of the object allocated.
+    template<typename T, typename Owner = T>
+    struct PooledAllocator {
+        static_assert(alignof(T) <= blockAlignment, "blocks are not aligned enough");
+
+        using value_type = T;
+
+        PooledAllocator() = default;
+
+        template<typename U>
+        PooledAllocator(const PooledAllocator<U, Owner> &) {
+        }
+
+        T *allocate(size_t count) {
+            sharedBlockBytes<Owner>.store(count * sizeof(T), memory_order_relaxed);
+            return static_cast<T *>(BlockCache::take(count * sizeof(T)));
+        }
+
+        void deallocate(T *block, size_t count) {
+            BlockCache::give(block, count * sizeof(T));
+        }
+
+        template<typename U>
+        bool operator==(const PooledAllocator<U, Owner> &) const {
+            return true;
+        }
+
+        template<typename U>
+        bool operator!=(const PooledAllocator<U, Owner> &) const {
+            return false;
+        }
+    };
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_MEMORY_H
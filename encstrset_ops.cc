@@ -0,0 +1,788 @@
+#include "encstrset_ops.h"
+#include "encstrset_arena.h"
+#include "encstrset_table.h"
+#include "encstrset_stats.h"
+#include "encstrset_trace.h"
+#include "encstrset_snapshot.h"
+#include "encstrset_journal.h"
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace {
+    using namespace encstrset_detail;
+
+    void setResultBit(unsigned char *results, size_t index, bool result) {
+        if (results == nullptr) {
+            return;
+        }
+        unsigned char mask = static_cast<unsigned char>(1u << (index % 8));
+        if (result) {
+            results[index / 8] |= mask;
+        } else {
+            results[index / 8] &= static_cast<unsigned char>(~mask);
+        }
+    }
+
+    // Walks a batch of values, encoding and hashing each one a step ahead
+    // of the caller so that its table group is prefetched while the
+    // current value is being probed.
+    class BatchCursor {
+    public:
+        // Values are prefetched in the table elements points to at the time,
+        // which may change as the batch goes.
+        BatchCursor(const char *const *values, size_t count, const KeyStream &keyStream,
+                    const ElementsPointer &elements)
+                : values(values), count(count), keyStream(keyStream), elements(elements) {
+            if (count > 0) {
+                load(0, ahead);
+            }
+        }
+
+        bool next() {
+            if (position + 1 >= count) {
+                return false;
+            }
+            position++;
+            swap(current, ahead);
+            if (position + 1 < count) {
+                load(position + 1, ahead);
+            }
+            return true;
+        }
+
+        size_t index() const {
+            return position;
+        }
+
+        bool isNull() const {
+            return values[position] == nullptr;
+        }
+
+        string_view cipher() const {
+            return current.cipher;
+        }
+
+        size_t cipherHash() const {
+            return current.cipherHash;
+        }
+
+    private:
+        struct Entry {
+            string cipher;
+            size_t cipherHash = 0;
+        };
+
+        const char *const *values;
+        size_t count;
+        const KeyStream &keyStream;
+        const ElementsPointer &elements;
+        size_t position = numeric_limits<size_t>::max();
+        Entry current, ahead;
+
+        void load(size_t index, Entry &entry) {
+            if (values[index] == nullptr) {
+                return;
+            }
+            entry.cipherHash = encodeInto(entry.cipher, values[index], keyStream);
+            elements->prefetch(entry.cipherHash);
+        }
+    };
+
+    // The compacted copy is built a range of slots at a time, each under a
+    // shared lock, so tests go on throughout and changes in between steps.
+    // No reference to the elements is held across steps, which would make
+    // every change copy them all; a change bumps the set's version instead,
+    // and the copy is then started over from the changed elements.
+    const int compactAttempts = 3;
+    const size_t compactStepSlots = 4096;
+} // namespace
+
+namespace encstrset_detail {
+    void clearResultBits(unsigned char *results, size_t count) {
+        if (results != nullptr) {
+            memset(results, 0, (count + 7) / 8);
+        }
+    }
+
+    void combineInto(const char *function, SetOperation operation, SetNumber aId, SetNumber bId, SetNumber dstId) {
+        SetPointer a = findSet(aId);
+        SetPointer b = findSet(bId);
+        SetPointer dst = findSet(dstId);
+        if (a == nullptr || b == nullptr || dst == nullptr) {
+            SetNumber missingId = a == nullptr ? aId : b == nullptr ? bId : dstId;
+            DEBUG_AS(function, SET_NOT_EXIST(missingId));
+            return;
+        }
+
+        JournalScope journal(true);
+        ElementsPointer result;
+        bool aDeleted, bDeleted;
+        {
+            PairReadLock lock(aId, *a, bId, *b);
+            aDeleted = a->deleted;
+            bDeleted = b->deleted;
+            if (!aDeleted && !bDeleted) {
+                result = combine(operation, a->elements, b->elements);
+            }
+        }
+        if (aDeleted || bDeleted) {
+            SetNumber missingId = aDeleted ? aId : bId;
+            DEBUG_AS(function, SET_NOT_EXIST(missingId));
+            return;
+        }
+        unique_lock<shared_mutex> lock(dst->mutex);
+        if (dst->deleted) {
+            lock.unlock();
+            DEBUG_AS(function, SET_NOT_EXIST(dstId));
+            return;
+        }
+        if (!dst->admitsReplacement(*result)) {
+            dst->budgetRejects++;
+            lock.unlock();
+            threadStats().count(BudgetRejectCount);
+            trace(traceOperation(operation), dstId, false, result->size());
+            DEBUG_AS(function, ": set #" << dstId << " would exceed the memory budget");
+            return;
+        }
+        dst->replaceElements(move(result));
+        size_t size = dst->elements->size();
+        journal.append(JournalRecord::Combine, {static_cast<uint64_t>(operation), aId, bId, dstId});
+        lock.unlock();
+        trace(traceOperation(operation), dstId, true, size);
+        DEBUG_AS(function, ": set #" << dstId << " contains " << size << " element(s)");
+    }
+
+    bool measureOverlap(const char *function, SetNumber aId, SetNumber bId,
+                        size_t &aSize, size_t &bSize, size_t &commonSize) {
+        SetPointer a = findSet(aId);
+        SetPointer b = findSet(bId);
+        if (a == nullptr || b == nullptr) {
+            SetNumber missingId = a == nullptr ? aId : bId;
+            DEBUG_AS(function, SET_NOT_EXIST(missingId));
+            return false;
+        }
+        bool aDeleted, bDeleted;
+        {
+            PairReadLock lock(aId, *a, bId, *b);
+            aDeleted = a->deleted;
+            bDeleted = b->deleted;
+            if (!aDeleted && !bDeleted) {
+                aSize = a->elements->size();
+                bSize = b->elements->size();
+                commonSize = intersectionSize(*a->elements, *b->elements);
+            }
+        }
+        if (aDeleted || bDeleted) {
+            SetNumber missingId = aDeleted ? aId : bId;
+            DEBUG_AS(function, SET_NOT_EXIST(missingId));
+            return false;
+        }
+        return true;
+    }
+
+    bool insertValue(const char *function, SetNumber id, SetEntry *set, const char *value, size_t valueLength,
+                     const KeyStream &keyStream) {
+        if (value == nullptr) {
+            DEBUG_AS(function, ": invalid value (NULL)");
+            return false;
+        }
+        if (valueLength > StrSet::maxCipherLength) {
+            DEBUG_AS(function, ": invalid value (longer than " << StrSet::maxCipherLength << " bytes)");
+            return false;
+        }
+        if (set != nullptr) {
+            ThreadStats &stats = threadStats();
+            LatencySample sample(stats, InsertLatency);
+            ScratchCipher scratch(string_view(value, valueLength), keyStream);
+            string_view encodedValue = scratch.cipher();
+            size_t cipherHash = scratch.hash();
+            JournalScope journal;
+            unique_lock<shared_mutex> lock(set->mutex);
+            if (set->deleted) {
+                lock.unlock();
+                DEBUG_AS(function, SET_NOT_EXIST(id));
+                return false;
+            }
+            // Elements shared with another set are only copied if the
+            // value is new to them.
+            bool present = set->elements->contains(encodedValue, cipherHash);
+            if (!present && !set->admitsInsert(encodedValue.size())) {
+                set->budgetRejects++;
+                stats.count(BudgetRejectCount);
+                lock.unlock();
+                traceCipher(TraceOperation::Insert, id, false, encodedValue, cipherHash);
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", encodedValue,
+                                     "\" would exceed the memory budget");
+                return false;
+            }
+            bool inserted = !present && set->mutableElements().insert(encodedValue, cipherHash);
+            if (inserted) {
+                set->filterInserted(cipherHash);
+            }
+            set->countInsert(inserted);
+            stats.count(inserted ? InsertedCount : DuplicateCount);
+            if (inserted) {
+                journal.append(JournalRecord::Insert, {id}, encodedValue);
+            }
+            lock.unlock();
+            traceCipher(TraceOperation::Insert, id, inserted, encodedValue, cipherHash);
+            if (inserted) {
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", encodedValue, "\" inserted");
+                return true;
+            } else {
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", encodedValue,
+                                     "\" was already present");
+            }
+        } else {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+        }
+
+        return false;
+    }
+
+    bool removeValue(const char *function, SetNumber id, SetEntry *set, const char *value, size_t valueLength,
+                     const KeyStream &keyStream) {
+        if (value == nullptr) {
+            DEBUG_AS(function, ": invalid value (NULL)");
+            return false;
+        }
+        if (set != nullptr) {
+            ThreadStats &stats = threadStats();
+            LatencySample sample(stats, RemoveLatency);
+            ScratchCipher scratch(string_view(value, valueLength), keyStream);
+            string_view encodedValue = scratch.cipher();
+            size_t cipherHash = scratch.hash();
+            JournalScope journal;
+            unique_lock<shared_mutex> lock(set->mutex);
+            if (set->deleted) {
+                lock.unlock();
+                DEBUG_AS(function, SET_NOT_EXIST(id));
+                return false;
+            }
+            bool removed = set->filterFor(cipherHash) != FilterOutcome::Rejected &&
+                           set->elements->contains(encodedValue, cipherHash) &&
+                           set->mutableElements().erase(encodedValue, cipherHash);
+            if (removed) {
+                set->filterRemoved();
+            }
+            set->countRemove(removed);
+            stats.count(removed ? RemovedCount : RemoveMissCount);
+            if (removed) {
+                journal.append(JournalRecord::Remove, {id}, encodedValue);
+            }
+            lock.unlock();
+            traceCipher(TraceOperation::Remove, id, removed, encodedValue, cipherHash);
+            if (removed) {
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", encodedValue, "\" removed");
+                return true;
+            } else {
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", encodedValue,
+                                     "\" was not present");
+            }
+        } else {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+        }
+
+        return false;
+    }
+
+    bool testValue(const char *function, SetNumber id, SetEntry *set, const char *value, size_t valueLength,
+                   const KeyStream &keyStream) {
+        if (value == nullptr) {
+            DEBUG_AS(function, ": invalid value (NULL)");
+            return false;
+        }
+        if (set != nullptr) {
+            ThreadStats &stats = threadStats();
+            LatencySample sample(stats, TestLatency);
+            ScratchCipher scratch(string_view(value, valueLength), keyStream);
+            string_view encodedValue = scratch.cipher();
+            size_t cipherHash = scratch.hash();
+            shared_lock<shared_mutex> lock(set->mutex);
+            if (set->deleted) {
+                lock.unlock();
+                DEBUG_AS(function, SET_NOT_EXIST(id));
+                return false;
+            }
+            FilterOutcome outcome = set->filterFor(cipherHash);
+            bool present = outcome != FilterOutcome::Rejected && set->elements->contains(encodedValue, cipherHash);
+            lock.unlock();
+            set->countTest(stats, present, outcome);
+            stats.count(present ? TestHitCount : TestMissCount);
+            traceCipher(TraceOperation::Test, id, present, encodedValue, cipherHash);
+            if (present) {
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", encodedValue, "\" is present");
+                return true;
+            } else {
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", encodedValue,
+                                     "\" is not present");
+                return false;
+            }
+        } else {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+        }
+        return false;
+    }
+
+    void addTableStats(jnp1::encstrset_stats &stats, const SetEntry &set) {
+        const StrSet &elements = *set.elements;
+        stats.elements += elements.size();
+        stats.cipher_bytes += elements.cipherBytes();
+        stats.slots += elements.slotCapacity();
+        stats.rehashes += elements.rehashes();
+        stats.filter_bytes += set.filter == nullptr ? 0 : set.filter->bytes();
+    }
+
+    void finishStats(jnp1::encstrset_stats &stats) {
+        stats.load_factor = stats.slots == 0 ? 0 : double(stats.elements) / double(stats.slots);
+        uint64_t filterPasses = stats.filter_false_positives + stats.filter_rejects;
+        stats.filter_false_positive_rate = filterPasses == 0 ? 0 : double(stats.filter_false_positives) /
+                                                                   double(filterPasses);
+    }
+
+    size_t setSize(const char *function, SetNumber id, SetEntry *set) {
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return 0;
+        }
+        shared_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            lock.unlock();
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return 0;
+        }
+        size_t size = set->elements->size();
+        lock.unlock();
+        trace(TraceOperation::Size, id, true, size);
+        DEBUG_AS(function, ": set #" << id << " contains " << size << " element(s)");
+        return size;
+    }
+
+    void clearSet(const char *function, SetNumber id, SetEntry *set) {
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return;
+        }
+        JournalScope journal;
+        unique_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            lock.unlock();
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return;
+        }
+        set->replaceElements(newElements());
+        journal.append(JournalRecord::Clear, {id});
+        lock.unlock();
+        trace(TraceOperation::Clear, id, true);
+        DEBUG_AS(function, ": set #" << id << " cleared");
+    }
+
+    size_t insertBatch(const char *function, SetNumber id, SetEntry *set, const char *const *values, size_t count,
+                       const char *key, unsigned char *results) {
+        clearResultBits(results, count);
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return 0;
+        }
+        if (values == nullptr) {
+            DEBUG_AS(function, ": invalid values (NULL)");
+            return 0;
+        }
+
+        KeyStream keyStream(key, keyStreamTargetLength);
+        ThreadStats &stats = threadStats();
+        JournalScope journal;
+        unique_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            lock.unlock();
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return 0;
+        }
+        // A budgeted set grows one value at a time, so that it takes no
+        // more than the values that fit.
+        bool budgeted = set->isBudgeted();
+        bool reserved = false;
+        size_t inserted = 0;
+        for (BatchCursor cursor(values, count, keyStream, set->elements); cursor.next();) {
+            if (cursor.isNull()) {
+                DEBUG_AS(function, ": invalid value (NULL)");
+                continue;
+            }
+            // As in insertValue, elements that would have to be copied are
+            // probed first, so that they are only copied for a new value.
+            bool present = (budgeted || !isExclusive(set->elements)) &&
+                           set->elements->contains(cursor.cipher(), cursor.cipherHash());
+            if (!present && budgeted && !set->admitsInsert(cursor.cipher().size())) {
+                set->budgetRejects++;
+                stats.count(BudgetRejectCount);
+                traceCipher(TraceOperation::Insert, id, false, cursor.cipher(), cursor.cipherHash());
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", cursor.cipher(),
+                                     "\" would exceed the memory budget");
+                continue;
+            }
+            if (!present && !budgeted && !reserved) {
+                StrSet &elements = set->mutableElements();
+                elements.reserve(elements.size() + count - cursor.index());
+                reserved = true;
+            }
+            bool added = !present && set->mutableElements().insert(cursor.cipher(), cursor.cipherHash());
+            if (added) {
+                set->filterInserted(cursor.cipherHash());
+            }
+            set->countInsert(added);
+            stats.count(added ? InsertedCount : DuplicateCount);
+            traceCipher(TraceOperation::Insert, id, added, cursor.cipher(), cursor.cipherHash());
+            if (added) {
+                journal.collect(JournalRecord::Insert, {id}, cursor.cipher());
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", cursor.cipher(), "\" inserted");
+                setResultBit(results, cursor.index(), true);
+                inserted++;
+            } else {
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", cursor.cipher(),
+                                     "\" was already present");
+            }
+        }
+        journal.commit();
+        return inserted;
+    }
+
+    size_t removeBatch(const char *function, SetNumber id, SetEntry *set, const char *const *values, size_t count,
+                       const char *key, unsigned char *results) {
+        clearResultBits(results, count);
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return 0;
+        }
+        if (values == nullptr) {
+            DEBUG_AS(function, ": invalid values (NULL)");
+            return 0;
+        }
+
+        KeyStream keyStream(key, keyStreamTargetLength);
+        ThreadStats &stats = threadStats();
+        JournalScope journal;
+        unique_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            lock.unlock();
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return 0;
+        }
+        size_t removed = 0;
+        for (BatchCursor cursor(values, count, keyStream, set->elements); cursor.next();) {
+            if (cursor.isNull()) {
+                DEBUG_AS(function, ": invalid value (NULL)");
+                continue;
+            }
+            // Only elements holding the value are copied to erase it.
+            bool erased = set->filterFor(cursor.cipherHash()) != FilterOutcome::Rejected &&
+                          (isExclusive(set->elements) ||
+                           set->elements->contains(cursor.cipher(), cursor.cipherHash())) &&
+                          set->mutableElements().erase(cursor.cipher(), cursor.cipherHash());
+            if (erased) {
+                set->filterRemoved();
+            }
+            set->countRemove(erased);
+            stats.count(erased ? RemovedCount : RemoveMissCount);
+            traceCipher(TraceOperation::Remove, id, erased, cursor.cipher(), cursor.cipherHash());
+            if (erased) {
+                journal.collect(JournalRecord::Remove, {id}, cursor.cipher());
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", cursor.cipher(), "\" removed");
+                setResultBit(results, cursor.index(), true);
+                removed++;
+            } else {
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", cursor.cipher(), "\" was not present");
+            }
+        }
+        journal.commit();
+        return removed;
+    }
+
+    size_t testBatch(const char *function, SetNumber id, SetEntry *set, const char *const *values, size_t count,
+                       const char *key, unsigned char *results) {
+        clearResultBits(results, count);
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return 0;
+        }
+        if (values == nullptr) {
+            DEBUG_AS(function, ": invalid values (NULL)");
+            return 0;
+        }
+
+        KeyStream keyStream(key, keyStreamTargetLength);
+        ThreadStats &stats = threadStats();
+        shared_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            lock.unlock();
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return 0;
+        }
+        size_t present = 0;
+        for (BatchCursor cursor(values, count, keyStream, set->elements); cursor.next();) {
+            if (cursor.isNull()) {
+                DEBUG_AS(function, ": invalid value (NULL)");
+                continue;
+            }
+            FilterOutcome outcome = set->filterFor(cursor.cipherHash());
+            bool found = outcome != FilterOutcome::Rejected &&
+                         set->elements->contains(cursor.cipher(), cursor.cipherHash());
+            set->countTest(stats, found, outcome);
+            stats.count(found ? TestHitCount : TestMissCount);
+            traceCipher(TraceOperation::Test, id, found, cursor.cipher(), cursor.cipherHash());
+            if (found) {
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", cursor.cipher(), "\" is present");
+                setResultBit(results, cursor.index(), true);
+                present++;
+            } else {
+                DEBUG_WITH_CYPHER_AS(function, ": set #" << id << ", cypher \"", cursor.cipher(), "\" is not present");
+            }
+        }
+        return present;
+    }
+
+    bool readFootprint(const char *function, SetNumber id, SetEntry *set, jnp1::encstrset_footprint *footprint) {
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        if (footprint == nullptr) {
+            DEBUG_AS(function, ": invalid footprint (NULL)");
+            return false;
+        }
+        shared_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            lock.unlock();
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        const ByteArena &arena = set->elements->byteArena();
+        footprint->table_bytes = set->elements->tableBytes();
+        footprint->arena_reserved = arena.reserved();
+        footprint->arena_used = arena.used();
+        footprint->arena_free = arena.freeListed();
+        footprint->arena_abandoned = arena.abandoned();
+        footprint->mapped_bytes = set->elements->borrowedBytes();
+        footprint->filter_bytes = set->filter == nullptr ? 0 : set->filter->bytes();
+        footprint->frozen_bytes = set->elements->frozenBytes();
+        lock.unlock();
+        DEBUG_AS(function, ": set #" << id << " holds " << footprint->table_bytes << " table byte(s) and "
+                                     << footprint->arena_used << " of " << footprint->arena_reserved
+                                     << " arena byte(s)");
+        return true;
+    }
+
+    bool readStats(const char *function, SetNumber id, SetEntry *set, jnp1::encstrset_stats *stats) {
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        if (stats == nullptr) {
+            DEBUG_AS(function, ": invalid stats (NULL)");
+            return false;
+        }
+        shared_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            lock.unlock();
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        *stats = jnp1::encstrset_stats();
+        addTableStats(*stats, *set);
+        stats->inserted = set->inserted;
+        stats->insert_duplicates = set->duplicates;
+        stats->removed = set->removed;
+        stats->remove_misses = set->removeMisses;
+        stats->budget_rejects = set->budgetRejects;
+        lock.unlock();
+        set->addTestTotals(*stats);
+        finishStats(*stats);
+        DEBUG_AS(function, ": set #" << id << " holds " << stats->elements << " element(s) in "
+                                     << stats->slots << " slot(s)");
+        return true;
+    }
+
+    bool saveSet(const char *function, SetNumber id, SetEntry *set, const char *path) {
+        if (path == nullptr) {
+            DEBUG_AS(function, ": invalid path (NULL)");
+            return false;
+        }
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        // Holding a reference keeps the elements unchanged while they are
+        // written: writers copy them first instead.
+        ElementsPointer elements;
+        {
+            shared_lock<shared_mutex> lock(set->mutex);
+            if (!set->deleted) {
+                elements = set->elements;
+            }
+        }
+        if (elements == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        bool saved = writeSnapshot(*elements, path);
+        trace(TraceOperation::Save, id, saved, elements->size());
+        if (!saved) {
+            DEBUG_AS(function, ": set #" << id << " could not be saved to \"" << path << "\"");
+            return false;
+        }
+        DEBUG_AS(function, ": set #" << id << " saved with " << elements->size() << " element(s)");
+        return true;
+    }
+
+    bool freezeSet(const char *function, SetNumber id, SetEntry *set) {
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        ElementsPointer elements;
+        {
+            shared_lock<shared_mutex> lock(set->mutex);
+            if (!set->deleted) {
+                elements = set->elements;
+            }
+        }
+        if (elements == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        if (elements->isFrozen()) {
+            trace(TraceOperation::Freeze, id, true, elements->size());
+            DEBUG_AS(function, ": set #" << id << " already frozen");
+            return true;
+        }
+        ElementsPointer frozen = newElements();
+        if (!frozen->freezeFrom(*elements)) {
+            trace(TraceOperation::Freeze, id, false, elements->size());
+            DEBUG_AS(function, ": set #" << id << " could not be frozen");
+            return false;
+        }
+        unique_lock<shared_mutex> lock(set->mutex);
+        if (set->deleted) {
+            lock.unlock();
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        bool unchanged = set->elements == elements;
+        if (unchanged) {
+            set->elements = move(frozen);
+            set->version++;
+        }
+        lock.unlock();
+        trace(TraceOperation::Freeze, id, unchanged, elements->size());
+        if (unchanged) {
+            DEBUG_AS(function, ": set #" << id << " frozen with " << elements->size() << " element(s)");
+        } else {
+            DEBUG_AS(function, ": set #" << id << " changed while being frozen");
+        }
+        return unchanged;
+    }
+
+    bool compactSet(const char *function, SetNumber id, SetEntry *set) {
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        for (int attempt = 0; attempt < compactAttempts; attempt++) {
+            ElementsPointer compacted = newElements();
+            uint64_t version = 0;
+            size_t sourceBytes = 0, slotCount = 0;
+            {
+                shared_lock<shared_mutex> lock(set->mutex);
+                if (set->deleted) {
+                    lock.unlock();
+                    DEBUG_AS(function, SET_NOT_EXIST(id));
+                    return false;
+                }
+                const StrSet &elements = *set->elements;
+                if (elements.isFrozen() || elements.isBorrowed() || elements.compactBytes() >= elements.heapBytes()) {
+                    lock.unlock();
+                    DEBUG_AS(function, ": set #" << id << " already compact");
+                    return true;
+                }
+                version = set->version;
+                sourceBytes = elements.heapBytes();
+                slotCount = elements.slotCapacity();
+                compacted->reserveCompacted(elements);
+            }
+            bool unchanged = true;
+            for (size_t begin = 0; unchanged && begin < slotCount; begin += compactStepSlots) {
+                shared_lock<shared_mutex> lock(set->mutex);
+                unchanged = set->version == version;
+                if (unchanged) {
+                    set->elements->forEachInRange(begin, min(begin + compactStepSlots, slotCount),
+                                                  [&](string_view cipher) {
+                                                      compacted->insert(cipher);
+                                                  });
+                }
+            }
+            size_t compactedBytes = compacted->heapBytes();
+            unique_lock<shared_mutex> lock(set->mutex);
+            if (set->deleted) {
+                lock.unlock();
+                DEBUG_AS(function, SET_NOT_EXIST(id));
+                return false;
+            }
+            if (set->version == version) {
+                ElementsPointer previous = exchange(set->elements, move(compacted));
+                set->version++;
+                lock.unlock();
+                DEBUG_AS(function, ": set #" << id << " compacted from " << sourceBytes << " to " << compactedBytes
+                                             << " byte(s)");
+                return true;
+            }
+        }
+        DEBUG_AS(function, ": set #" << id << " changed while being compacted");
+        return false;
+    }
+
+    bool shareSet(const char *function, SetNumber id, SetEntry *set, const char *name) {
+        if (name == nullptr) {
+            DEBUG_AS(function, ": invalid name (NULL)");
+            return false;
+        }
+        if (set == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        ElementsPointer elements;
+        {
+            shared_lock<shared_mutex> lock(set->mutex);
+            if (!set->deleted) {
+                elements = set->elements;
+            }
+        }
+        if (elements == nullptr) {
+            DEBUG_AS(function, SET_NOT_EXIST(id));
+            return false;
+        }
+        bool shared = writeShared(*elements, name);
+        trace(TraceOperation::Share, id, shared, elements->size());
+        if (!shared) {
+            DEBUG_AS(function, ": set #" << id << " could not be shared as \"" << name << "\"");
+            return false;
+        }
+        if (ElementsPointer segment = readShared(name, false)) {
+            unique_lock<shared_mutex> lock(set->mutex);
+            if (set->elements == elements) {
+                set->elements = move(segment);
+                set->version++;
+            }
+        }
+        DEBUG_AS(function, ": set #" << id << " shared as \"" << name << "\" with " << elements->size()
+                                     << " element(s)");
+        return true;
+    }
+} // namespace encstrset_detail
@@ -0,0 +1,67 @@
+#ifndef ENCSTRSET_ENCSTRSET_OPS_H
+#define ENCSTRSET_ENCSTRSET_OPS_H
+
+#include "encstrset.h"
+#include "encstrset_common.h"
+#include "encstrset_sets.h"
+#include "encstrset_encode.h"
+#include "encstrset_algebra.h"
+#include <cstddef>
+
+namespace encstrset_detail {
+    void clearResultBits(unsigned char *results, size_t count);
+
+    void combineInto(const char *function, SetOperation operation, SetNumber aId, SetNumber bId, SetNumber dstId);
+
+    // Fills in the sizes of both sets and of their intersection; returns
+    // false if either set does not exist.
+    bool measureOverlap(const char *function, SetNumber aId, SetNumber bId,
+                        size_t &aSize, size_t &bSize, size_t &commonSize);
+
+    bool insertValue(const char *function, SetNumber id, SetEntry *set, const char *value, size_t valueLength,
+                     const KeyStream &keyStream);
+
+    bool removeValue(const char *function, SetNumber id, SetEntry *set, const char *value, size_t valueLength,
+                     const KeyStream &keyStream);
+
+    bool testValue(const char *function, SetNumber id, SetEntry *set, const char *value, size_t valueLength,
+                   const KeyStream &keyStream);
+
+    // Call with set.mutex held.
+    void addTableStats(jnp1::encstrset_stats &stats, const SetEntry &set);
+
+    void finishStats(jnp1::encstrset_stats &stats);
+
+    size_t setSize(const char *function, SetNumber id, SetEntry *set);
+
+    void clearSet(const char *function, SetNumber id, SetEntry *set);
+
+    size_t insertBatch(const char *function, SetNumber id, SetEntry *set, const char *const *values, size_t count,
+                       const char *key, unsigned char *results);
+
+    size_t removeBatch(const char *function, SetNumber id, SetEntry *set, const char *const *values, size_t count,
+                       const char *key, unsigned char *results);
+
+    size_t testBatch(const char *function, SetNumber id, SetEntry *set, const char *const *values, size_t count,
+                       const char *key, unsigned char *results);
+
+    bool readFootprint(const char *function, SetNumber id, SetEntry *set, jnp1::encstrset_footprint *footprint);
+
+    bool readStats(const char *function, SetNumber id, SetEntry *set, jnp1::encstrset_stats *stats);
+
+    bool saveSet(const char *function, SetNumber id, SetEntry *set, const char *path);
+
+    // The perfect hash is built from a reference to the elements, so tests
+    // go on meanwhile; the set is only switched over if it is unchanged by
+    // then. A set changed while it was being frozen is left as it is, and
+    // false is returned.
+    bool freezeSet(const char *function, SetNumber id, SetEntry *set);
+
+    bool compactSet(const char *function, SetNumber id, SetEntry *set);
+
+    // Once the segment is written the set itself uses it, as an attached
+    // set would, unless it changed in the meantime.
+    bool shareSet(const char *function, SetNumber id, SetEntry *set, const char *name);
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_OPS_H
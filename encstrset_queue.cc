@@ -0,0 +1,129 @@
+#include "encstrset_queue.h"
+#include "encstrset_sets.h"
+#include "encstrset_encode.h"
+#include "encstrset_ops.h"
+#include <cstdint>
+
+using namespace std;
+
+namespace encstrset_detail {
+    WorkQueue::WorkQueue(size_t workerCount, size_t capacity, jnp1::encstrset_completion_callback callback, void *context)
+            : workerCount(workerCount), capacity(capacity), callback(callback), context(context),
+              submissions(capacity), completions(capacity) {
+        for (size_t i = 0; i < workerCount; i++) {
+            workers.emplace_back([this] {
+                work();
+            });
+        }
+    }
+
+    WorkQueue::~WorkQueue() {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        requestsReady.notify_all();
+        for (thread &worker : workers) {
+            worker.join();
+        }
+    }
+
+    size_t WorkQueue::submit(const jnp1::encstrset_request *requests, size_t count) {
+        size_t accepted;
+        {
+            lock_guard<mutex> lock(queueMutex);
+            accepted = min(count, capacity - outstanding);
+            submissions.push(requests, accepted);
+            outstanding += accepted;
+        }
+        if (accepted > 1) {
+            requestsReady.notify_all();
+        } else if (accepted == 1) {
+            requestsReady.notify_one();
+        }
+        return accepted;
+    }
+
+    size_t WorkQueue::poll(jnp1::encstrset_completion *target, size_t limit, bool wait) {
+        unique_lock<mutex> lock(queueMutex);
+        if (wait) {
+            completionsReady.wait(lock, [&] {
+                return !completions.empty() || outstanding == completions.size();
+            });
+        }
+        size_t polled = completions.pop(target, limit);
+        outstanding -= polled;
+        return polled;
+    }
+
+    void WorkQueue::work() {
+        vector<jnp1::encstrset_request> batch;
+        vector<jnp1::encstrset_completion> results;
+        unique_lock<mutex> lock(queueMutex);
+        for (;;) {
+            requestsReady.wait(lock, [&] {
+                return stopping || !submissions.empty();
+            });
+            if (submissions.empty()) {
+                return;
+            }
+            size_t share = (submissions.size() + workerCount - 1) / workerCount;
+            batch.resize(min(maxBatch, share));
+            batch.resize(submissions.pop(batch.data(), batch.size()));
+            lock.unlock();
+
+            run(batch, results);
+            if (callback != nullptr) {
+                callback(context, results.data(), results.size());
+            }
+            lock.lock();
+            if (callback != nullptr) {
+                outstanding -= results.size();
+            } else {
+                completions.push(results.data(), results.size());
+            }
+            completionsReady.notify_all();
+        }
+    }
+
+    void WorkQueue::run(vector<jnp1::encstrset_request> &batch, vector<jnp1::encstrset_completion> &results) {
+        results.resize(batch.size());
+        for (size_t i = 0; i < batch.size(); i++) {
+            results[i].cookie = batch[i].cookie;
+        }
+        vector<uint32_t> order(batch.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = uint32_t(i);
+        }
+        stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return batch[a].id < batch[b].id;
+        });
+        SetPointer set;
+        for (size_t i = 0; i < order.size(); i++) {
+            const jnp1::encstrset_request &request = batch[order[i]];
+            if (i == 0 || request.id != batch[order[i - 1]].id) {
+                set = findSet(request.id);
+            }
+            KeyStream keyStream(request.key, lengthOrZero(request.key, request.key_length),
+                                request.value_length);
+            switch (request.operation) {
+                case jnp1::ENCSTRSET_INSERT:
+                    results[order[i]].result = insertValue("encstrset_queue", request.id, set.get(),
+                                                           request.value, request.value_length, keyStream);
+                    break;
+                case jnp1::ENCSTRSET_REMOVE:
+                    results[order[i]].result = removeValue("encstrset_queue", request.id, set.get(),
+                                                           request.value, request.value_length, keyStream);
+                    break;
+                case jnp1::ENCSTRSET_TEST:
+                    results[order[i]].result = testValue("encstrset_queue", request.id, set.get(),
+                                                         request.value, request.value_length, keyStream);
+                    break;
+                default:
+                    DEBUG_AS("encstrset_queue", ": invalid operation " << int(request.operation));
+                    results[order[i]].result = false;
+                    break;
+            }
+        }
+    }
+} // namespace encstrset_detail
@@ -0,0 +1,98 @@
+#ifndef ENCSTRSET_ENCSTRSET_QUEUE_H
+#define ENCSTRSET_ENCSTRSET_QUEUE_H
+
+#include "encstrset.h"
+#include "encstrset_common.h"
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <cassert>
+#include <algorithm>
+#include <cstddef>
+
+namespace encstrset_detail {
+    // Fixed-capacity ring of requests or completions, guarded by its owner.
+    template<typename T>
+    class Ring {
+    public:
+        explicit Ring(size_t capacity) : items(capacity) {
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        bool empty() const {
+            return count == 0;
+        }
+
+        // There must be room for all of them.
+        void push(const T *source, size_t pushed) {
+            assert(count + pushed <= items.size());
+            for (size_t i = 0; i < pushed; i++) {
+                items[(head + count + i) % items.size()] = source[i];
+            }
+            count += pushed;
+        }
+
+        // Moves up to limit of the oldest items to target; returns how many.
+        size_t pop(T *target, size_t limit) {
+            size_t popped = min(limit, count);
+            for (size_t i = 0; i < popped; i++) {
+                target[i] = items[(head + i) % items.size()];
+            }
+            head = (head + popped) % items.size();
+            count -= popped;
+            return popped;
+        }
+
+    private:
+        vector<T> items;
+        size_t head = 0;
+        size_t count = 0;
+    };
+
+    // Requests of an encstrset_queue, run by its workers. Submissions and
+    // completions go through rings under one mutex, taken once per batch
+    // by both callers and workers. A worker takes its share of the pending
+    // requests, up to maxBatch, and runs them grouped by set, so that each
+    // set is looked up once per batch and its table stays in cache.
+    class WorkQueue {
+    public:
+        static constexpr size_t maxBatch = 256;
+
+        WorkQueue(size_t workerCount, size_t capacity, jnp1::encstrset_completion_callback callback, void *context);
+
+        WorkQueue(const WorkQueue &) = delete;
+
+        WorkQueue &operator=(const WorkQueue &) = delete;
+
+        ~WorkQueue();
+
+        size_t submit(const jnp1::encstrset_request *requests, size_t count);
+
+        size_t poll(jnp1::encstrset_completion *target, size_t limit, bool wait);
+
+    private:
+        const size_t workerCount;
+        const size_t capacity;
+        const jnp1::encstrset_completion_callback callback;
+        void *const context;
+        mutex queueMutex;
+        condition_variable requestsReady;
+        condition_variable completionsReady;
+        Ring<jnp1::encstrset_request> submissions;
+        Ring<jnp1::encstrset_completion> completions;
+        size_t outstanding = 0;
+        bool stopping = false;
+        vector<thread> workers;
+
+        void work();
+
+        // Results come out in the order of batch.
+        static void run(vector<jnp1::encstrset_request> &batch, vector<jnp1::encstrset_completion> &results);
+    };
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_QUEUE_H
@@ -0,0 +1,250 @@
+#include "encstrset_sets.h"
+#include "encstrset_memory.h"
+#include <string_view>
+#include <cassert>
+#include <new>
+
+using namespace std;
+
+namespace {
+    using namespace encstrset_detail;
+
+    // Slots of deleted sets, kept in a few stacks so that threads creating
+    // and deleting sets rarely share one. A thread pushes to its own stack
+    // and pops from it first, so it reuses the slots it has just freed.
+    // A stack may hold a slot that journal replay has occupied again; such
+    // entries are skipped when popped.
+    const size_t freeSlotStripeCount = 8;
+
+    struct alignas(64) FreeSlots {
+        mutex lock;
+        vector<SetNumber> slots;
+    };
+
+    atomic<SetNumber> nextUnusedSlot{0};
+
+    FreeSlots *freeSlots() {
+        static FreeSlots stacks[freeSlotStripeCount];
+        return stacks;
+    }
+
+    FreeSlots &ownFreeSlots() {
+        return freeSlots()[threadStats().stripe % freeSlotStripeCount];
+    }
+
+    bool popFreeSlot(FreeSlots &stack, SetNumber &slot) {
+        lock_guard<mutex> lock(stack.lock);
+        if (stack.slots.empty()) {
+            return false;
+        }
+        slot = stack.slots.back();
+        stack.slots.pop_back();
+        return true;
+    }
+
+    // A freed slot if there is one, otherwise the next unused one.
+    SetNumber takeSlot() {
+        FreeSlots &own = ownFreeSlots();
+        SetNumber slot;
+        if (popFreeSlot(own, slot)) {
+            return slot;
+        }
+        for (size_t i = 0; i < freeSlotStripeCount; i++) {
+            FreeSlots &stack = freeSlots()[i];
+            if (&stack != &own && popFreeSlot(stack, slot)) {
+                return slot;
+            }
+        }
+        slot = nextUnusedSlot.fetch_add(1);
+        assert(slot <= slotMask);
+        return slot;
+    }
+
+    RegistrySlot &slotEntry(RegistryShard &shard, SetNumber slot) {
+        size_t index = slot / registryShardCount;
+        if (index >= shard.slots.size()) {
+            shard.slots.resize(index + 1);
+        }
+        return shard.slots[index];
+    }
+} // namespace
+
+namespace encstrset_detail {
+    atomic<size_t> globalBudget{0};
+
+    RegistryShard &registryShard(SetNumber slot) {
+        static RegistryShard shards[registryShardCount];
+        return shards[slot % registryShardCount];
+    }
+
+    void recycleSlot(SetNumber id) {
+        if (generationOf(id) < lastGeneration) {
+            FreeSlots &own = ownFreeSlots();
+            lock_guard<mutex> lock(own.lock);
+            own.slots.push_back(slotOf(id));
+        }
+    }
+
+    SetPointer findSet(SetNumber id) {
+        SetNumber slot = slotOf(id);
+        size_t index = slot / registryShardCount;
+        RegistryShard &shard = registryShard(slot);
+        shared_lock<shared_mutex> lock(shard.mutex);
+        if (index >= shard.slots.size() || shard.slots[index].generation != generationOf(id)) {
+            return nullptr;
+        }
+        return shard.slots[index].set;
+    }
+
+    SetNumber registerSet(ElementsPointer elements) {
+        SetPointer set = allocate_shared<SetEntry>(PooledAllocator<SetEntry>(), move(elements));
+        while (true) {
+            SetNumber slot = takeSlot();
+            RegistryShard &shard = registryShard(slot);
+            unique_lock<shared_mutex> lock(shard.mutex);
+            RegistrySlot &entry = slotEntry(shard, slot);
+            if (entry.set == nullptr) {
+                entry.set = move(set);
+                return setNumber(slot, entry.generation);
+            }
+        }
+    }
+
+    SetPointer unregisterSet(SetNumber id) {
+        SetNumber slot = slotOf(id);
+        size_t index = slot / registryShardCount;
+        RegistryShard &shard = registryShard(slot);
+        unique_lock<shared_mutex> lock(shard.mutex);
+        if (index >= shard.slots.size() || shard.slots[index].generation != generationOf(id) ||
+            shard.slots[index].set == nullptr) {
+            return nullptr;
+        }
+        shard.slots[index].generation++;
+        return move(shard.slots[index].set);
+    }
+
+    SetPointer placeSet(SetNumber id, SetPointer set) {
+        SetNumber slot = slotOf(id);
+        SetNumber unused = nextUnusedSlot.load();
+        while (unused <= slot && !nextUnusedSlot.compare_exchange_weak(unused, slot + 1)) {
+        }
+        for (; unused < slot; unused++) {
+            recycleSlot(unused);
+        }
+        RegistryShard &shard = registryShard(slot);
+        unique_lock<shared_mutex> lock(shard.mutex);
+        RegistrySlot &entry = slotEntry(shard, slot);
+        entry.generation = generationOf(id);
+        return exchange(entry.set, move(set));
+    }
+
+    SetEntry::~SetEntry() {
+        if (TestCounts *counts = testCounts.load(memory_order_relaxed)) {
+            BlockCache::give(counts, testStripeCount * sizeof(TestCounts));
+        }
+    }
+
+    ElementsPointer SetEntry::retire() {
+        unique_lock<shared_mutex> lock(mutex);
+        deleted = true;
+        version++;
+        filter.reset();
+        return exchange(elements, newElements());
+    }
+
+    void SetEntry::rebuildFilter() {
+        if (filter == nullptr) {
+            return;
+        }
+        filter = make_unique<BloomFilter>(filterCapacityFor(elements->size()));
+        filterStale = 0;
+        elements->forEach([&](string_view cipher) {
+            filter->add(StrSet::hash(cipher));
+        });
+    }
+
+    size_t SetEntry::memoryUsage() const {
+        size_t bytes = sharedBlockBytes<SetEntry>.load(memory_order_relaxed) +
+                       sharedBlockBytes<StrSet>.load(memory_order_relaxed) + elements->heapBytes();
+        if (filter != nullptr) {
+            bytes += sizeof(BloomFilter) + filter->bytes();
+        }
+        if (testCounts.load(memory_order_relaxed) != nullptr) {
+            bytes += testStripeCount * sizeof(TestCounts);
+        }
+        return bytes;
+    }
+
+    bool SetEntry::admitsInsert(size_t length) const {
+        if (!isBudgeted()) {
+            return true;
+        }
+        const StrSet &current = *elements;
+        size_t growth = current.insertGrowth(length);
+        if (elements.use_count() > 1 || current.isBorrowed() || current.isFrozen()) {
+            growth += current.copyGrowth();
+        }
+        if (filter != nullptr && current.size() + 1 > filter->designCapacity()) {
+            growth += BloomFilter::bytesFor(filterCapacityFor(current.size() + 1)) - filter->bytes();
+        }
+        if (growth == 0) {
+            return true;
+        }
+        size_t global = globalBudget.load(memory_order_relaxed);
+        return (budget == 0 || memoryUsage() + growth <= budget) &&
+               (global == 0 || BlockCache::inUse() + growth <= global);
+    }
+
+    bool SetEntry::admitsReplacement(const StrSet &replacement) const {
+        if (!isBudgeted()) {
+            return true;
+        }
+        size_t current = elements->heapBytes();
+        size_t next = replacement.heapBytes();
+        if (next <= current) {
+            return true;
+        }
+        // The replacement is counted in use already; elements held by this
+        // set alone are released by it.
+        size_t global = globalBudget.load(memory_order_relaxed);
+        size_t released = elements.use_count() == 1 ? current : 0;
+        size_t inUse = BlockCache::inUse();
+        return (budget == 0 || memoryUsage() - current + next <= budget) &&
+               (global == 0 || inUse - min(inUse, released) <= global);
+    }
+
+    void SetEntry::countTest(ThreadStats &stats, bool found, FilterOutcome outcome) {
+        TestCounts *counts = testCounts.load(memory_order_acquire);
+        if (counts == nullptr) {
+            auto *fresh = static_cast<TestCounts *>(BlockCache::take(testStripeCount * sizeof(TestCounts)));
+            for (size_t i = 0; i < testStripeCount; i++) {
+                new(&fresh[i]) TestCounts;
+            }
+            if (testCounts.compare_exchange_strong(counts, fresh, memory_order_acq_rel)) {
+                counts = fresh;
+            } else {
+                BlockCache::give(fresh, testStripeCount * sizeof(TestCounts));
+            }
+        }
+        TestCounts &stripe = counts[stats.stripe % testStripeCount];
+        (found ? stripe.hits : stripe.misses).fetch_add(1, memory_order_relaxed);
+        if (outcome == FilterOutcome::Rejected) {
+            stripe.filterRejects.fetch_add(1, memory_order_relaxed);
+            stats.count(FilterRejectCount);
+        } else if (outcome == FilterOutcome::Passed && !found) {
+            stripe.filterFalsePositives.fetch_add(1, memory_order_relaxed);
+            stats.count(FilterFalsePositiveCount);
+        }
+    }
+
+    void SetEntry::addTestTotals(jnp1::encstrset_stats &stats) const {
+        if (const TestCounts *counts = testCounts.load(memory_order_acquire)) {
+            for (size_t i = 0; i < testStripeCount; i++) {
+                stats.test_hits += counts[i].hits.load(memory_order_relaxed);
+                stats.test_misses += counts[i].misses.load(memory_order_relaxed);
+                stats.filter_rejects += counts[i].filterRejects.load(memory_order_relaxed);
+                stats.filter_false_positives += counts[i].filterFalsePositives.load(memory_order_relaxed);
+            }
+        }
+    }
+} // namespace encstrset_detail
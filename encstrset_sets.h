@@ -0,0 +1,275 @@
+#ifndef ENCSTRSET_ENCSTRSET_SETS_H
+#define ENCSTRSET_ENCSTRSET_SETS_H
+
+#include "encstrset.h"
+#include "encstrset_common.h"
+#include "encstrset_table.h"
+#include "encstrset_bloom.h"
+#include "encstrset_stats.h"
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+namespace encstrset_detail {
+    // Test counts of a set, striped by thread so that concurrent tests of
+    // one set rarely share a cache line.
+    struct alignas(64) TestCounts {
+        atomic<uint64_t> hits{0};
+        atomic<uint64_t> misses{0};
+        atomic<uint64_t> filterRejects{0};
+        atomic<uint64_t> filterFalsePositives{0};
+    };
+
+    // What a set's filter said about a tested value, if it has one.
+    enum class FilterOutcome {
+        Unfiltered,
+        Rejected,
+        Passed
+    };
+
+    // Sets are filtered for at least this many elements, so that small
+    // ones are not rebuilt every few inserts.
+    const size_t minimumFilterCapacity = 256;
+
+    const size_t testStripeCount = 8;
+
+    // Limit on the memory of all sets for inserts (see
+    // encstrset_set_global_budget); zero if none.
+    extern atomic<size_t> globalBudget;
+
+    // A set together with the lock guarding it: many readers (size, test)
+    // or a single writer at a time. The elements may be shared with other
+    // sets after encstrset_copy; writers go through mutableElements(), which
+    // takes a private copy first if needed.
+    struct SetEntry {
+        mutable shared_mutex mutex;
+        ElementsPointer elements;
+
+        // Counts of calls on this set. Inserts and removes hold mutex
+        // exclusively, so theirs are plain; tests only hold it shared, so
+        // theirs are striped and allocated on the first test.
+        uint64_t inserted = 0;
+        uint64_t duplicates = 0;
+        uint64_t removed = 0;
+        uint64_t removeMisses = 0;
+        atomic<TestCounts *> testCounts{nullptr};
+
+        // Bumped, with mutex held exclusively, whenever the elements may
+        // change, so that compaction can tell they did without holding a
+        // reference to them.
+        uint64_t version = 0;
+
+        // Set, with mutex held exclusively, once the set is taken out of the
+        // registry. Handles keep the entry alive and check it instead of
+        // looking the set up again.
+        bool deleted = false;
+
+        // Optional filter in front of the table for tests and removes (see
+        // encstrset_set_filter), guarded by mutex like the elements, and
+        // the number of elements removed since it was built.
+        unique_ptr<BloomFilter> filter;
+        size_t filterStale = 0;
+
+        // Optional limit on memoryUsage() for inserts (see
+        // encstrset_set_budget), zero if none, and the inserts turned away
+        // by it or by globalBudget. Guarded by mutex.
+        size_t budget = 0;
+        uint64_t budgetRejects = 0;
+
+        explicit SetEntry(ElementsPointer elements) : elements(move(elements)) {
+        }
+
+        SetEntry(const SetEntry &) = delete;
+
+        SetEntry &operator=(const SetEntry &) = delete;
+
+        ~SetEntry();
+
+        StrSet &mutableElements() {
+            version++;
+            return ownedElements(elements);
+        }
+
+        // Marks the set deleted and returns its elements, to be released by
+        // the caller after its own locks.
+        ElementsPointer retire();
+
+        // Replaces the elements wholesale, rebuilding the filter for them.
+        void replaceElements(ElementsPointer replacement) {
+            elements = move(replacement);
+            version++;
+            rebuildFilter();
+        }
+
+        static size_t filterCapacityFor(size_t count) {
+            return max(minimumFilterCapacity, 2 * count);
+        }
+
+        void rebuildFilter();
+
+        // Heap memory of the set: this entry, its elements (in full, even if
+        // shared with other sets), filter and test counts. Call with mutex
+        // held.
+        size_t memoryUsage() const;
+
+        bool isBudgeted() const {
+            return budget != 0 || globalBudget.load(memory_order_relaxed) != 0;
+        }
+
+        // Whether inserting a ciphertext of length bytes, not held yet,
+        // keeps the set and all sets within their budgets. An insert that
+        // takes no more memory is always let through. Call with mutex held
+        // exclusively.
+        bool admitsInsert(size_t length) const;
+
+        // Whether replacing the elements with replacement, built already or
+        // shared with another set, keeps the set and all sets within their
+        // budgets. One taking no more memory is always let through. Call
+        // with mutex held exclusively.
+        bool admitsReplacement(const StrSet &replacement) const;
+
+        FilterOutcome filterFor(size_t cipherHash) const {
+            if (filter == nullptr) {
+                return FilterOutcome::Unfiltered;
+            }
+            return filter->mayContain(cipherHash) ? FilterOutcome::Passed : FilterOutcome::Rejected;
+        }
+
+        // Keep the filter in step with single elements being added or
+        // removed; it is rebuilt once it holds more elements than it was
+        // sized for, or once removed ones, which it still passes, reach
+        // half the elements left.
+        void filterInserted(size_t cipherHash) {
+            if (filter == nullptr) {
+                return;
+            }
+            if (elements->size() > filter->designCapacity()) {
+                rebuildFilter();
+            } else {
+                filter->add(cipherHash);
+            }
+        }
+
+        void filterRemoved() {
+            if (filter != nullptr && ++filterStale > max(minimumFilterCapacity, elements->size()) / 2) {
+                rebuildFilter();
+            }
+        }
+
+        void countInsert(bool added) {
+            (added ? inserted : duplicates)++;
+        }
+
+        void countRemove(bool erased) {
+            (erased ? removed : removeMisses)++;
+        }
+
+        // Also counts the filter's outcome in stats; the caller counts the
+        // hit or miss there.
+        void countTest(ThreadStats &stats, bool found, FilterOutcome outcome);
+
+        void addTestTotals(jnp1::encstrset_stats &stats) const;
+    };
+
+    using SetPointer = shared_ptr<SetEntry>;
+
+    // Takes shared locks on both sets in set number order (a single lock if
+    // they are the same set), like encstrset_copy does.
+    class PairReadLock {
+    public:
+        PairReadLock(SetNumber aId, SetEntry &a, SetNumber bId, SetEntry &b)
+                : first(aId <= bId ? a.mutex : b.mutex, defer_lock),
+                  second(aId <= bId ? b.mutex : a.mutex, defer_lock) {
+            first.lock();
+            if (&a != &b) {
+                second.lock();
+            }
+        }
+
+    private:
+        shared_lock<shared_mutex> first;
+        shared_lock<shared_mutex> second;
+    };
+
+    // A set number packs the slot of the set in the registry with the
+    // generation of that slot, which grows each time a set in it is deleted,
+    // so that slots are reused but set numbers are not. Unused slots are
+    // taken in order first, making the first sets 0, 1, 2, ... Half the
+    // bits go to each, and a slot whose generations run out is retired;
+    // the last generation is never used so that no set gets number
+    // ENCSTRSET_INVALID_ID.
+    const int slotBits = numeric_limits<SetNumber>::digits / 2;
+    const SetNumber slotMask = (SetNumber(1) << slotBits) - 1;
+    const SetNumber lastGeneration = (numeric_limits<SetNumber>::max() >> slotBits) - 1;
+
+    inline SetNumber slotOf(SetNumber id) {
+        return id & slotMask;
+    }
+
+    inline SetNumber generationOf(SetNumber id) {
+        return id >> slotBits;
+    }
+
+    inline SetNumber setNumber(SetNumber slot, SetNumber generation) {
+        return generation << slotBits | slot;
+    }
+
+    struct RegistrySlot {
+        SetPointer set;
+        SetNumber generation = 0;
+    };
+
+    // Slots are striped over shards (slot i is entry i / registryShardCount
+    // of shard i % registryShardCount) so that creating, deleting and
+    // looking up different sets rarely contends on the same lock.
+    const size_t registryShardCount = 64;
+
+    struct RegistryShard {
+        mutable shared_mutex mutex;
+        vector<RegistrySlot> slots;
+    };
+
+    RegistryShard &registryShard(SetNumber slot);
+
+    // Makes the slot of a deleted set available again, unless its
+    // generations have run out.
+    void recycleSlot(SetNumber id);
+
+    // Returns the set, or nullptr if it does not exist. The returned pointer
+    // keeps the set alive even if it is deleted concurrently.
+    SetPointer findSet(SetNumber id);
+
+    SetNumber registerSet(ElementsPointer elements);
+
+    // Takes the set out of the registry and moves its slot to the next
+    // generation. The slot is only reused once recycleSlot is called.
+    SetPointer unregisterSet(SetNumber id);
+
+    // Puts a set under the given number, as journal replay does, and returns
+    // the set it replaces, if any. Unused slots skipped over are freed.
+    SetPointer placeSet(SetNumber id, SetPointer set);
+
+    // Calls visit(id, set) for every set, holding the lock of its shard.
+    template<typename Visitor>
+    void forEachSet(Visitor visit) {
+        for (size_t shardIndex = 0; shardIndex < registryShardCount; shardIndex++) {
+            RegistryShard &shard = registryShard(shardIndex);
+            shared_lock<shared_mutex> lock(shard.mutex);
+            for (size_t index = 0; index < shard.slots.size(); index++) {
+                const RegistrySlot &entry = shard.slots[index];
+                if (entry.set != nullptr) {
+                    visit(setNumber(index * registryShardCount + shardIndex, entry.generation), entry.set);
+                }
+            }
+        }
+    }
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_SETS_H
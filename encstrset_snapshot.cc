@@ -0,0 +1,305 @@
+#include "encstrset_snapshot.h"
+#include "encstrset_arena.h"
+#include <cstring>
+#include <cstdio>
+#include <utility>
+
+#ifdef ENCSTRSET_POSIX_FILES
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+    using namespace encstrset_detail;
+
+    // Snapshot files: a SnapshotHeader followed by the table
+    // image (control bytes, then slots), the arena bytes and, if any block
+    // was ever released, the arena free lists. Every section starts at a
+    // multiple of snapshotAlignment, so the file can be mapped and its
+    // table used in place.
+    const char snapshotMagic[8] = {'E', 'N', 'C', 'S', 'S', 'E', 'T', '\0'};
+    // Version 3 changed CipherTable::hash, and with it where elements are.
+    const uint32_t snapshotVersion = 3;
+    const size_t snapshotAlignment = 64;
+
+    // Tables are probed with CipherTable::hash, so a snapshot is only
+    // usable by a build that hashes this text the same way.
+    const char snapshotHashProbe[] = "encstrset snapshot hash probe";
+
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t layoutSignature;
+        uint64_t hashProbe;
+        uint64_t slotCount;
+        uint64_t elementCount;
+        uint64_t deletedCount;
+        uint64_t cipherBytes;
+        uint64_t arenaUsed;
+        uint64_t arenaFree;
+        uint64_t arenaAbandoned;
+        uint64_t tableOffset;
+        uint64_t arenaOffset;
+        uint64_t freeListOffset;
+        uint64_t fileSize;
+        uint64_t payloadChecksum;
+        uint64_t headerChecksum;
+    };
+
+    uint64_t headerChecksum(const SnapshotHeader &header) {
+        return checksum(&header, offsetof(SnapshotHeader, headerChecksum), 0);
+    }
+
+    size_t freeListBytes(const CipherTable::Image &image) {
+        return image.arenaFreeLists == nullptr ? 0 : ByteArena::freeListCount * sizeof(uint64_t);
+    }
+
+    uint64_t payloadChecksum(const CipherTable::Image &image) {
+        uint64_t result = checksum(image.table, image.tableBytes, 0);
+        result = checksum(image.arenaBytes, image.arenaUsed, result);
+        return checksum(image.arenaFreeLists, freeListBytes(image), result);
+    }
+
+    size_t alignedOffset(size_t offset) {
+        return (offset + snapshotAlignment - 1) / snapshotAlignment * snapshotAlignment;
+    }
+
+    bool writePadded(FILE *file, const void *data, size_t length, size_t offset) {
+        static const char padding[snapshotAlignment] = {};
+        long position = ftell(file);
+        if (position < 0 || size_t(position) > offset ||
+            fwrite(padding, 1, offset - size_t(position), file) != offset - size_t(position)) {
+            return false;
+        }
+        return length == 0 || fwrite(data, 1, length, file) == length;
+    }
+
+    // The header is written last, so that a snapshot is never found with a
+    // valid header in front of an incomplete payload.
+    bool writeSnapshotImage(FILE *file, const StrSet &elements) {
+        if (elements.isFrozen()) {
+            return writeSnapshotImage(file, StrSet(elements));
+        }
+        CipherTable::Image image = elements.image();
+        SnapshotHeader header = {};
+        memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+        header.version = snapshotVersion;
+        header.headerSize = sizeof(SnapshotHeader);
+        header.layoutSignature = CipherTable::layoutSignature();
+        header.hashProbe = CipherTable::hash(snapshotHashProbe);
+        header.slotCount = image.slotCount;
+        header.elementCount = image.elementCount;
+        header.deletedCount = image.deletedCount;
+        header.cipherBytes = image.cipherBytes;
+        header.arenaUsed = image.arenaUsed;
+        header.arenaFree = image.arenaFree;
+        header.arenaAbandoned = image.arenaAbandoned;
+        header.tableOffset = alignedOffset(sizeof(SnapshotHeader));
+        header.arenaOffset = alignedOffset(header.tableOffset + image.tableBytes);
+        size_t end = header.arenaOffset + image.arenaUsed;
+        if (image.arenaFreeLists != nullptr) {
+            header.freeListOffset = alignedOffset(end);
+            end = header.freeListOffset + freeListBytes(image);
+        }
+        header.fileSize = end;
+        header.payloadChecksum = payloadChecksum(image);
+        header.headerChecksum = headerChecksum(header);
+        return writePadded(file, image.table, image.tableBytes, header.tableOffset) &&
+               writePadded(file, image.arenaBytes, image.arenaUsed, header.arenaOffset) &&
+               (image.arenaFreeLists == nullptr ||
+                writePadded(file, image.arenaFreeLists, freeListBytes(image), header.freeListOffset)) &&
+               fflush(file) == 0 && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 &&
+               fflush(file) == 0;
+    }
+
+#ifdef ENCSTRSET_POSIX_FILES
+    // The whole of an open file or shared memory segment, mapped read-only.
+    shared_ptr<const void> mapDescriptor(int descriptor, size_t &size) {
+        struct stat status;
+        void *mapping = MAP_FAILED;
+        if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+            size = size_t(status.st_size);
+            mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        }
+        if (mapping == MAP_FAILED) {
+            return nullptr;
+        }
+        size_t mappedSize = size;
+        return shared_ptr<const void>(mapping, [mappedSize](const void *address) {
+            munmap(const_cast<void *>(address), mappedSize);
+        });
+    }
+#endif
+
+    bool sectionFits(uint64_t offset, uint64_t length, uint64_t fileSize) {
+        return offset % snapshotAlignment == 0 && offset <= fileSize && length <= fileSize - offset;
+    }
+
+    // Returns nullptr for files that are not compatible snapshots. The
+    // header and the structure of the table are always checked, as the
+    // file or segment may come from anywhere; verification also checksums
+    // the whole payload.
+    ElementsPointer snapshotElements(shared_ptr<const void> file, size_t size, bool verify) {
+        if (file == nullptr || size < sizeof(SnapshotHeader)) {
+            return nullptr;
+        }
+        const char *bytes = static_cast<const char *>(file.get());
+        SnapshotHeader header;
+        memcpy(&header, bytes, sizeof(header));
+        if (memcmp(header.magic, snapshotMagic, sizeof(header.magic)) != 0 ||
+            header.version != snapshotVersion || header.headerSize != sizeof(SnapshotHeader) ||
+            header.headerChecksum != headerChecksum(header) ||
+            header.layoutSignature != CipherTable::layoutSignature() ||
+            header.hashProbe != CipherTable::hash(snapshotHashProbe) || header.fileSize != size ||
+            !CipherTable::isValidCapacity(header.slotCount) ||
+            header.elementCount + header.deletedCount > header.slotCount ||
+            header.arenaFree + header.arenaAbandoned > header.arenaUsed) {
+            return nullptr;
+        }
+
+        CipherTable::Image image = {};
+        image.slotCount = header.slotCount;
+        image.tableBytes = CipherTable::imageTableBytes(header.slotCount);
+        image.elementCount = header.elementCount;
+        image.deletedCount = header.deletedCount;
+        image.cipherBytes = header.cipherBytes;
+        image.arenaUsed = header.arenaUsed;
+        image.arenaFree = header.arenaFree;
+        image.arenaAbandoned = header.arenaAbandoned;
+        bool hasFreeLists = header.freeListOffset != 0;
+        if (!sectionFits(header.tableOffset, image.tableBytes, size) ||
+            !sectionFits(header.arenaOffset, image.arenaUsed, size) ||
+            (hasFreeLists && !sectionFits(header.freeListOffset, ByteArena::freeListCount * sizeof(uint64_t), size))) {
+            return nullptr;
+        }
+        image.table = bytes + header.tableOffset;
+        image.arenaBytes = bytes + header.arenaOffset;
+        image.arenaFreeLists = hasFreeLists ? reinterpret_cast<const uint64_t *>(bytes + header.freeListOffset)
+                                            : nullptr;
+        if (!CipherTable::isSoundImage(image) || (verify && payloadChecksum(image) != header.payloadChecksum)) {
+            return nullptr;
+        }
+        return newElements(image, move(file));
+    }
+} // namespace
+
+namespace encstrset_detail {
+    uint64_t checksum(const void *data, size_t length, uint64_t seed) {
+        const char *bytes = static_cast<const char *>(data);
+        const uint64_t multiplier = 0xFF51AFD7ED558CCDull;
+        uint64_t result = seed ^ 0x9E3779B97F4A7C15ull ^ length;
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, bytes + i, sizeof(word));
+            result = (result ^ word) * multiplier;
+            result ^= result >> 32;
+        }
+        for (; i < length; i++) {
+            result = (result ^ static_cast<unsigned char>(bytes[i])) * multiplier;
+        }
+        return result ^ (result >> 29);
+    }
+
+    bool writeSnapshot(const StrSet &elements, const string &path) {
+        string temporaryPath = path + ".tmp";
+        FILE *file = fopen(temporaryPath.c_str(), "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        bool written = writeSnapshotImage(file, elements);
+#ifdef ENCSTRSET_POSIX_FILES
+        written = written && fsync(fileno(file)) == 0;
+#endif
+        written = fclose(file) == 0 && written;
+        if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            remove(temporaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    shared_ptr<const void> mapFile(const string &path, size_t &size) {
+#ifdef ENCSTRSET_POSIX_FILES
+        int descriptor = open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            return nullptr;
+        }
+        shared_ptr<const void> mapping = mapDescriptor(descriptor, size);
+        close(descriptor);
+        return mapping;
+#else
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            return nullptr;
+        }
+        shared_ptr<char> contents;
+        if (fseek(file, 0, SEEK_END) == 0) {
+            long length = ftell(file);
+            if (length > 0 && fseek(file, 0, SEEK_SET) == 0) {
+                size = size_t(length);
+                contents.reset(new char[size], default_delete<char[]>());
+                if (fread(contents.get(), 1, size, file) != size) {
+                    contents.reset();
+                }
+            }
+        }
+        fclose(file);
+        return contents;
+#endif
+    }
+
+    ElementsPointer readSnapshot(const string &path, bool verify) {
+        size_t size = 0;
+        shared_ptr<const void> file = mapFile(path, size);
+        return snapshotElements(move(file), size, verify);
+    }
+
+    bool writeShared(const StrSet &elements, const string &name) {
+#ifdef ENCSTRSET_POSIX_FILES
+        shm_unlink(name.c_str());
+        int descriptor = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (descriptor < 0) {
+            return false;
+        }
+        FILE *file = fdopen(descriptor, "wb");
+        if (file == nullptr) {
+            close(descriptor);
+            shm_unlink(name.c_str());
+            return false;
+        }
+        bool written = writeSnapshotImage(file, elements);
+        written = fclose(file) == 0 && written;
+        if (!written) {
+            shm_unlink(name.c_str());
+        }
+        return written;
+#else
+        (void) elements;
+        (void) name;
+        return false;
+#endif
+    }
+
+    ElementsPointer readShared(const string &name, bool verify) {
+#ifdef ENCSTRSET_POSIX_FILES
+        int descriptor = shm_open(name.c_str(), O_RDONLY, 0);
+        if (descriptor < 0) {
+            return nullptr;
+        }
+        size_t size = 0;
+        shared_ptr<const void> segment = mapDescriptor(descriptor, size);
+        close(descriptor);
+        return snapshotElements(move(segment), size, verify);
+#else
+        (void) name;
+        (void) verify;
+        return nullptr;
+#endif
+    }
+} // namespace encstrset_detail
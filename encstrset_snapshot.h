@@ -0,0 +1,33 @@
+#ifndef ENCSTRSET_ENCSTRSET_SNAPSHOT_H
+#define ENCSTRSET_ENCSTRSET_SNAPSHOT_H
+
+#include "encstrset_common.h"
+#include "encstrset_table.h"
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace encstrset_detail {
+    uint64_t checksum(const void *data, size_t length, uint64_t seed);
+
+    // Written to a temporary file that replaces path only once complete.
+    bool writeSnapshot(const StrSet &elements, const string &path);
+
+    // The whole file, mapped read-only where possible and read into memory
+    // otherwise; pages of a mapping are only read once touched.
+    shared_ptr<const void> mapFile(const string &path, size_t &size);
+
+    ElementsPointer readSnapshot(const string &path, bool verify);
+
+    // Shared memory segments hold a snapshot image, used in place by every
+    // set attached to them. A segment is never changed once written: it is
+    // replaced by unlinking it and writing a new one under the same name,
+    // so sets attached before keep their mapping of the old one. Until the
+    // header of the new one is written, attaching to it fails.
+    bool writeShared(const StrSet &elements, const string &name);
+
+    ElementsPointer readShared(const string &name, bool verify);
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_SNAPSHOT_H
@@ -0,0 +1,56 @@
+#include "encstrset_stats.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace encstrset_detail {
+    StatsRegistry &statsRegistry() {
+        static StatsRegistry registry;
+        return registry;
+    }
+
+    ThreadStats &threadStats() {
+        struct Registration {
+            ThreadStats stats;
+
+            Registration() {
+                StatsRegistry &registry = statsRegistry();
+                lock_guard<mutex> lock(registry.lock);
+                stats.stripe = registry.nextStripe++;
+                registry.live.push_back(&stats);
+            }
+
+            ~Registration() {
+                StatsRegistry &registry = statsRegistry();
+                lock_guard<mutex> lock(registry.lock);
+                stats.addTo(registry.retiredCounts, registry.retiredLatencies);
+                auto position = find(registry.live.begin(), registry.live.end(), &stats);
+                if (position != registry.live.end()) {
+                    registry.live.erase(position);
+                }
+            }
+        };
+        thread_local Registration registration;
+        return registration.stats;
+    }
+
+    size_t latencyBucket(uint64_t nanoseconds) {
+        size_t bucket = 0;
+        for (nanoseconds >>= 1; nanoseconds > 0; nanoseconds >>= 1) {
+            bucket++;
+        }
+        return min<size_t>(bucket, ENCSTRSET_LATENCY_BUCKETS - 1);
+    }
+
+    void ThreadStats::addTo(uint64_t (&countTotals)[statsCounterCount],
+               uint64_t (&latencyTotals)[statsLatencyCount][ENCSTRSET_LATENCY_BUCKETS]) const {
+        for (size_t i = 0; i < statsCounterCount; i++) {
+            countTotals[i] += counts[i].load(memory_order_relaxed);
+        }
+        for (size_t i = 0; i < statsLatencyCount; i++) {
+            for (size_t bucket = 0; bucket < ENCSTRSET_LATENCY_BUCKETS; bucket++) {
+                latencyTotals[i][bucket] += latencies[i][bucket].load(memory_order_relaxed);
+            }
+        }
+    }
+} // namespace encstrset_detail
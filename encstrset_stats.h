@@ -0,0 +1,110 @@
+#ifndef ENCSTRSET_ENCSTRSET_STATS_H
+#define ENCSTRSET_ENCSTRSET_STATS_H
+
+#include "encstrset.h"
+#include "encstrset_common.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <chrono>
+#include <cstddef>
+
+namespace encstrset_detail {
+    // Statistics of all calls are kept per thread: each counter has a
+    // single writer, which updates it with a plain load and store, so
+    // counting needs neither a locked instruction nor a shared cache line.
+    // Readers sum the counters of all threads.
+    enum StatsCounter {
+        InsertedCount,
+        DuplicateCount,
+        TestHitCount,
+        TestMissCount,
+        RemovedCount,
+        RemoveMissCount,
+        FilterRejectCount,
+        FilterFalsePositiveCount,
+        BudgetRejectCount,
+        statsCounterCount
+    };
+
+    enum StatsLatency {
+        InsertLatency,
+        TestLatency,
+        RemoveLatency,
+        statsLatencyCount
+    };
+
+    // Latency is measured for one in this many single-value calls of each
+    // thread.
+    const uint32_t latencySamplePeriod = 16;
+
+    inline void bump(atomic<uint64_t> &counter, uint64_t amount = 1) {
+        counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+
+    struct ThreadStats {
+        atomic<uint64_t> counts[statsCounterCount] = {};
+        atomic<uint64_t> latencies[statsLatencyCount][ENCSTRSET_LATENCY_BUCKETS] = {};
+        uint32_t untilSample = 0;
+        size_t stripe = 0;
+
+        void count(StatsCounter counter, uint64_t amount = 1) {
+            bump(counts[counter], amount);
+        }
+
+        void addTo(uint64_t (&countTotals)[statsCounterCount],
+                   uint64_t (&latencyTotals)[statsLatencyCount][ENCSTRSET_LATENCY_BUCKETS]) const;
+    };
+
+    // Counters of running threads, and the totals of threads that have
+    // exited. Constructed on first use, as calls may come from static
+    // initializers of other translation units.
+    struct StatsRegistry {
+        mutex lock;
+        vector<ThreadStats *> live;
+        uint64_t retiredCounts[statsCounterCount] = {};
+        uint64_t retiredLatencies[statsLatencyCount][ENCSTRSET_LATENCY_BUCKETS] = {};
+        size_t nextStripe = 0;
+    };
+
+    StatsRegistry &statsRegistry();
+
+    ThreadStats &threadStats();
+
+    // Bucket i holds latencies of 2^i to 2^(i+1) - 1 nanoseconds; the last
+    // one everything longer.
+    size_t latencyBucket(uint64_t nanoseconds);
+
+    // Times a call if it is the thread's sampled one, from construction to
+    // destruction.
+    class LatencySample {
+    public:
+        LatencySample(ThreadStats &stats, StatsLatency latency) : stats(stats), latency(latency) {
+            if (stats.untilSample-- == 0) {
+                stats.untilSample = latencySamplePeriod - 1;
+                start = chrono::steady_clock::now();
+                timed = true;
+            }
+        }
+
+        LatencySample(const LatencySample &) = delete;
+
+        LatencySample &operator=(const LatencySample &) = delete;
+
+        ~LatencySample() {
+            if (timed) {
+                auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+                bump(stats.latencies[latency][latencyBucket(static_cast<uint64_t>(elapsed.count()))]);
+            }
+        }
+
+    private:
+        ThreadStats &stats;
+        StatsLatency latency;
+        chrono::steady_clock::time_point start;
+        bool timed = false;
+    };
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_STATS_H
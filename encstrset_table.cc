@@ -0,0 +1,166 @@
+#include "encstrset_table.h"
+
+using namespace std;
+
+namespace encstrset_detail {
+    StrSet &ownedElements(ElementsPointer &elements) {
+        if (!isExclusive(elements)) {
+            elements = newElements(*elements);
+        }
+        return *elements;
+    }
+
+    CipherTable::CipherTable(const CipherTable &other)
+            : arena(other.arena), elementCount(other.elementCount), deletedCount(other.deletedCount),
+              cipherByteCount(other.cipherByteCount), rehashCount(other.rehashCount) {
+        if (other.slotCount > 0) {
+            allocateTable(other.slotCount);
+            memcpy(tableMemory.get(), other.controls, tableBytes());
+        } else if (other.frozen != nullptr) {
+            elementCount = 0;
+            cipherByteCount = 0;
+            reserve(other.size());
+            other.forEach([&](string_view cipher) {
+                insert(cipher);
+            });
+        }
+    }
+
+    CipherTable::CipherTable(const Image &image, shared_ptr<const void> backing)
+            : arena(image.arenaBytes, image.arenaUsed, image.arenaFree, image.arenaAbandoned,
+                    image.arenaFreeLists),
+              controls(reinterpret_cast<Control *>(const_cast<char *>(image.table))),
+              slots(reinterpret_cast<Slot *>(const_cast<char *>(image.table) + image.slotCount * sizeof(Control))),
+              slotCount(image.slotCount), backing(move(backing)), elementCount(image.elementCount),
+              deletedCount(image.deletedCount), cipherByteCount(image.cipherBytes) {
+    }
+
+    bool CipherTable::isSoundImage(const Image &image) {
+        if (image.slotCount > 0 && image.elementCount + image.deletedCount >= image.slotCount) {
+            return false;
+        }
+        auto imageControls = reinterpret_cast<const Control *>(image.table);
+        auto imageSlots = reinterpret_cast<const Slot *>(image.table + image.slotCount * sizeof(Control));
+        size_t fullCount = 0, deletedSlots = 0, cipherBytes = 0;
+        for (size_t index = 0; index < image.slotCount; index++) {
+            Control control = imageControls[index];
+            if (control == deletedControl) {
+                deletedSlots++;
+            } else if (isFull(control)) {
+                Slot slot;
+                memcpy(&slot, &imageSlots[index], sizeof(slot));
+                if (!isInline(slot) && (storeOffset(slot) > image.arenaUsed ||
+                                        slot.length > image.arenaUsed - storeOffset(slot))) {
+                    return false;
+                }
+                fullCount++;
+                cipherBytes += slot.length;
+            } else if (control != emptyControl) {
+                return false;
+            }
+        }
+        if (fullCount != image.elementCount || deletedSlots != image.deletedCount ||
+            cipherBytes != image.cipherBytes) {
+            return false;
+        }
+        if (image.arenaFreeLists == nullptr) {
+            return image.arenaFree == 0;
+        }
+        size_t listedBytes = 0;
+        for (size_t list = 1; list < ByteArena::freeListCount; list++) {
+            size_t block = list * ByteArena::granularity;
+            for (uint64_t head = image.arenaFreeLists[list]; head != 0;) {
+                uint64_t offset = head - 1;
+                listedBytes += block;
+                if (offset > image.arenaUsed || block > image.arenaUsed - offset ||
+                    listedBytes > image.arenaFree) {
+                    return false;
+                }
+                memcpy(&head, image.arenaBytes + offset, sizeof(head));
+            }
+        }
+        return image.arenaFreeLists[0] == 0 && listedBytes == image.arenaFree;
+    }
+
+    bool CipherTable::freezeFrom(const CipherTable &source) {
+        assert(slotCount == 0 && frozen == nullptr);
+        frozen = FrozenCiphers::build(source.size(), [&](auto visitor) {
+            source.forEach(visitor);
+        });
+        if (frozen == nullptr) {
+            return false;
+        }
+        elementCount = source.elementCount;
+        cipherByteCount = source.cipherByteCount;
+        rehashCount = source.rehashCount;
+        return true;
+    }
+
+    void CipherTable::clear() {
+        tableMemory.reset();
+        backing.reset();
+        frozen.reset();
+        controls = nullptr;
+        slots = nullptr;
+        slotCount = 0;
+        arena.reset();
+        elementCount = 0;
+        deletedCount = 0;
+        cipherByteCount = 0;
+    }
+
+    size_t CipherTable::insertGrowth(size_t length) const {
+        size_t growth = 0;
+        if (frozen == nullptr && isFullyLoaded()) {
+            growth += imageTableBytes(rehashedCapacity()) - imageTableBytes(slotCount);
+        }
+        if (length > inlineCapacity) {
+            growth += arena.growthFor(length);
+        }
+        return growth;
+    }
+
+    size_t CipherTable::copyGrowth() const {
+        size_t copyBytes = frozen != nullptr ? imageTableBytes(capacityFor(elementCount)) + cipherByteCount
+                                             : imageTableBytes(slotCount) + arena.used();
+        return copyBytes > heapBytes() ? copyBytes - heapBytes() : 0;
+    }
+
+    void CipherTable::reserveCompacted(const CipherTable &source) {
+        assert(slotCount == 0 && frozen == nullptr && elementCount == 0);
+        if (source.size() > 0) {
+            reserve(source.size());
+            arena.reserveExactly(source.arena.live());
+        }
+        rehashCount = source.rehashCount;
+    }
+
+    void CipherTable::allocateTable(size_t newCapacity) {
+        tableMemory = PooledBytes(newCapacity * (sizeof(Control) + sizeof(Slot)));
+        controls = reinterpret_cast<Control *>(tableMemory.get());
+        slots = reinterpret_cast<Slot *>(tableMemory.get() + newCapacity * sizeof(Control));
+        slotCount = newCapacity;
+    }
+
+    void CipherTable::rehash(size_t newCapacity) {
+        rehashCount++;
+        PooledBytes oldMemory = move(tableMemory);
+        const Control *oldControls = controls;
+        const Slot *oldSlots = slots;
+        size_t oldCount = slotCount;
+
+        allocateTable(newCapacity);
+        fill(controls, controls + newCapacity, emptyControl);
+        deletedCount = 0;
+
+        for (size_t index = 0; index < oldCount; index++) {
+            if (!isFull(oldControls[index])) {
+                continue;
+            }
+            size_t cipherHash = hash(cipherAt(oldSlots[index]));
+            size_t newIndex = findFreeSlot(cipherHash);
+            controls[newIndex] = hashControl(cipherHash);
+            slots[newIndex] = oldSlots[index];
+        }
+    }
+} // namespace encstrset_detail
@@ -0,0 +1,501 @@
+#ifndef ENCSTRSET_ENCSTRSET_TABLE_H
+#define ENCSTRSET_ENCSTRSET_TABLE_H
+
+#include "encstrset_common.h"
+#include "encstrset_memory.h"
+#include "encstrset_arena.h"
+#include "encstrset_hash.h"
+#include "encstrset_frozen.h"
+#include <string_view>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <limits>
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace encstrset_detail {
+    // Open-addressing table of ciphertexts in the style of SwissTable: one
+    // control byte per slot (empty, deleted, or 7 bits of the hash), probed
+    // a group of 16 slots at a time. Ciphertexts of up to inlineCapacity
+    // bytes are kept in the slot itself; longer ones live in the set's byte
+    // arena and the slot keeps their first bytes and offset. Control bytes
+    // and slots share a single allocation. A frozen table keeps its
+    // ciphertexts in FrozenCiphers instead, and is copied, which thaws it,
+    // before it is modified.
+    class CipherTable {
+    public:
+        CipherTable() = default;
+
+        // Copies the table memory and arena as they are, without rehashing.
+        // The copy always owns its memory, even if other is borrowed, and is
+        // never frozen: the ciphertexts of a frozen table are inserted anew.
+        CipherTable(const CipherTable &other);
+
+        CipherTable &operator=(const CipherTable &) = delete;
+
+        // The raw memory of a table: control bytes immediately followed by
+        // the slots, and the arena with its free lists (which may be null).
+        struct Image {
+            const char *table;
+            size_t tableBytes;
+            size_t slotCount;
+            size_t elementCount;
+            size_t deletedCount;
+            size_t cipherBytes;
+            const char *arenaBytes;
+            size_t arenaUsed;
+            size_t arenaFree;
+            size_t arenaAbandoned;
+            const uint64_t *arenaFreeLists;
+        };
+
+        // A read-only table over an image kept alive by backing, such as a
+        // mapped snapshot file. It must be copied before it is modified.
+        CipherTable(const Image &image, shared_ptr<const void> backing);
+
+        // Checks that an image from outside can be used without reading
+        // out of it or probing forever: control bytes are valid and agree
+        // with the counts, some slot is empty, every ciphertext lies within
+        // the arena, and the free lists are finite chains inside it. Cheap
+        // next to a checksum, as of the arena only free blocks are read.
+        static bool isSoundImage(const Image &image);
+
+        Image image() const {
+            assert(frozen == nullptr);
+            return {reinterpret_cast<const char *>(controls), imageTableBytes(slotCount),
+                    slotCount, elementCount, deletedCount, cipherByteCount,
+                    arena.at(0), arena.used(), arena.freeListed(), arena.abandoned(), arena.freeLists()};
+        }
+
+        bool isBorrowed() const {
+            return backing != nullptr;
+        }
+
+        // Makes this empty table a frozen copy of source; false if no
+        // perfect hash was found for its ciphertexts.
+        bool freezeFrom(const CipherTable &source);
+
+        bool isFrozen() const {
+            return frozen != nullptr;
+        }
+
+        // Heap memory of the frozen form; zero unless frozen.
+        size_t frozenBytes() const {
+            return frozen == nullptr ? 0 : frozen->bytes();
+        }
+
+        // Changes whenever the slot layout does; images are only usable by
+        // tables with the same layout and hash function.
+        static uint64_t layoutSignature() {
+            return sizeof(Slot) << 24 | inlineCapacity << 16 | groupWidth << 8 | ByteArena::granularity;
+        }
+
+        static size_t imageTableBytes(size_t capacity) {
+            return capacity * (sizeof(Control) + sizeof(Slot));
+        }
+
+        static bool isValidCapacity(size_t capacity) {
+            return capacity == 0 || (capacity >= groupWidth && (capacity & (capacity - 1)) == 0);
+        }
+
+        // Slots keep lengths in 32 bits.
+        static constexpr size_t maxCipherLength = numeric_limits<uint32_t>::max();
+
+        static size_t hash(string_view cipher) {
+            return static_cast<size_t>(CipherHasher::hash(cipher.data(), cipher.size()));
+        }
+
+        size_t size() const {
+            return elementCount;
+        }
+
+        // Total length of the ciphertexts held.
+        size_t cipherBytes() const {
+            return cipherByteCount;
+        }
+
+        // Times the table has been rebuilt to grow or to drop deleted slots.
+        size_t rehashes() const {
+            return rehashCount;
+        }
+
+        bool contains(string_view cipher, size_t cipherHash) const {
+            if (frozen != nullptr) {
+                return frozen->contains(cipher, cipherHash);
+            }
+            return find(cipher, cipherHash) != notFound;
+        }
+
+        bool contains(string_view cipher) const {
+            return contains(cipher, hash(cipher));
+        }
+
+        bool insert(string_view cipher, size_t cipherHash) {
+            assert(frozen == nullptr);
+            if (cipher.size() > maxCipherLength || find(cipher, cipherHash) != notFound) {
+                return false;
+            }
+            if (isFullyLoaded()) {
+                rehash(rehashedCapacity());
+            }
+            size_t index = findFreeSlot(cipherHash);
+            if (controls[index] == deletedControl) {
+                deletedCount--;
+            }
+            controls[index] = hashControl(cipherHash);
+            storeCipher(slots[index], cipher);
+            elementCount++;
+            cipherByteCount += cipher.size();
+            return true;
+        }
+
+        bool insert(string_view cipher) {
+            return insert(cipher, hash(cipher));
+        }
+
+        bool erase(string_view cipher, size_t cipherHash) {
+            assert(frozen == nullptr);
+            size_t index = find(cipher, cipherHash);
+            if (index == notFound) {
+                return false;
+            }
+            // A probe only moves past a group with no empty slot, so if this
+            // group still has one the slot can become empty, not deleted.
+            if (matchGroup(&controls[index / groupWidth * groupWidth], emptyControl) != 0) {
+                controls[index] = emptyControl;
+            } else {
+                controls[index] = deletedControl;
+                deletedCount++;
+            }
+            if (!isInline(slots[index])) {
+                arena.release(storeOffset(slots[index]), slots[index].length);
+            }
+            elementCount--;
+            cipherByteCount -= slots[index].length;
+            return true;
+        }
+
+        bool erase(string_view cipher) {
+            return erase(cipher, hash(cipher));
+        }
+
+        // Releases all memory of the table at once, without visiting the
+        // elements.
+        void clear();
+
+        // Heap memory of the table; zero for a borrowed one.
+        size_t tableBytes() const {
+            return isBorrowed() ? 0 : imageTableBytes(slotCount);
+        }
+
+        // Heap memory of the table, arena and frozen form, not counting the
+        // table object itself.
+        size_t heapBytes() const {
+            return tableBytes() + arena.heapBytes() + frozenBytes();
+        }
+
+        // How much heapBytes() would grow by if a ciphertext of length bytes,
+        // not held yet, were inserted. A borrowed or frozen table is copied
+        // first, which costs about copyGrowth() more.
+        size_t insertGrowth(size_t length) const;
+
+        // About how much more heap memory a copy takes than this table; a
+        // frozen one is taken to need arena room for all its ciphertexts.
+        size_t copyGrowth() const;
+
+        // Heap memory of a compacted copy of an unfrozen table (see
+        // reserveCompacted).
+        size_t compactBytes() const {
+            return elementCount == 0 ? 0 : imageTableBytes(capacityFor(elementCount)) + arena.live();
+        }
+
+        // Readies this empty table to take the elements of source with as
+        // few slots as they allow, and an arena holding just their long
+        // ciphertexts; they are then inserted a range at a time.
+        void reserveCompacted(const CipherTable &source);
+
+        // Memory borrowed from a snapshot mapping.
+        size_t borrowedBytes() const {
+            return isBorrowed() ? imageTableBytes(slotCount) + arena.used() : 0;
+        }
+
+        const ByteArena &byteArena() const {
+            return arena;
+        }
+
+        void reserve(size_t count) {
+            size_t needed = capacityFor(count);
+            if (needed > capacity()) {
+                rehash(needed);
+            }
+        }
+
+        void prefetch(size_t cipherHash) const {
+#ifdef __GNUC__
+            if (frozen != nullptr) {
+                frozen->prefetch(cipherHash);
+            } else if (slotCount > 0) {
+                size_t first = (groupIndex(cipherHash) & (groupCount() - 1)) * groupWidth;
+                __builtin_prefetch(&controls[first]);
+                __builtin_prefetch(&slots[first]);
+            }
+#else
+            (void) cipherHash;
+#endif
+        }
+
+        template<typename Visitor>
+        void forEach(Visitor visitor) const {
+            forEachInRange(0, slotCapacity(), visitor);
+        }
+
+        // Visits the elements held in slots [begin, end), so that disjoint
+        // ranges can be walked by different threads. Each position of a
+        // frozen table counts as a slot.
+        template<typename Visitor>
+        void forEachInRange(size_t begin, size_t end, Visitor visitor) const {
+            if (frozen != nullptr) {
+                for (size_t position = begin; position < end; position++) {
+                    visitor(frozen->cipherAt(position));
+                }
+                return;
+            }
+            for (size_t index = begin; index < end; index++) {
+                if (isFull(controls[index])) {
+                    visitor(cipherAt(slots[index]));
+                }
+            }
+        }
+
+        size_t slotCapacity() const {
+            return frozen != nullptr ? frozen->size() : slotCount;
+        }
+
+        // Finds the first element in a slot at or after index, and moves
+        // index past it; false once there is none.
+        bool nextElement(size_t &index, string_view &cipher) const {
+            if (frozen != nullptr) {
+                if (index >= frozen->size()) {
+                    return false;
+                }
+                cipher = frozen->cipherAt(index++);
+                return true;
+            }
+            for (; index < slotCount; index++) {
+                if (isFull(controls[index])) {
+                    cipher = cipherAt(slots[index++]);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        using Control = int8_t;
+
+        static constexpr Control emptyControl = -128;
+        static constexpr Control deletedControl = -2;
+        static constexpr size_t groupWidth = 16;
+        static constexpr size_t inlineCapacity = 12;
+        static constexpr size_t prefixLength = 4;
+        static constexpr size_t notFound = numeric_limits<size_t>::max();
+
+        // Short ciphertexts fill bytes; long ones keep a prefix there,
+        // followed by their offset in the arena.
+        struct Slot {
+            uint32_t length;
+            char bytes[inlineCapacity];
+        };
+
+        ByteArena arena;
+        PooledBytes tableMemory;
+        Control *controls = nullptr;
+        Slot *slots = nullptr;
+        size_t slotCount = 0;
+        shared_ptr<const void> backing;
+        unique_ptr<const FrozenCiphers> frozen;
+        size_t elementCount = 0;
+        size_t deletedCount = 0;
+        size_t cipherByteCount = 0;
+        size_t rehashCount = 0;
+
+        static bool isFull(Control control) {
+            return control >= 0;
+        }
+
+        static Control hashControl(size_t cipherHash) {
+            return static_cast<Control>(cipherHash & 0x7F);
+        }
+
+        static size_t groupIndex(size_t cipherHash) {
+            return cipherHash >> 7;
+        }
+
+        // Bit i of the result is set iff group[i] == control.
+        static uint32_t matchGroup(const Control *group, Control control) {
+#ifdef __SSE2__
+            __m128i groupControls = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(groupControls, _mm_set1_epi8(control))));
+#else
+            uint32_t mask = 0;
+            for (size_t i = 0; i < groupWidth; i++) {
+                mask |= static_cast<uint32_t>(group[i] == control) << i;
+            }
+            return mask;
+#endif
+        }
+
+        // Bit i of the result is set iff group[i] is empty or deleted.
+        static uint32_t matchFree(const Control *group) {
+#ifdef __SSE2__
+            __m128i groupControls = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), groupControls)));
+#else
+            uint32_t mask = 0;
+            for (size_t i = 0; i < groupWidth; i++) {
+                mask |= static_cast<uint32_t>(group[i] < -1) << i;
+            }
+            return mask;
+#endif
+        }
+
+        static size_t capacityFor(size_t count) {
+            size_t result = groupWidth;
+            while (count * 8 > result * 7) {
+                result *= 2;
+            }
+            return result;
+        }
+
+        size_t capacity() const {
+            return slotCount;
+        }
+
+        // Whether one more element needs a rehash first.
+        bool isFullyLoaded() const {
+            return (elementCount + deletedCount + 1) * 8 > capacity() * 7;
+        }
+
+        // Mostly deleted slots are dropped in place; otherwise the table
+        // doubles.
+        size_t rehashedCapacity() const {
+            return elementCount * 16 < capacity() * 7 ? capacity() : max(groupWidth, capacity() * 2);
+        }
+
+        size_t groupCount() const {
+            return capacity() / groupWidth;
+        }
+
+        static bool isInline(const Slot &slot) {
+            return slot.length <= inlineCapacity;
+        }
+
+        static uint64_t storeOffset(const Slot &slot) {
+            uint64_t offset;
+            memcpy(&offset, slot.bytes + prefixLength, sizeof(offset));
+            return offset;
+        }
+
+        string_view cipherAt(const Slot &slot) const {
+            if (isInline(slot)) {
+                return string_view(slot.bytes, slot.length);
+            }
+            return string_view(arena.at(storeOffset(slot)), slot.length);
+        }
+
+        bool slotHolds(const Slot &slot, string_view cipher) const {
+            if (slot.length != cipher.size()) {
+                return false;
+            }
+            if (isInline(slot)) {
+                return memcmp(slot.bytes, cipher.data(), cipher.size()) == 0;
+            }
+            return memcmp(slot.bytes, cipher.data(), prefixLength) == 0 &&
+                   memcmp(arena.at(storeOffset(slot)), cipher.data(), cipher.size()) == 0;
+        }
+
+        void storeCipher(Slot &slot, string_view cipher) {
+            assert(cipher.size() <= numeric_limits<uint32_t>::max());
+            slot.length = static_cast<uint32_t>(cipher.size());
+            if (isInline(slot)) {
+                memcpy(slot.bytes, cipher.data(), cipher.size());
+                return;
+            }
+            uint64_t offset = arena.allocate(cipher.size());
+            memcpy(arena.at(offset), cipher.data(), cipher.size());
+            memcpy(slot.bytes, cipher.data(), prefixLength);
+            memcpy(slot.bytes + prefixLength, &offset, sizeof(offset));
+        }
+
+        size_t find(string_view cipher, size_t cipherHash) const {
+            if (elementCount == 0) {
+                return notFound;
+            }
+            Control control = hashControl(cipherHash);
+            size_t groupMask = groupCount() - 1;
+            size_t group = groupIndex(cipherHash) & groupMask;
+            for (size_t step = 1;; step++) {
+                const Control *groupControls = &controls[group * groupWidth];
+                for (uint32_t mask = matchGroup(groupControls, control); mask != 0; mask &= mask - 1) {
+                    size_t index = group * groupWidth + lowestBit(mask);
+                    if (slotHolds(slots[index], cipher)) {
+                        return index;
+                    }
+                }
+                if (matchGroup(groupControls, emptyControl) != 0) {
+                    return notFound;
+                }
+                group = (group + step) & groupMask;
+            }
+        }
+
+        // Triangular probing over a power-of-two number of groups visits
+        // every group, and the load limit guarantees a free slot exists.
+        size_t findFreeSlot(size_t cipherHash) const {
+            size_t groupMask = groupCount() - 1;
+            size_t group = groupIndex(cipherHash) & groupMask;
+            for (size_t step = 1;; step++) {
+                uint32_t mask = matchFree(&controls[group * groupWidth]);
+                if (mask != 0) {
+                    return group * groupWidth + lowestBit(mask);
+                }
+                group = (group + step) & groupMask;
+            }
+        }
+
+        void allocateTable(size_t newCapacity);
+
+        // Rebuilds the table with newCapacity slots, dropping deleted ones.
+        // Arena offsets stay valid, so long ciphertexts are not moved.
+        void rehash(size_t newCapacity);
+    };
+
+    using StrSet = CipherTable;
+
+    using ElementsPointer = shared_ptr<StrSet>;
+
+    template<typename... Arguments>
+    ElementsPointer newElements(Arguments &&...arguments) {
+        return allocate_shared<StrSet>(PooledAllocator<StrSet>(), forward<Arguments>(arguments)...);
+    }
+
+    // Whether elements can be modified in place: they are not shared, not
+    // borrowed from a snapshot and not frozen.
+    inline bool isExclusive(const ElementsPointer &elements) {
+        return elements.use_count() == 1 && !elements->isBorrowed() && !elements->isFrozen();
+    }
+
+    // Other elements are copied before they are modified, table and arena
+    // whole: copying them is a few large memcpy calls, where sharing pages
+    // would cost an indirection on every probe.
+    StrSet &ownedElements(ElementsPointer &elements);
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_TABLE_H
@@ -0,0 +1,397 @@
+#include "encstrset.h"
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace ::jnp1;
+
+// Every allocation made through operator new is counted, so that a test can
+// check that the calls it makes allocate nothing.
+namespace {
+    std::atomic<size_t> allocations{0};
+
+    void *countedAllocation(size_t size, size_t alignment) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        if (size == 0) {
+            size = 1;
+        }
+        void *pointer = nullptr;
+        if (alignment <= alignof(std::max_align_t)) {
+            pointer = std::malloc(size);
+        } else if (posix_memalign(&pointer, alignment, size) != 0) {
+            pointer = nullptr;
+        }
+        return pointer;
+    }
+}
+
+void *operator new(size_t size) {
+    void *pointer = countedAllocation(size, alignof(std::max_align_t));
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    void *pointer = countedAllocation(size, size_t(alignment));
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    return countedAllocation(size, alignof(std::max_align_t));
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return countedAllocation(size, alignof(std::max_align_t));
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+namespace {
+    const size_t valueLengths[] = {3, 40, 1000, 70000};
+
+    std::vector<std::string> makeValues(char first) {
+        std::vector<std::string> values;
+        for (size_t length : valueLengths) {
+            std::string value(length, first);
+            for (size_t i = 0; i < length; i++) {
+                value[i] = char(first + i % 23);
+            }
+            values.push_back(value);
+        }
+        return values;
+    }
+
+    // Runs the calls once to warm up thread-local state (statistics, the
+    // scratch buffer) and then checks that running them again allocates
+    // nothing.
+    template<typename Calls>
+    void assertNoAllocations(Calls calls) {
+        calls();
+        size_t before = allocations.load();
+        calls();
+        assert(allocations.load() == before);
+    }
+
+    // Tests of present and absent values, removals of absent values and
+    // repeated inserts only probe the table.
+    void probes(bool filtered) {
+        unsigned long id = encstrset_new();
+        encstrset_set_filter(id, filtered);
+        std::vector<std::string> present = makeValues('a');
+        std::vector<std::string> absent = makeValues('A');
+        for (const std::string &value : present) {
+            assert(encstrset_insert(id, value.c_str(), "key"));
+        }
+
+        assertNoAllocations([&] {
+            for (const std::string &value : present) {
+                assert(encstrset_test(id, value.c_str(), "key"));
+                assert(!encstrset_insert(id, value.c_str(), "key"));
+                assert(encstrset_test_n(id, value.data(), value.size(), "key", 3));
+            }
+            for (const std::string &value : absent) {
+                assert(!encstrset_test(id, value.c_str(), "key"));
+                assert(!encstrset_remove(id, value.c_str(), "key"));
+                assert(!encstrset_remove_n(id, value.data(), value.size(), "key", 3));
+            }
+        });
+        encstrset_delete(id);
+    }
+
+    // Prepared keys and handles take the same path.
+    void preparedKeysAndHandles() {
+        unsigned long id = encstrset_new();
+        encstrset_key *key = encstrset_key_prepare("key");
+        encstrset_handle *handle = encstrset_open(id);
+        std::vector<std::string> present = makeValues('a');
+        for (const std::string &value : present) {
+            assert(encstrset_insert_k(id, value.c_str(), key));
+        }
+
+        assertNoAllocations([&] {
+            for (const std::string &value : present) {
+                assert(encstrset_test_k(id, value.c_str(), key));
+                assert(!encstrset_insert_hk(handle, value.c_str(), key));
+                assert(encstrset_test_h(handle, value.c_str(), "key"));
+                assert(!encstrset_remove_h(handle, value.c_str(), "other"));
+            }
+        });
+        encstrset_close(handle);
+        encstrset_key_release(key);
+        encstrset_delete(id);
+    }
+
+    // A repeated insert into a set sharing its elements with a copy must
+    // not copy them.
+    void sharedDuplicates() {
+        unsigned long source = encstrset_new();
+        unsigned long copy = encstrset_new();
+        std::vector<std::string> present = makeValues('a');
+        for (const std::string &value : present) {
+            assert(encstrset_insert(source, value.c_str(), "key"));
+        }
+        encstrset_copy(source, copy);
+
+        assertNoAllocations([&] {
+            for (const std::string &value : present) {
+                assert(!encstrset_insert(copy, value.c_str(), "key"));
+                assert(!encstrset_insert(source, value.c_str(), "key"));
+            }
+        });
+        encstrset_delete(copy);
+        encstrset_delete(source);
+    }
+
+    // Neither does a batch of such inserts, or of removes of absent values.
+    void sharedBatches() {
+        unsigned long source = encstrset_new();
+        unsigned long copy = encstrset_new();
+        std::vector<std::string> present = makeValues('a');
+        std::vector<std::string> absent = makeValues('A');
+        std::vector<const char *> presentValues, absentValues;
+        for (size_t i = 0; i < present.size(); i++) {
+            assert(encstrset_insert(source, present[i].c_str(), "key"));
+            presentValues.push_back(present[i].c_str());
+            absentValues.push_back(absent[i].c_str());
+        }
+        encstrset_copy(source, copy);
+
+        size_t before = encstrset_total_memory_usage();
+        assert(encstrset_insert_batch(copy, presentValues.data(), presentValues.size(), "key", nullptr) == 0);
+        assert(encstrset_remove_batch(copy, absentValues.data(), absentValues.size(), "key", nullptr) == 0);
+        assert(encstrset_total_memory_usage() == before);
+        encstrset_delete(copy);
+        encstrset_delete(source);
+    }
+
+    // Removing a present value frees its bytes back to the set's arena,
+    // whose free lists are allocated when it first gets some back.
+    void removals() {
+        unsigned long id = encstrset_new();
+        std::vector<std::string> present = makeValues('a');
+        std::string stored = present[1];
+        assert(encstrset_insert(id, stored.c_str(), "key"));
+        assert(encstrset_remove(id, stored.c_str(), "key"));
+        for (const std::string &value : present) {
+            assert(encstrset_insert(id, value.c_str(), "key"));
+        }
+
+        size_t before = allocations.load();
+        for (const std::string &value : present) {
+            assert(encstrset_remove(id, value.c_str(), "key"));
+        }
+        assert(allocations.load() == before);
+        assert(encstrset_size(id) == 0);
+        encstrset_delete(id);
+    }
+
+    // What sets take from the allocator is told exactly, per set and in
+    // total, with elements shared by a copy counted once in the total.
+    void accounting() {
+        size_t before = encstrset_total_memory_usage();
+        unsigned long id = encstrset_new();
+        encstrset_set_filter(id, true);
+        for (int i = 0; i < 1000; i++) {
+            std::string value = "value-" + std::to_string(i) + std::string(size_t(i % 40), 'x');
+            assert(encstrset_insert(id, value.c_str(), "key"));
+        }
+        assert(encstrset_test(id, "value-0", "key"));
+        size_t usage = encstrset_memory_usage(id);
+        assert(usage > 0);
+        assert(encstrset_total_memory_usage() - before == usage);
+
+        unsigned long copy = encstrset_new();
+        encstrset_copy(id, copy);
+        assert(encstrset_memory_usage(copy) > 0);
+        assert(encstrset_total_memory_usage() - before < usage + encstrset_memory_usage(copy));
+        encstrset_delete(copy);
+        assert(encstrset_total_memory_usage() - before == usage);
+
+        encstrset_delete(id);
+        assert(encstrset_total_memory_usage() == before);
+        assert(encstrset_memory_usage(id) == 0);
+    }
+
+    // Inserts that need more memory than a budget allows fail, and leave
+    // the set within it; duplicates and inserts into free room do not.
+    void budgets() {
+        unsigned long id = encstrset_new();
+        size_t budget = encstrset_memory_usage(id) + 8192;
+        assert(encstrset_set_budget(id, budget));
+        std::string value;
+        size_t inserted = 0;
+        for (int i = 0; i < 10000; i++) {
+            value = "value-" + std::to_string(i) + std::string(100, 'x');
+            if (!encstrset_insert(id, value.c_str(), "key")) {
+                break;
+            }
+            inserted++;
+        }
+        assert(inserted > 0 && inserted < 10000);
+        assert(encstrset_memory_usage(id) <= budget);
+        assert(encstrset_size(id) == inserted);
+        assert(!encstrset_insert(id, value.c_str(), "key"));
+        assert(encstrset_size(id) == inserted);
+
+        const char *batch[] = {"a-long-value-in-a-batch-which-needs-the-arena", "short"};
+        encstrset_insert_batch(id, batch, 2, "key", nullptr);
+        assert(encstrset_memory_usage(id) <= budget);
+
+        encstrset_stats stats;
+        assert(encstrset_get_stats(id, &stats));
+        assert(stats.budget_rejects >= 2);
+
+        assert(encstrset_set_budget(id, 0));
+        assert(encstrset_insert(id, value.c_str(), "key"));
+
+        size_t total = encstrset_total_memory_usage();
+        encstrset_set_global_budget(total);
+        for (int i = 0; i < 10000; i++) {
+            value = "global-" + std::to_string(i) + std::string(100, 'x');
+            encstrset_insert(id, value.c_str(), "key");
+        }
+        assert(encstrset_total_memory_usage() == total);
+        encstrset_set_global_budget(0);
+        assert(encstrset_insert(id, ("after-" + value).c_str(), "key"));
+        encstrset_delete(id);
+    }
+
+    // Copies and set operations into a budgeted set that would take it past
+    // its budget leave it as it was; those that fit, or shrink it, do not.
+    void replacementBudgets() {
+        unsigned long large = encstrset_new(), small = encstrset_new(), dst = encstrset_new();
+        for (int i = 0; i < 2000; i++) {
+            std::string value = "value-" + std::to_string(i) + std::string(100, 'x');
+            assert(encstrset_insert(large, value.c_str(), "key"));
+            if (i < 10) {
+                assert(encstrset_insert(small, value.c_str(), "key"));
+            }
+        }
+        assert(encstrset_insert(dst, "kept", "key"));
+        size_t budget = encstrset_memory_usage(dst) + 8192;
+        assert(encstrset_set_budget(dst, budget));
+
+        encstrset_copy(large, dst);
+        encstrset_union(large, dst, dst);
+        encstrset_symdiff(dst, large, dst);
+        assert(encstrset_size(dst) == 1 && encstrset_test(dst, "kept", "key"));
+        assert(encstrset_memory_usage(dst) <= budget);
+        encstrset_stats stats;
+        assert(encstrset_get_stats(dst, &stats));
+        assert(stats.budget_rejects == 3);
+
+        encstrset_copy(small, dst);
+        assert(encstrset_size(dst) == 11);
+        encstrset_intersect(dst, large, dst);
+        assert(encstrset_size(dst) == 10);
+        encstrset_clear(dst);
+        encstrset_copy(large, dst);
+        assert(encstrset_size(dst) == 0);
+
+        // A global budget stops copies whose result is new memory.
+        assert(encstrset_set_budget(dst, 0));
+        assert(encstrset_insert(dst, "kept", "key"));
+        encstrset_set_global_budget(encstrset_total_memory_usage());
+        encstrset_copy(large, dst);
+        assert(encstrset_size(dst) == 1);
+        encstrset_set_global_budget(0);
+        encstrset_copy(large, dst);
+        assert(encstrset_size(dst) == 2001);
+
+        encstrset_delete(large);
+        encstrset_delete(small);
+        encstrset_delete(dst);
+    }
+
+    // Compaction gives back what removes left behind and keeps the values.
+    void compaction() {
+        unsigned long id = encstrset_new();
+        for (int i = 0; i < 20000; i++) {
+            std::string value = "value-" + std::to_string(i) + std::string(50, 'x');
+            assert(encstrset_insert(id, value.c_str(), "key"));
+        }
+        for (int i = 0; i < 20000; i++) {
+            if (i % 10 != 0) {
+                std::string value = "value-" + std::to_string(i) + std::string(50, 'x');
+                assert(encstrset_remove(id, value.c_str(), "key"));
+            }
+        }
+        size_t before = encstrset_memory_usage(id);
+        assert(encstrset_compact(id));
+        assert(encstrset_size(id) == 2000);
+        for (int i = 0; i < 20000; i++) {
+            std::string value = "value-" + std::to_string(i) + std::string(50, 'x');
+            assert(encstrset_test(id, value.c_str(), "key") == (i % 10 == 0));
+        }
+        size_t after = encstrset_memory_usage(id);
+        assert(after * 4 < before);
+        assert(encstrset_compact(id));
+        assert(encstrset_memory_usage(id) == after);
+        encstrset_delete(id);
+        assert(!encstrset_compact(id));
+    }
+}
+
+int main() {
+    probes(false);
+    probes(true);
+    preparedKeysAndHandles();
+    sharedDuplicates();
+    sharedBatches();
+    removals();
+    accounting();
+    budgets();
+    replacementBudgets();
+    compaction();
+}
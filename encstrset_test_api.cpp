@@ -0,0 +1,541 @@
+#include "encstrset.h"
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace ::jnp1;
+
+namespace {
+    const int valueCount = 1000;
+
+    std::string valueName(int group, int i) {
+        return "value-" + std::to_string(group) + "-" + std::to_string(i);
+    }
+
+    bool resultBit(const std::vector<unsigned char> &results, size_t i) {
+        return (results[i / 8] >> (i % 8) & 1) != 0;
+    }
+
+    std::vector<std::string> contents(unsigned long id) {
+        std::vector<std::string> ciphers;
+        encstrset_iter *cursor = encstrset_iter_begin(id);
+        const char *cipher;
+        size_t length;
+        while (cursor != nullptr && encstrset_iter_next(cursor, &cipher, &length)) {
+            ciphers.emplace_back(cipher, length);
+        }
+        encstrset_iter_end(cursor);
+        std::sort(ciphers.begin(), ciphers.end());
+        return ciphers;
+    }
+
+    // Batches, by set number and through a handle, return what the single
+    // calls would, one result bit per value; NULL values only clear theirs.
+    void batches() {
+        unsigned long id = encstrset_new();
+        encstrset_handle *handle = encstrset_open(id);
+        std::vector<std::string> values;
+        for (int i = 0; i < valueCount; i++) {
+            values.push_back(valueName(0, i));
+        }
+        std::vector<const char *> even, all;
+        for (int i = 0; i < valueCount; i++) {
+            all.push_back(values[i].c_str());
+            if (i % 2 == 0) {
+                even.push_back(values[i].c_str());
+            }
+        }
+        all[1] = nullptr;
+        std::vector<unsigned char> results((valueCount + 7) / 8, 0xFF);
+
+        assert(encstrset_insert_batch(id, even.data(), even.size(), "key", results.data()) == even.size());
+        assert(encstrset_test_batch(id, all.data(), all.size(), "key", results.data()) == even.size());
+        for (int i = 0; i < valueCount; i++) {
+            assert(resultBit(results, i) == (i % 2 == 0));
+        }
+        assert(encstrset_test_batch(id, all.data(), all.size(), "other", results.data()) == 0);
+        assert(encstrset_test_batch(id, all.data(), all.size(), "key", nullptr) == even.size());
+
+        assert(encstrset_insert_batch_h(handle, all.data(), all.size(), "key", results.data()) ==
+               size_t(valueCount / 2 - 1));
+        for (int i = 0; i < valueCount; i++) {
+            assert(resultBit(results, i) == (i % 2 == 1 && i != 1));
+        }
+        assert(encstrset_test_batch_h(handle, all.data(), all.size(), "key", results.data()) ==
+               size_t(valueCount - 1));
+        assert(encstrset_remove_batch_h(handle, even.data(), even.size(), "key", results.data()) == even.size());
+        assert(encstrset_remove_batch_h(handle, even.data(), even.size(), "key", results.data()) == 0);
+        assert(encstrset_test_batch_h(handle, all.data(), all.size(), "key", results.data()) ==
+               size_t(valueCount / 2 - 1));
+        for (int i = 0; i < valueCount; i++) {
+            assert(resultBit(results, i) == encstrset_test(id, values[i].c_str(), "key"));
+        }
+        assert(encstrset_size_h(handle) == size_t(valueCount / 2 - 1));
+
+        encstrset_delete(id);
+        assert(encstrset_test_batch(id, all.data(), all.size(), "key", results.data()) == 0);
+        assert(encstrset_test_batch_h(handle, all.data(), all.size(), "key", results.data()) == 0);
+        assert(encstrset_insert_batch_h(handle, all.data(), all.size(), "key", results.data()) == 0);
+        for (unsigned char byte : results) {
+            assert(byte == 0);
+        }
+        encstrset_close(handle);
+    }
+
+    // Removes with a prepared key match the plain calls with its text, and
+    // a NULL prepared key acts as a NULL key.
+    void preparedKeyRemoves() {
+        unsigned long id = encstrset_new();
+        encstrset_handle *handle = encstrset_open(id);
+        encstrset_key *key = encstrset_key_prepare("a somewhat longer key");
+        for (int i = 0; i < valueCount; i++) {
+            assert(encstrset_insert(id, valueName(0, i).c_str(), "a somewhat longer key"));
+        }
+        for (int i = 0; i < valueCount; i++) {
+            if (i % 2 == 0) {
+                assert(encstrset_remove_k(id, valueName(0, i).c_str(), key));
+                assert(!encstrset_remove_k(id, valueName(0, i).c_str(), key));
+            } else {
+                assert(!encstrset_remove_hk(handle, valueName(1, i).c_str(), key));
+                assert(encstrset_remove_hk(handle, valueName(0, i).c_str(), key));
+            }
+            assert(!encstrset_test(id, valueName(0, i).c_str(), "a somewhat longer key"));
+        }
+        assert(encstrset_size(id) == 0);
+
+        assert(encstrset_insert(id, "plain", nullptr));
+        assert(!encstrset_remove_k(id, "plain", key));
+        assert(encstrset_remove_hk(handle, "plain", nullptr));
+        assert(encstrset_insert(id, "plain", nullptr));
+        assert(encstrset_remove_k(id, "plain", nullptr));
+
+        assert(encstrset_insert(id, "deleted", "a somewhat longer key"));
+        encstrset_delete(id);
+        assert(!encstrset_remove_k(id, "deleted", key));
+        assert(!encstrset_remove_hk(handle, "deleted", key));
+        encstrset_close(handle);
+        encstrset_key_release(key);
+    }
+
+    // Slots keep lengths in 32 bits, so longer values are turned away
+    // rather than cut short. The value is a sparse mapping, never written.
+    void overlongValues() {
+        size_t length = size_t(1) << 32;
+        void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping == MAP_FAILED) {
+            return;
+        }
+        const char *value = static_cast<const char *>(mapping);
+        unsigned long id = encstrset_new();
+        assert(!encstrset_insert_n(id, value, length, nullptr, 0));
+        assert(encstrset_size(id) == 0);
+        munmap(mapping, length);
+        encstrset_delete(id);
+    }
+
+    // Set operations and their counts against a model of the values: every
+    // operation into a third set and into either operand, on operands that
+    // share their elements, own them or are frozen, and on shared operands
+    // large enough to be split between threads. a holds the even values of
+    // the universe and b every third one.
+    void setAlgebra() {
+        using Operation = void (*)(unsigned long, unsigned long, unsigned long);
+        using Count = size_t (*)(unsigned long, unsigned long);
+        const Operation operations[] = {encstrset_union, encstrset_intersect, encstrset_difference,
+                                        encstrset_symdiff};
+        const Count counts[] = {encstrset_union_count, encstrset_intersect_count, encstrset_difference_count,
+                                encstrset_symdiff_count};
+        const std::function<bool(bool, bool)> models[] = {
+                [](bool a, bool b) { return a || b; },
+                [](bool a, bool b) { return a && b; },
+                [](bool a, bool b) { return a && !b; },
+                [](bool a, bool b) { return a != b; }};
+
+        for (int universe : {3000, 6 * 65536}) {
+            unsigned long aSource = encstrset_new(), bSource = encstrset_new();
+            for (int i = 0; i < universe; i++) {
+                if (i % 2 == 0) {
+                    assert(encstrset_insert(aSource, valueName(0, i).c_str(), nullptr));
+                }
+                if (i % 3 == 0) {
+                    assert(encstrset_insert(bSource, valueName(0, i).c_str(), nullptr));
+                }
+            }
+            for (const char *form : {"shared", "owned", "frozen"}) {
+                if (universe > 3000 && std::string(form) != "shared") {
+                    continue;
+                }
+                for (int operation = 0; operation < 4; operation++) {
+                    for (int target = 0; target < 3; target++) {
+                        unsigned long a = encstrset_new(), b = encstrset_new(), other = encstrset_new();
+                        encstrset_copy(aSource, a);
+                        encstrset_copy(bSource, b);
+                        if (std::string(form) == "owned") {
+                            for (unsigned long id : {a, b}) {
+                                assert(encstrset_insert(id, "owned", nullptr));
+                                assert(encstrset_remove(id, "owned", nullptr));
+                            }
+                        } else if (std::string(form) == "frozen") {
+                            assert(encstrset_freeze(a) && encstrset_freeze(b));
+                        }
+                        assert(encstrset_insert(other, "replaced", nullptr));
+                        unsigned long dst = target == 0 ? other : target == 1 ? a : b;
+
+                        size_t expected = 0;
+                        for (int i = 0; i < universe; i++) {
+                            expected += models[operation](i % 2 == 0, i % 3 == 0);
+                        }
+                        assert(counts[operation](a, b) == expected);
+                        size_t aSize = encstrset_size(a), bSize = encstrset_size(b);
+                        operations[operation](a, b, dst);
+                        assert(encstrset_size(dst) == expected);
+                        assert(dst == a || encstrset_size(a) == aSize);
+                        assert(dst == b || encstrset_size(b) == bSize);
+                        // With a NULL key ciphertexts are the values.
+                        std::vector<bool> seen(universe, false);
+                        encstrset_iter *cursor = encstrset_iter_begin(dst);
+                        const char *cipher;
+                        size_t length;
+                        while (encstrset_iter_next(cursor, &cipher, &length)) {
+                            std::string value(cipher, length);
+                            assert(value.compare(0, 8, "value-0-") == 0);
+                            int i = std::stoi(value.substr(8));
+                            assert(models[operation](i % 2 == 0, i % 3 == 0) && !seen[i]);
+                            seen[i] = true;
+                        }
+                        encstrset_iter_end(cursor);
+                        for (int i = 0; i < universe; i += 97) {
+                            std::string value = valueName(0, i);
+                            assert(encstrset_test(dst, value.c_str(), nullptr) == seen[i]);
+                        }
+                        encstrset_delete(a);
+                        encstrset_delete(b);
+                        encstrset_delete(other);
+                    }
+                }
+            }
+            // The sources were only ever shared, never changed.
+            assert(encstrset_size(aSource) == size_t(universe + 1) / 2);
+            assert(encstrset_size(bSource) == size_t(universe + 2) / 3);
+            encstrset_delete(aSource);
+            encstrset_delete(bSource);
+        }
+
+        // A missing operand or destination leaves everything as it was.
+        unsigned long a = encstrset_new(), missing = encstrset_new();
+        encstrset_delete(missing);
+        assert(encstrset_insert(a, "kept", nullptr));
+        encstrset_union(a, missing, a);
+        encstrset_intersect(missing, a, a);
+        encstrset_difference(a, a, missing);
+        assert(encstrset_size(a) == 1);
+        assert(encstrset_union_count(a, missing) == 0);
+        assert(encstrset_symdiff_count(missing, a) == 0);
+        encstrset_difference(a, a, a);
+        assert(encstrset_size(a) == 0);
+        encstrset_delete(a);
+    }
+
+    // Replaying a journal brings back every set with its number and
+    // elements, with either durability and with or without a checkpoint
+    // part way through. Sets changed after the checkpoint start from the
+    // snapshots it saved.
+    void journalReplay() {
+        const char *path = "encstrset_test_api.journal";
+        for (encstrset_durability durability : {ENCSTRSET_SYNC_EACH, ENCSTRSET_GROUP_COMMIT}) {
+            for (bool checkpoint : {false, true}) {
+                std::remove(path);
+                assert(encstrset_journal_open(path, durability));
+                unsigned long ids[6];
+                for (unsigned long &id : ids) {
+                    id = encstrset_new();
+                }
+                std::vector<std::string> values;
+                std::vector<const char *> batch;
+                for (int i = 0; i < valueCount; i++) {
+                    values.push_back(valueName(0, i));
+                }
+                for (int i = 0; i < valueCount; i++) {
+                    batch.push_back(values[i].c_str());
+                    if (i % 2 == 0) {
+                        assert(encstrset_insert(ids[0], values[i].c_str(), "key"));
+                    }
+                }
+                assert(encstrset_insert_batch(ids[1], batch.data(), batch.size() / 3, "key", nullptr) ==
+                       batch.size() / 3);
+                assert(encstrset_insert(ids[5], "deleted", nullptr));
+                if (checkpoint) {
+                    assert(encstrset_journal_checkpoint());
+                }
+                for (int i = 0; i < valueCount; i += 4) {
+                    assert(encstrset_remove(ids[0], values[i].c_str(), "key"));
+                }
+                assert(encstrset_remove_batch(ids[1], batch.data(), 10, "key", nullptr) == 10);
+                assert(encstrset_set_filter(ids[1], true));
+                assert(encstrset_insert(ids[1], "filtered", "key"));
+                encstrset_symdiff(ids[0], ids[1], ids[2]);
+                encstrset_copy(ids[0], ids[3]);
+                encstrset_copy(ids[1], ids[3]);
+                assert(encstrset_insert(ids[4], "cleared", nullptr));
+                encstrset_clear(ids[4]);
+                encstrset_delete(ids[5]);
+                assert(encstrset_journal_close());
+
+                std::vector<std::string> expected[6];
+                for (int set = 0; set < 6; set++) {
+                    expected[set] = contents(ids[set]);
+                    encstrset_delete(ids[set]);
+                }
+                assert(encstrset_journal_replay(path));
+                for (int set = 0; set < 5; set++) {
+                    assert(encstrset_size(ids[set]) == expected[set].size());
+                    assert(contents(ids[set]) == expected[set]);
+                }
+                assert(encstrset_test(ids[1], "filtered", "key"));
+                assert(encstrset_size(ids[4]) == 0 && encstrset_insert(ids[4], "kept", nullptr));
+                assert(!encstrset_insert(ids[5], "deleted", nullptr));
+
+                for (unsigned long id : ids) {
+                    encstrset_delete(id);
+                    std::remove((std::string(path) + ".1." + std::to_string(id)).c_str());
+                }
+            }
+        }
+        std::remove(path);
+    }
+    // Global stats count every call since the start, from threads that
+    // have exited too, and sum the tables of the sets that exist.
+    void globalStats() {
+        assert(!encstrset_get_global_stats(nullptr));
+        encstrset_global_stats before, after;
+        assert(encstrset_get_global_stats(&before));
+
+        unsigned long a = encstrset_new(), b = encstrset_new();
+        size_t cipherBytes = 0;
+        for (int i = 0; i < 300; i++) {
+            assert(encstrset_insert(a, valueName(0, i).c_str(), "key"));
+            cipherBytes += valueName(0, i).size();
+        }
+        for (int i = 0; i < 100; i++) {
+            assert(!encstrset_insert(a, valueName(0, i).c_str(), "key"));
+        }
+        assert(encstrset_set_filter(a, true));
+        for (int i = 0; i < 350; i++) {
+            assert(encstrset_test(a, valueName(0, i).c_str(), "key") == (i < 300));
+        }
+        for (int i = 0; i < 70; i++) {
+            assert(encstrset_remove(a, valueName(0, i * 5).c_str(), "key") == (i < 60));
+            cipherBytes -= i < 60 ? valueName(0, i * 5).size() : 0;
+        }
+        std::thread worker([b, &cipherBytes] {
+            for (int i = 0; i < 40; i++) {
+                assert(encstrset_insert(b, valueName(1, i).c_str(), nullptr));
+                cipherBytes += valueName(1, i).size();
+            }
+        });
+        worker.join();
+        assert(encstrset_set_budget(b, 1));
+        std::string large(size_t(1) << 20, 'x');
+        assert(!encstrset_insert(b, large.c_str(), nullptr));
+
+        assert(encstrset_get_global_stats(&after));
+        assert(after.sets == before.sets + 2);
+        assert(after.totals.inserted - before.totals.inserted == 340);
+        assert(after.totals.insert_duplicates - before.totals.insert_duplicates == 100);
+        assert(after.totals.test_hits - before.totals.test_hits == 300);
+        assert(after.totals.test_misses - before.totals.test_misses == 50);
+        assert(after.totals.removed - before.totals.removed == 60);
+        assert(after.totals.remove_misses - before.totals.remove_misses == 10);
+        assert(after.totals.filter_rejects - before.totals.filter_rejects +
+               after.totals.filter_false_positives - before.totals.filter_false_positives == 50);
+        assert(after.totals.budget_rejects - before.totals.budget_rejects == 1);
+        assert(after.totals.elements - before.totals.elements == 280);
+        assert(after.totals.cipher_bytes - before.totals.cipher_bytes == cipherBytes);
+        assert(after.totals.slots > before.totals.slots && after.totals.filter_bytes > before.totals.filter_bytes);
+        // One in 16 calls of a thread is timed.
+        uint64_t timed[3] = {};
+        for (int i = 0; i < ENCSTRSET_LATENCY_BUCKETS; i++) {
+            timed[0] += after.insert_latency[i] - before.insert_latency[i];
+            timed[1] += after.test_latency[i] - before.test_latency[i];
+            timed[2] += after.remove_latency[i] - before.remove_latency[i];
+        }
+        assert(timed[0] >= 440 / 16 - 2 && timed[0] <= 440 / 16 + 2);
+        assert(timed[1] >= 350 / 16 - 1 && timed[1] <= 350 / 16 + 1);
+        assert(timed[2] >= 70 / 16 - 1 && timed[2] <= 70 / 16 + 1);
+
+        encstrset_delete(a);
+        encstrset_delete(b);
+        assert(encstrset_get_global_stats(&after));
+        assert(after.sets == before.sets);
+        assert(after.totals.elements == before.totals.elements);
+    }
+
+    // Loads from a descriptor insert the lines as encstrset_load_lines does,
+    // whether it is a pipe fed in pieces, with a line longer than the first
+    // buffer, or a regular file read from its current offset.
+    void descriptorLoads() {
+        int pipeEnds[2];
+        assert(pipe(pipeEnds) == 0);
+        std::string longLine(size_t(3) << 20, 'l');
+        std::thread writer([&pipeEnds, &longLine] {
+            std::string lines;
+            for (int i = 0; i < 200000; i++) {
+                lines += valueName(0, i) + "\n";
+            }
+            lines += longLine + "\n" + valueName(0, 0) + "\nlast";
+            for (size_t begin = 0; begin < lines.size();) {
+                size_t piece = std::min<size_t>(65536, lines.size() - begin);
+                ssize_t written = write(pipeEnds[1], lines.data() + begin, piece);
+                assert(written > 0);
+                begin += size_t(written);
+            }
+            close(pipeEnds[1]);
+        });
+        unsigned long id = encstrset_new();
+        assert(encstrset_load_lines_fd(id, pipeEnds[0], "key", '\n') == 200002);
+        writer.join();
+        close(pipeEnds[0]);
+        assert(encstrset_size(id) == 200002);
+        for (int i = 0; i < 200000; i += 997) {
+            assert(encstrset_test(id, valueName(0, i).c_str(), "key"));
+        }
+        assert(encstrset_test(id, longLine.c_str(), "key") && encstrset_test(id, "last", "key"));
+        encstrset_delete(id);
+
+        const char *path = "encstrset_test_api.lines";
+        FILE *file = std::fopen(path, "wb");
+        std::fputs("skipped,first,second,", file);
+        std::fclose(file);
+        int descriptor = open(path, O_RDONLY);
+        assert(lseek(descriptor, 8, SEEK_SET) == 8);
+        id = encstrset_new();
+        assert(encstrset_load_lines_fd(id, descriptor, nullptr, ',') == 2);
+        assert(encstrset_load_lines_fd(id, descriptor, nullptr, ',') == 0);
+        close(descriptor);
+        assert(encstrset_size(id) == 2 && !encstrset_test(id, "skipped", nullptr));
+        assert(encstrset_test(id, "first", nullptr) && encstrset_test(id, "second", nullptr));
+        assert(encstrset_load_lines_fd(id, -1, nullptr, ',') == 0);
+        encstrset_delete(id);
+        std::remove(path);
+    }
+
+    // Chunks hold every ciphertext once, whole. One too long for the buffer
+    // is reported by the capacity it needs, more than the buffer has, and
+    // then returned into a buffer that large.
+    void chunks() {
+        unsigned long id = encstrset_new();
+        for (int i = 0; i < valueCount; i++) {
+            std::string value = valueName(0, i);
+            if (i % 100 == 0) {
+                value.append(size_t(i) + 100, 'x');
+            }
+            assert(encstrset_insert(id, value.c_str(), "key"));
+        }
+        std::vector<std::string> ciphers;
+        std::vector<unsigned char> buffer(64);
+        size_t tooLong = 0;
+        encstrset_iter *cursor = encstrset_iter_begin(id);
+        while (size_t used = encstrset_iter_next_chunk(cursor, buffer.data(), buffer.size())) {
+            if (used > buffer.size()) {
+                buffer.resize(used);
+                tooLong++;
+                continue;
+            }
+            for (size_t offset = 0; offset < used;) {
+                size_t length = buffer[offset] | buffer[offset + 1] << 8 | buffer[offset + 2] << 16 |
+                                size_t(buffer[offset + 3]) << 24;
+                ciphers.emplace_back(reinterpret_cast<char *>(buffer.data()) + offset + 4, length);
+                offset += 4 + length;
+            }
+        }
+        assert(encstrset_iter_next_chunk(cursor, buffer.data(), buffer.size()) == 0);
+        encstrset_iter_end(cursor);
+        assert(tooLong > 0 && tooLong <= 10);
+        std::sort(ciphers.begin(), ciphers.end());
+        assert(ciphers == contents(id));
+        encstrset_delete(id);
+    }
+
+    // Lines of the decoded trace at path that contain text.
+    size_t decodedLines(const char *decoder, const char *path, const std::string &text) {
+        std::string command = std::string(decoder) + " " + path;
+        FILE *output = popen(command.c_str(), "r");
+        assert(output != nullptr);
+        size_t count = 0;
+        std::string line;
+        int character;
+        while ((character = std::fgetc(output)) != EOF) {
+            if (character != '\n') {
+                line += static_cast<char>(character);
+                continue;
+            }
+            count += line.find(text) != std::string::npos;
+            line.clear();
+        }
+        assert(pclose(output) == 0);
+        return count;
+    }
+
+    // Traces written by encstrset_trace_start decode to one record per
+    // traced call, from every thread, and a trace started again holds only
+    // the calls made while it ran.
+    void traces(const char *decoder) {
+        const char *path = "encstrset_test_api.trace";
+        unsigned long id = encstrset_new();
+        for (int round = 0; round < 2; round++) {
+            assert(encstrset_trace_start(path));
+            assert(!encstrset_trace_start(path));
+            std::thread worker([id, round] {
+                for (int i = 0; i < 100; i++) {
+                    assert(encstrset_insert(id, valueName(round, i).c_str(), "key"));
+                }
+            });
+            worker.join();
+            for (int i = 0; i < 100; i++) {
+                assert(encstrset_test(id, valueName(round, i).c_str(), "key"));
+            }
+            assert(!encstrset_remove(id, "missing", "key"));
+            encstrset_clear(id);
+            assert(encstrset_trace_stop());
+            assert(!encstrset_trace_stop());
+            // Calls between traces are not recorded.
+            assert(encstrset_insert(id, "untraced", "key"));
+
+            std::string set = " set #" + std::to_string(id) + " ";
+            assert(decodedLines(decoder, path, "insert" + set) == 100);
+            assert(decodedLines(decoder, path, "test" + set) == 100);
+            assert(decodedLines(decoder, path, "remove" + set) == 1);
+            assert(decodedLines(decoder, path, "clear" + set) == 1);
+            assert(decodedLines(decoder, path, "dropped") == 0);
+        }
+        std::remove(path);
+        encstrset_delete(id);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    batches();
+    preparedKeyRemoves();
+    overlongValues();
+    setAlgebra();
+    journalReplay();
+    globalStats();
+    descriptorLoads();
+    chunks();
+    // The decoder is a separate program; its path is the first argument.
+    if (argc > 1) {
+        traces(argv[1]);
+    }
+}
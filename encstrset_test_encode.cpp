@@ -0,0 +1,92 @@
+#include "encstrset.h"
+#include "encstrset_encode.h"
+#include "encstrset_hash.h"
+#include "encstrset_table.h"
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <cassert>
+#include <string>
+#include <vector>
+
+using namespace ::jnp1;
+using namespace ::encstrset_detail;
+
+namespace {
+    // Lengths around the chunks encodeAndHash works in (128 hash blocks of
+    // 48 bytes), and around a single block.
+    const size_t valueLengths[] = {0, 1, 47, 48, 49, 6143, 6144, 6145, 12288, 12289};
+
+    // Keys shorter than the key stream target, repeated into a stream,
+    // longer than it, used as is, and longer than every value.
+    const size_t keyLengths[] = {0, 1, 7, 255, 256, 300, 13000};
+
+    std::string pattern(size_t length, unsigned seed) {
+        std::string bytes(length, '\0');
+        for (size_t i = 0; i < length; i++) {
+            seed = seed * 1103515245 + 12345;
+            bytes[i] = static_cast<char>(seed >> 16);
+        }
+        return bytes;
+    }
+
+    std::string expectedCipher(const std::string &value, const std::string &key) {
+        std::string cipher = value;
+        for (size_t i = 0; i < cipher.size() && !key.empty(); i++) {
+            cipher[i] ^= key[i % key.size()];
+        }
+        return cipher;
+    }
+
+    // Encoding and hashing at once gives the ciphertext byte by byte and the
+    // hash the table computes from it, whatever the chunk boundaries.
+    void fusedHashes() {
+        for (size_t keyLength : keyLengths) {
+            std::string key = pattern(keyLength, unsigned(keyLength) + 1);
+            for (size_t valueLength : valueLengths) {
+                std::string value = pattern(valueLength, unsigned(valueLength) + 7);
+                std::string expected = expectedCipher(value, key);
+                size_t expectedHash = StrSet::hash(expected);
+                assert(expectedHash == CipherHasher::hash(expected.data(), expected.size()));
+
+                KeyStream keyStream(key.data(), key.size(), valueLength);
+                std::string cipher = value;
+                assert(encodeAndHash(&cipher[0], cipher.size(), keyStream) == expectedHash);
+                assert(cipher == expected);
+
+                std::string encoded;
+                assert(encodeInto(encoded, value, keyStream) == expectedHash);
+                assert(encoded == expected);
+
+                // Streams prepared for a shorter value are still applied
+                // with the right phase.
+                KeyStream shortStream(key.data(), key.size(), 1);
+                cipher = value;
+                assert(encodeAndHash(&cipher[0], cipher.size(), shortStream) == expectedHash);
+                assert(cipher == expected);
+            }
+        }
+    }
+
+    // Scratch ciphertexts and prepared keys take the same path.
+    void scratchAndPreparedKeys() {
+        std::string key = "a prepared key";
+        encstrset_key *prepared = encstrset_key_prepare(key.c_str());
+        for (size_t valueLength : valueLengths) {
+            std::string value = pattern(valueLength, unsigned(valueLength) + 3);
+            std::string expected = expectedCipher(value, key);
+            KeyStream keyStream(prepared);
+            ScratchCipher scratch(value, keyStream);
+            assert(scratch.cipher() == expected);
+            assert(scratch.hash() == StrSet::hash(expected));
+        }
+        encstrset_key_release(prepared);
+    }
+}
+
+int main() {
+    fusedHashes();
+    scratchAndPreparedKeys();
+}
@@ -0,0 +1,578 @@
+#include "encstrset.h"
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace ::jnp1;
+
+namespace {
+    const int threadCount = 8;
+    const int valueCount = 2000;
+
+    std::string valueName(int thread, int i) {
+        return "value-" + std::to_string(thread) + "-" + std::to_string(i);
+    }
+
+    // Every thread works on a set of its own while creating and deleting
+    // short-lived sets, so that registry shards are shared between threads.
+    void privateSets() {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.emplace_back([t] {
+                unsigned long id = encstrset_new();
+                for (int i = 0; i < valueCount; i++) {
+                    assert(encstrset_insert(id, valueName(t, i).c_str(), "key"));
+                    unsigned long temporary = encstrset_new();
+                    assert(encstrset_insert(temporary, "x", nullptr));
+                    encstrset_delete(temporary);
+                    assert(encstrset_size(temporary) == 0);
+                }
+                assert(encstrset_size(id) == valueCount);
+                for (int i = 0; i < valueCount; i += 2) {
+                    assert(encstrset_remove(id, valueName(t, i).c_str(), "key"));
+                }
+                for (int i = 0; i < valueCount; i++) {
+                    assert(encstrset_test(id, valueName(t, i).c_str(), "key") == (i % 2 == 1));
+                }
+                encstrset_delete(id);
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Readers test values that are always present while writers insert and
+    // remove values of their own in the same set.
+    void sharedSet() {
+        unsigned long id = encstrset_new();
+        for (int i = 0; i < valueCount; i++) {
+            encstrset_insert(id, valueName(-1, i).c_str(), "shared");
+        }
+
+        std::atomic<bool> writersDone{false};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount / 2; t++) {
+            threads.emplace_back([id, t] {
+                for (int round = 0; round < 5; round++) {
+                    for (int i = 0; i < valueCount; i++) {
+                        assert(encstrset_insert(id, valueName(t, i).c_str(), "shared"));
+                    }
+                    for (int i = 0; i < valueCount; i++) {
+                        assert(encstrset_remove(id, valueName(t, i).c_str(), "shared"));
+                    }
+                }
+            });
+        }
+        for (int t = 0; t < threadCount / 2; t++) {
+            threads.emplace_back([id, &writersDone] {
+                while (!writersDone) {
+                    for (int i = 0; i < valueCount; i++) {
+                        assert(encstrset_test(id, valueName(-1, i).c_str(), "shared"));
+                    }
+                }
+            });
+        }
+        for (int t = 0; t < threadCount / 2; t++) {
+            threads[t].join();
+        }
+        writersDone = true;
+        for (auto &thread : threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+        assert(encstrset_size(id) == valueCount);
+        encstrset_delete(id);
+    }
+
+    // Copies in both directions at once must neither deadlock nor lose
+    // elements, and deleting a set while it is being copied must be safe.
+    void crossCopies() {
+        unsigned long a = encstrset_new(), b = encstrset_new();
+        for (int i = 0; i < valueCount; i++) {
+            encstrset_insert(a, valueName(0, i).c_str(), nullptr);
+            encstrset_insert(b, valueName(1, i).c_str(), nullptr);
+        }
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.emplace_back([a, b, t] {
+                for (int round = 0; round < 20; round++) {
+                    if (t % 2 == 0) {
+                        encstrset_copy(a, b);
+                    } else {
+                        encstrset_copy(b, a);
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        assert(encstrset_size(a) == 2 * valueCount);
+        assert(encstrset_size(b) == 2 * valueCount);
+
+        std::thread copier([a, b] {
+            for (int round = 0; round < 20; round++) {
+                encstrset_copy(a, b);
+            }
+        });
+        encstrset_delete(a);
+        copier.join();
+        assert(encstrset_size(a) == 0);
+        assert(encstrset_size(b) == 2 * valueCount);
+        encstrset_delete(b);
+    }
+
+    // Calls through handles race with the deletion of their set: each
+    // either completes on the set or finds it deleted, and once it has
+    // been deleted every call finds it so.
+    void staleHandles() {
+        unsigned long id = encstrset_new();
+        for (int i = 0; i < valueCount; i++) {
+            encstrset_insert(id, valueName(-1, i).c_str(), "handle");
+        }
+
+        std::vector<encstrset_handle *> handles;
+        for (int t = 0; t < threadCount; t++) {
+            handles.push_back(encstrset_open(id));
+            assert(handles.back() != nullptr);
+        }
+        std::atomic<int> working{0};
+        std::atomic<bool> deleted{false};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.emplace_back([t, &handles, &working, &deleted] {
+                const encstrset_handle *handle = handles[t];
+                working++;
+                for (int i = 0;; i = (i + 1) % valueCount) {
+                    bool wasDeleted = deleted;
+                    bool present = encstrset_test_h(handle, valueName(-1, i).c_str(), "handle");
+                    bool inserted = encstrset_insert_h(handle, valueName(t, i).c_str(), "handle");
+                    if (wasDeleted) {
+                        assert(!present && !inserted);
+                        assert(encstrset_size_h(handle) == 0);
+                        return;
+                    }
+                    if (inserted) {
+                        encstrset_remove_h(handle, valueName(t, i).c_str(), "handle");
+                    }
+                }
+            });
+        }
+        while (working < threadCount) {
+            std::this_thread::yield();
+        }
+        encstrset_delete(id);
+        deleted = true;
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        assert(encstrset_open(id) == nullptr);
+        for (encstrset_handle *handle : handles) {
+            encstrset_close(handle);
+        }
+    }
+
+    // Threads load the same file, with duplicate lines, into one set while
+    // others insert some of its lines one by one: every line is inserted
+    // exactly once overall.
+    void concurrentLoads() {
+        const char *path = "encstrset_test_threads.lines";
+        FILE *file = std::fopen(path, "wb");
+        assert(file != nullptr);
+        for (int i = 0; i < 4 * valueCount; i++) {
+            std::fprintf(file, "%s\n", valueName(-1, i % valueCount).c_str());
+        }
+        std::fclose(file);
+
+        unsigned long id = encstrset_new();
+        std::atomic<size_t> inserted{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.emplace_back([t, id, path, &inserted] {
+                if (t % 2 == 0) {
+                    inserted += encstrset_load_lines(id, path, "lines", '\n');
+                    return;
+                }
+                for (int i = t; i < valueCount; i += threadCount) {
+                    inserted += encstrset_insert(id, valueName(-1, i).c_str(), "lines");
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        std::remove(path);
+        assert(inserted == size_t(valueCount));
+        assert(encstrset_size(id) == size_t(valueCount));
+        for (int i = 0; i < valueCount; i++) {
+            assert(encstrset_test(id, valueName(-1, i).c_str(), "lines"));
+        }
+        encstrset_delete(id);
+    }
+
+    // Cursors walk the set as it was when they began while other threads
+    // clear and refill it; what they return stays valid until they end.
+    void iterationDuringChanges() {
+        unsigned long id = encstrset_new();
+        for (int i = 0; i < valueCount; i++) {
+            encstrset_insert(id, valueName(-1, i).c_str(), nullptr);
+        }
+
+        std::atomic<bool> iterating{true};
+        std::thread writer([id, &iterating] {
+            for (int round = 0; iterating; round++) {
+                encstrset_clear(id);
+                for (int i = 0; i < valueCount; i += 7) {
+                    encstrset_insert(id, valueName(round, i).c_str(), nullptr);
+                }
+            }
+        });
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.emplace_back([id, t] {
+                encstrset_iter *cursor = encstrset_iter_begin(id);
+                assert(cursor != nullptr);
+                std::vector<std::string> ciphers;
+                if (t % 2 == 0) {
+                    const char *cipher;
+                    size_t length;
+                    while (encstrset_iter_next(cursor, &cipher, &length)) {
+                        ciphers.emplace_back(cipher, length);
+                    }
+                } else {
+                    unsigned char buffer[256];
+                    while (size_t used = encstrset_iter_next_chunk(cursor, buffer, sizeof(buffer))) {
+                        assert(used <= sizeof(buffer));
+                        for (size_t offset = 0; offset < used;) {
+                            size_t length = buffer[offset] | buffer[offset + 1] << 8 | buffer[offset + 2] << 16 |
+                                            size_t(buffer[offset + 3]) << 24;
+                            ciphers.emplace_back(reinterpret_cast<char *>(buffer) + offset + 4, length);
+                            offset += 4 + length;
+                        }
+                    }
+                }
+                encstrset_iter_end(cursor);
+                // Each cursor saw one state of the set, possibly halfway
+                // through a refill: distinct ciphers (with a NULL key, the
+                // values) of a single round.
+                if (ciphers.empty()) {
+                    return;
+                }
+                std::string round = ciphers[0].substr(0, ciphers[0].rfind('-') + 1);
+                size_t roundSize = round == "value--1-" ? valueCount : (valueCount + 6) / 7;
+                assert(ciphers.size() <= roundSize);
+                for (const auto &cipher : ciphers) {
+                    assert(cipher.compare(0, round.size(), round) == 0);
+                }
+                std::sort(ciphers.begin(), ciphers.end());
+                assert(std::adjacent_find(ciphers.begin(), ciphers.end()) == ciphers.end());
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        iterating = false;
+        writer.join();
+        encstrset_delete(id);
+        assert(encstrset_iter_begin(id) == nullptr);
+    }
+
+    // A set frozen again and again while readers test it and a writer
+    // thaws it: tests always see the values that stay, never the ones the
+    // writer keeps out, and the writer's changes are never lost. A freeze
+    // overtaken by a change fails, so those in the loop may go either way.
+    void freezingDuringChanges() {
+        unsigned long id = encstrset_new();
+        for (int i = 0; i < valueCount; i++) {
+            encstrset_insert(id, valueName(-1, i).c_str(), "key");
+        }
+
+        std::atomic<bool> changing{true};
+        std::thread freezer([id, &changing] {
+            while (changing) {
+                encstrset_freeze(id);
+            }
+        });
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.emplace_back([id, t] {
+                for (int i = 0; i < valueCount; i++) {
+                    assert(encstrset_test(id, valueName(-1, (i + t) % valueCount).c_str(), "key"));
+                    assert(!encstrset_test(id, valueName(-2, i).c_str(), "key"));
+                }
+            });
+        }
+        for (int i = 0; i < valueCount; i++) {
+            assert(encstrset_insert(id, valueName(0, i).c_str(), "key"));
+            if (i % 2 == 0) {
+                assert(encstrset_remove(id, valueName(0, i).c_str(), "key"));
+            }
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        changing = false;
+        freezer.join();
+
+        assert(encstrset_freeze(id));
+        assert(encstrset_size(id) == valueCount + valueCount / 2);
+        for (int i = 0; i < valueCount; i++) {
+            assert(encstrset_test(id, valueName(0, i).c_str(), "key") == (i % 2 == 1));
+        }
+        encstrset_delete(id);
+    }
+
+    // A set compacted again and again while readers test it and a writer
+    // changes it: compaction never loses a value or the writer's changes.
+    void compactingDuringChanges() {
+        unsigned long id = encstrset_new();
+        for (int i = 0; i < valueCount; i++) {
+            encstrset_insert(id, valueName(-1, i).c_str(), "key");
+        }
+
+        std::atomic<bool> changing{true};
+        std::thread compactor([id, &changing] {
+            while (changing) {
+                encstrset_compact(id);
+            }
+        });
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.emplace_back([id, t] {
+                for (int i = 0; i < valueCount; i++) {
+                    assert(encstrset_test(id, valueName(-1, (i + t) % valueCount).c_str(), "key"));
+                    assert(!encstrset_test(id, valueName(-2, i).c_str(), "key"));
+                }
+            });
+        }
+        for (int i = 0; i < valueCount; i++) {
+            assert(encstrset_insert(id, valueName(0, i).c_str(), "key"));
+            if (i % 2 == 0) {
+                assert(encstrset_remove(id, valueName(0, i).c_str(), "key"));
+            }
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        changing = false;
+        compactor.join();
+
+        assert(encstrset_compact(id));
+        assert(encstrset_size(id) == valueCount + valueCount / 2);
+        for (int i = 0; i < valueCount; i++) {
+            assert(encstrset_test(id, valueName(0, i).c_str(), "key") == (i % 2 == 1));
+        }
+        encstrset_delete(id);
+    }
+
+    // Runs requests through queue, resubmitting those it has no room for,
+    // and returns the result of each, polled unless a callback records it.
+    std::vector<char> runQueued(encstrset_queue *queue, const std::vector<encstrset_request> &requests,
+                                std::vector<char> *recorded) {
+        std::vector<char> results(requests.size(), -1);
+        std::vector<encstrset_completion> completions(64);
+        size_t submitted = 0, completed = 0;
+        while (completed < requests.size()) {
+            submitted += encstrset_queue_submit(queue, requests.data() + submitted, requests.size() - submitted);
+            size_t polled = encstrset_queue_poll(queue, completions.data(), completions.size(), true);
+            if (recorded != nullptr) {
+                assert(polled == 0);
+                completed = submitted;
+                continue;
+            }
+            for (size_t i = 0; i < polled; i++) {
+                assert(results[completions[i].cookie] == -1);
+                results[completions[i].cookie] = completions[i].result;
+            }
+            completed += polled;
+        }
+        return recorded != nullptr ? *recorded : results;
+    }
+
+    void recordCompletions(void *context, const encstrset_completion *completions, size_t count) {
+        auto &recorded = *static_cast<std::vector<char> *>(context);
+        for (size_t i = 0; i < count; i++) {
+            assert(recorded[completions[i].cookie] == -1);
+            recorded[completions[i].cookie] = completions[i].result;
+        }
+    }
+
+    // Requests on two sets through a queue, with results polled or passed
+    // to a callback, match what the calls themselves return.
+    void queuedRequests() {
+        for (bool withCallback : {false, true}) {
+            unsigned long ids[2] = {encstrset_new(), encstrset_new()};
+            std::vector<std::string> values;
+            for (int i = 0; i < valueCount; i++) {
+                values.push_back(valueName(i % 2, i));
+            }
+            std::vector<char> recorded;
+            encstrset_queue *queue = encstrset_queue_create(4, 100, withCallback ? recordCompletions : nullptr,
+                                                            &recorded);
+            assert(queue != nullptr);
+
+            auto requestsFor = [&](encstrset_operation operation, int stride) {
+                std::vector<encstrset_request> requests;
+                for (int i = 0; i < valueCount; i += stride) {
+                    encstrset_request request = {requests.size(), ids[i % 2], operation, values[i].data(),
+                                                 values[i].size(), "key", 3};
+                    requests.push_back(request);
+                }
+                recorded.assign(requests.size(), -1);
+                return requests;
+            };
+            auto inserts = requestsFor(ENCSTRSET_INSERT, 1);
+            std::vector<char> results = runQueued(queue, inserts, withCallback ? &recorded : nullptr);
+            assert(std::count(results.begin(), results.end(), 1) == valueCount);
+            assert(encstrset_size(ids[0]) + encstrset_size(ids[1]) == size_t(valueCount));
+
+            auto removes = requestsFor(ENCSTRSET_REMOVE, 3);
+            results = runQueued(queue, removes, withCallback ? &recorded : nullptr);
+            assert(std::count(results.begin(), results.end(), 1) == long(removes.size()));
+
+            auto tests = requestsFor(ENCSTRSET_TEST, 1);
+            results = runQueued(queue, tests, withCallback ? &recorded : nullptr);
+            for (int i = 0; i < valueCount; i++) {
+                assert(results[i] == (i % 3 != 0));
+                assert(encstrset_test(ids[i % 2], values[i].c_str(), "key") == (i % 3 != 0));
+            }
+
+            // Requests still queued are run before the queue goes away.
+            encstrset_delete(ids[1]);
+            auto lastInserts = requestsFor(ENCSTRSET_INSERT, 3);
+            size_t submitted = encstrset_queue_submit(queue, lastInserts.data(), lastInserts.size());
+            encstrset_queue_destroy(queue);
+            for (size_t i = 0; i < submitted; i++) {
+                assert(encstrset_test(ids[0], values[3 * i].c_str(), "key") == (3 * i % 2 == 0));
+            }
+            encstrset_delete(ids[0]);
+        }
+    }
+
+    // Reads or overwrites count bytes of a file at offset.
+    void patchFile(const char *path, long offset, void *bytes, size_t count, bool write) {
+        FILE *file = std::fopen(path, "r+b");
+        assert(file != nullptr && std::fseek(file, offset, SEEK_SET) == 0);
+        assert((write ? std::fwrite(bytes, 1, count, file) : std::fread(bytes, 1, count, file)) == count);
+        std::fclose(file);
+    }
+
+    // A snapshot whose table is damaged is turned away even unverified:
+    // with no empty slot a probe would never end, and a ciphertext past
+    // the arena would be read out of the mapping.
+    void damagedSnapshots() {
+        const char *path = "encstrset_test_threads.snapshot";
+        unsigned long id = encstrset_new();
+        for (int i = 0; i < valueCount; i++) {
+            assert(encstrset_insert(id, (valueName(0, i) + std::string(40, 'x')).c_str(), "key"));
+        }
+        for (int i = 0; i < valueCount; i += 3) {
+            assert(encstrset_remove(id, (valueName(0, i) + std::string(40, 'x')).c_str(), "key"));
+        }
+        assert(encstrset_save(id, path));
+        unsigned long loaded = encstrset_load(path, false);
+        assert(loaded != ENCSTRSET_INVALID_ID && encstrset_size(loaded) == encstrset_size(id));
+        encstrset_delete(loaded);
+
+        // Offsets of the slot count and the table in the header.
+        uint64_t slotCount, tableOffset;
+        patchFile(path, 32, &slotCount, sizeof(slotCount), false);
+        patchFile(path, 88, &tableOffset, sizeof(tableOffset), false);
+        std::vector<char> table(slotCount * 17);
+        patchFile(path, long(tableOffset), table.data(), table.size(), false);
+
+        std::vector<char> damaged(table);
+        std::fill(damaged.begin(), damaged.begin() + long(slotCount), 0);
+        patchFile(path, long(tableOffset), damaged.data(), damaged.size(), true);
+        assert(encstrset_load(path, false) == ENCSTRSET_INVALID_ID);
+
+        damaged = table;
+        for (uint64_t slot = 0; slot < slotCount; slot++) {
+            // The arena offset of a long ciphertext follows its length and
+            // first bytes.
+            if (static_cast<signed char>(damaged[slot]) >= 0) {
+                std::memset(&damaged[slotCount + slot * 16 + 8], 0x7F, 8);
+            }
+        }
+        patchFile(path, long(tableOffset), damaged.data(), damaged.size(), true);
+        assert(encstrset_load(path, false) == ENCSTRSET_INVALID_ID);
+
+        std::remove(path);
+        encstrset_delete(id);
+    }
+
+    // A set shared by this process is attached by a child process, which
+    // finds the same values in it; sharing it again only shows to sets
+    // attached afterwards.
+    void sharedSegments() {
+        const char *name = "/encstrset_test_threads";
+        unsigned long id = encstrset_new();
+        for (int i = 0; i < valueCount; i++) {
+            assert(encstrset_insert(id, valueName(0, i).c_str(), "key"));
+        }
+        assert(encstrset_share(id, name));
+        encstrset_footprint footprint;
+        assert(encstrset_get_footprint(id, &footprint) && footprint.mapped_bytes > 0);
+
+        pid_t child = fork();
+        assert(child >= 0);
+        if (child == 0) {
+            unsigned long attached = encstrset_attach(name, true);
+            bool found = attached != ENCSTRSET_INVALID_ID && encstrset_size(attached) == size_t(valueCount);
+            for (int i = 0; i < valueCount && found; i++) {
+                found = encstrset_test(attached, valueName(0, i).c_str(), "key") &&
+                        !encstrset_test(attached, valueName(1, i).c_str(), "key");
+            }
+            _exit(found ? 0 : 1);
+        }
+        int status;
+        assert(waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+        unsigned long before = encstrset_attach(name, false);
+        assert(encstrset_insert(id, "after sharing", "key"));
+        assert(encstrset_get_footprint(id, &footprint) && footprint.mapped_bytes == 0);
+        assert(encstrset_share(id, name));
+        unsigned long after = encstrset_attach(name, false);
+        assert(!encstrset_test(before, "after sharing", "key"));
+        assert(encstrset_test(after, "after sharing", "key"));
+        assert(encstrset_size(before) == size_t(valueCount));
+        assert(encstrset_size(after) == size_t(valueCount) + 1);
+
+        assert(encstrset_unshare(name));
+        assert(!encstrset_unshare(name));
+        assert(encstrset_attach(name, false) == ENCSTRSET_INVALID_ID);
+        assert(encstrset_test(after, valueName(0, 0).c_str(), "key"));
+        encstrset_delete(after);
+        encstrset_delete(before);
+        encstrset_delete(id);
+    }
+}
+
+int main() {
+    privateSets();
+    sharedSet();
+    crossCopies();
+    staleHandles();
+    concurrentLoads();
+    iterationDuringChanges();
+    freezingDuringChanges();
+    compactingDuringChanges();
+    queuedRequests();
+    damagedSnapshots();
+    sharedSegments();
+}
@@ -0,0 +1,205 @@
+#include "encstrset_trace.h"
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#ifdef ENCSTRSET_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+    using namespace encstrset_detail;
+
+    const char *const traceOperationNames[] = {
+        "dropped", "new", "delete", "size", "insert", "remove", "test", "clear", "copy",
+        "union", "intersect", "difference", "symdiff", "save", "load", "load_lines", "share", "attach",
+        "freeze"
+    };
+
+    // Trace files start with traceMagic, the format version, the record
+    // size and the number of operation names, each a uint32_t, followed by
+    // the names (each terminated by a NUL byte) and then the records.
+    const char traceMagic[8] = {'E', 'N', 'C', 'S', 'T', 'R', 'C', '\0'};
+    const uint32_t traceVersion = 2;
+
+    uint16_t nextTraceThread = 0;
+
+    // The calling thread's ring, registered on its first traced call.
+    TraceRing &traceRing() {
+        struct ThreadRing {
+            shared_ptr<TraceRing> ring;
+
+            ~ThreadRing() {
+                if (ring != nullptr) {
+                    ring->finished.store(true, memory_order_release);
+                }
+            }
+        };
+        thread_local ThreadRing local;
+        if (local.ring == nullptr) {
+            auto ring = make_shared<TraceRing>();
+            lock_guard<mutex> lock(traceMutex);
+            ring->thread = nextTraceThread++;
+            traceRings.push_back(ring);
+            local.ring = move(ring);
+        }
+        return *local.ring;
+    }
+} // namespace
+
+namespace encstrset_detail {
+    atomic<bool> tracing{false};
+    mutex traceMutex;
+    vector<shared_ptr<TraceRing>> traceRings;
+
+    uint64_t traceClock() {
+        return static_cast<uint64_t>(
+                chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    uint64_t traceStamp() {
+#ifdef ENCSTRSET_X86_DISPATCH
+        return __rdtsc();
+#else
+        return traceClock();
+#endif
+    }
+
+    uint64_t traceStartStamp = 0;
+    uint64_t traceStartClock = 0;
+
+    void appendTrace(TraceOperation operation, SetNumber id, bool result, uint64_t detail, string_view cipher,
+                     size_t cipherHash) {
+        TraceRing &ring = traceRing();
+        uint64_t head = ring.head.load(memory_order_relaxed);
+        if (head - ring.tail.load(memory_order_acquire) >= TraceRing::capacity) {
+            ring.dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        jnp1::encstrset_trace_record &record = ring.records[head % TraceRing::capacity];
+        record.time = traceStamp();
+        record.set_id = id;
+        record.cipher_hash = static_cast<uint32_t>(cipherHash);
+        record.detail = detail;
+        memset(record.cipher_prefix, 0, sizeof(record.cipher_prefix));
+        memcpy(record.cipher_prefix, cipher.data(), min(cipher.size(), sizeof(record.cipher_prefix)));
+        record.thread = ring.thread;
+        record.operation = static_cast<uint8_t>(operation);
+        record.result = result;
+        ring.head.store(head + 1, memory_order_release);
+    }
+
+    TraceOperation traceOperation(SetOperation operation) {
+        switch (operation) {
+            case SetOperation::Union:
+                return TraceOperation::Union;
+            case SetOperation::Intersection:
+                return TraceOperation::Intersect;
+            case SetOperation::Difference:
+                return TraceOperation::Difference;
+            default:
+                return TraceOperation::SymmetricDifference;
+        }
+    }
+
+    mutex tracerMutex;
+    unique_ptr<TraceDrainer> tracer;
+
+    bool writeTraceHeader(FILE *file) {
+        uint32_t fields[] = {traceVersion, sizeof(jnp1::encstrset_trace_record),
+                             sizeof(traceOperationNames) / sizeof(traceOperationNames[0])};
+        bool written = fwrite(traceMagic, sizeof(traceMagic), 1, file) == 1 &&
+                       fwrite(fields, sizeof(fields), 1, file) == 1;
+        for (const char *name : traceOperationNames) {
+            written = written && fwrite(name, strlen(name) + 1, 1, file) == 1;
+        }
+        return written;
+    }
+
+    TraceDrainer::TraceDrainer(FILE *file) : file(file), worker([this] { run(); }) {
+        unique_lock<mutex> lock(drainerMutex);
+        ready.wait(lock, [&] { return started; });
+    }
+
+    bool TraceDrainer::stop() {
+        {
+            lock_guard<mutex> lock(drainerMutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        if (file != nullptr) {
+            failed |= fclose(file) != 0;
+            file = nullptr;
+        }
+        return !failed;
+    }
+
+    void TraceDrainer::run() {
+        discardLeftovers();
+        unique_lock<mutex> lock(drainerMutex);
+        started = true;
+        ready.notify_one();
+        while (!stopping) {
+            wake.wait_for(lock, chrono::milliseconds(1));
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+        lock.unlock();
+        drain();
+    }
+
+    void TraceDrainer::discardLeftovers() {
+        lock_guard<mutex> lock(traceMutex);
+        for (const auto &ring : traceRings) {
+            ring->tail.store(ring->head.load(memory_order_acquire), memory_order_release);
+            ring->dropped.store(0, memory_order_relaxed);
+        }
+    }
+
+    void TraceDrainer::drain() {
+        uint64_t stamp = traceStamp();
+        uint64_t clock = traceClock();
+        double nanosecondsPerStamp = stamp > traceStartStamp
+                                     ? double(clock - traceStartClock) / double(stamp - traceStartStamp) : 1;
+        lock_guard<mutex> lock(traceMutex);
+        for (auto ring = traceRings.begin(); ring != traceRings.end();) {
+            bool finished = (*ring)->finished.load(memory_order_acquire);
+            drain(**ring, nanosecondsPerStamp);
+            ring = finished ? traceRings.erase(ring) : ring + 1;
+        }
+        failed |= fflush(file) != 0;
+    }
+
+    void TraceDrainer::drain(TraceRing &ring, double nanosecondsPerStamp) {
+        uint64_t head = ring.head.load(memory_order_acquire);
+        uint64_t tail = ring.tail.load(memory_order_relaxed);
+        while (tail != head) {
+            size_t first = tail % TraceRing::capacity;
+            size_t count = min<uint64_t>(head - tail, TraceRing::capacity - first);
+            for (size_t i = first; i < first + count; i++) {
+                uint64_t stamps = ring.records[i].time - min(ring.records[i].time, traceStartStamp);
+                ring.records[i].time = static_cast<uint64_t>(double(stamps) * nanosecondsPerStamp);
+            }
+            failed |= fwrite(&ring.records[first], sizeof(ring.records[0]), count, file) != count;
+            tail += count;
+        }
+        ring.tail.store(tail, memory_order_release);
+
+        uint64_t dropped = ring.dropped.exchange(0, memory_order_relaxed);
+        if (dropped > 0) {
+            jnp1::encstrset_trace_record record = {};
+            record.time = traceClock() - traceStartClock;
+            record.detail = dropped;
+            record.thread = ring.thread;
+            record.operation = static_cast<uint8_t>(TraceOperation::Dropped);
+            failed |= fwrite(&record, sizeof(record), 1, file) != 1;
+        }
+    }
+} // namespace encstrset_detail
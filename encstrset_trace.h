@@ -0,0 +1,122 @@
+#ifndef ENCSTRSET_ENCSTRSET_TRACE_H
+#define ENCSTRSET_ENCSTRSET_TRACE_H
+
+#include "encstrset.h"
+#include "encstrset_common.h"
+#include "encstrset_algebra.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <string_view>
+#include <memory>
+#include <cstdint>
+#include <cstdio>
+#include <cstddef>
+
+namespace encstrset_detail {
+    // Binary tracing. While a trace is running, calls append a fixed-size
+    // record to a ring buffer owned by the calling thread, without locking
+    // or waiting; when the ring is full the record is dropped and counted.
+    // A drainer thread empties the rings into the trace file every
+    // millisecond. Rings of threads that have exited are dropped once
+    // drained.
+    enum class TraceOperation : uint8_t {
+        Dropped, New, Delete, Size, Insert, Remove, Test, Clear, Copy,
+        Union, Intersect, Difference, SymmetricDifference, Save, Load, LoadLines, Share, Attach,
+        Freeze
+    };
+
+    struct TraceRing {
+        static constexpr size_t capacity = size_t(1) << 13;
+
+        jnp1::encstrset_trace_record records[capacity];
+        atomic<uint64_t> head{0};
+        atomic<uint64_t> tail{0};
+        atomic<uint64_t> dropped{0};
+        atomic<bool> finished{false};
+        uint16_t thread = 0;
+    };
+
+    extern atomic<bool> tracing;
+    extern mutex traceMutex;
+    extern vector<shared_ptr<TraceRing>> traceRings;
+
+    uint64_t traceClock();
+
+    // Records are stamped with the time stamp counter where there is one,
+    // as it is cheaper to read than the clock, and the drainer converts
+    // stamps to nanoseconds against the clock. Elsewhere stamps are clock
+    // readings already.
+    uint64_t traceStamp();
+
+    // Stamp and clock readings taken when the trace started.
+    extern uint64_t traceStartStamp;
+    extern uint64_t traceStartClock;
+
+    void appendTrace(TraceOperation operation, SetNumber id, bool result, uint64_t detail, string_view cipher,
+                     size_t cipherHash);
+
+    // detail is the length of cipher for operations on a ciphertext, and
+    // otherwise a size, count or set number depending on the operation.
+    inline void trace(TraceOperation operation, SetNumber id, bool result, uint64_t detail = 0) {
+        if (tracing.load(memory_order_acquire)) {
+            appendTrace(operation, id, result, detail, {}, 0);
+        }
+    }
+
+    inline void traceCipher(TraceOperation operation, SetNumber id, bool result, string_view cipher,
+                            size_t cipherHash) {
+        if (tracing.load(memory_order_acquire)) {
+            appendTrace(operation, id, result, cipher.size(), cipher, cipherHash);
+        }
+    }
+
+    // Only the drainer moves the tails of the rings. It starts by
+    // discarding records left over from an earlier trace, and the
+    // constructor returns once it has.
+    class TraceDrainer {
+    public:
+        explicit TraceDrainer(FILE *file);
+
+        TraceDrainer(const TraceDrainer &) = delete;
+
+        TraceDrainer &operator=(const TraceDrainer &) = delete;
+
+        ~TraceDrainer() {
+            stop();
+        }
+
+        // Drains what is left and closes the file; returns false if any
+        // record could not be written.
+        bool stop();
+
+    private:
+        FILE *file;
+        mutex drainerMutex;
+        condition_variable wake;
+        condition_variable ready;
+        bool started = false;
+        bool stopping = false;
+        bool failed = false;
+        thread worker;
+
+        void run();
+
+        void discardLeftovers();
+
+        void drain();
+
+        void drain(TraceRing &ring, double nanosecondsPerStamp);
+    };
+
+    TraceOperation traceOperation(SetOperation operation);
+
+    extern mutex tracerMutex;
+    extern unique_ptr<TraceDrainer> tracer;
+
+    bool writeTraceHeader(FILE *file);
+} // namespace encstrset_detail
+
+#endif //ENCSTRSET_ENCSTRSET_TRACE_H
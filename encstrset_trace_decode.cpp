@@ -0,0 +1,97 @@
+// Formats a trace file written by encstrset_trace_start, one line per
+// record:
+//
+//     <time ns> thread <n> <operation> set #<id> cypher "<prefix>" (<length> bytes, hash <hash>) -> <result>
+//     <time ns> thread <n> copy set #<id> from set #<id> -> <result>
+//     <time ns> thread <n> <operation> set #<id> detail <n> -> <result>
+//     <time ns> thread <n> dropped <count> record(s)
+
+#include "encstrset.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace ::jnp1;
+
+namespace {
+    const char traceMagic[8] = {'E', 'N', 'C', 'S', 'T', 'R', 'C', '\0'};
+    const uint32_t traceVersion = 2;
+
+    // Operations whose detail is the length of a ciphertext.
+    bool hasCipher(const std::string &operation) {
+        return operation == "insert" || operation == "remove" || operation == "test";
+    }
+
+    bool readNames(FILE *file, uint32_t count, std::vector<std::string> &names) {
+        for (uint32_t i = 0; i < count; i++) {
+            std::string name;
+            int character;
+            while ((character = std::fgetc(file)) != EOF && character != '\0') {
+                name += static_cast<char>(character);
+            }
+            if (character == EOF) {
+                return false;
+            }
+            names.push_back(name);
+        }
+        return true;
+    }
+
+    void printRecord(const encstrset_trace_record &record, const std::vector<std::string> &names) {
+        std::string operation = record.operation < names.size() ? names[record.operation] : "unknown";
+        std::printf("%12" PRIu64 " thread %u %s", record.time, unsigned(record.thread), operation.c_str());
+        if (operation == "dropped") {
+            std::printf(" %" PRIu64 " record(s)\n", record.detail);
+            return;
+        }
+        std::printf(" set #%" PRIu64, record.set_id);
+        if (hasCipher(operation)) {
+            std::printf(" cypher \"");
+            uint64_t shown = record.detail < sizeof(record.cipher_prefix) ? record.detail
+                                                                          : uint64_t(sizeof(record.cipher_prefix));
+            for (uint64_t i = 0; i < shown; i++) {
+                std::printf(i == 0 ? "%02X" : " %02X", unsigned(record.cipher_prefix[i]));
+            }
+            std::printf("%s\" (%" PRIu64 " bytes, hash %08" PRIX32 ")", shown < record.detail ? " ..." : "",
+                        record.detail, record.cipher_hash);
+        } else if (operation == "copy") {
+            std::printf(" from set #%" PRIu64, record.detail);
+        } else {
+            std::printf(" detail %" PRIu64, record.detail);
+        }
+        std::printf(" -> %s\n", record.result ? "true" : "false");
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+        return 2;
+    }
+    FILE *file = std::fopen(argv[1], "rb");
+    if (file == nullptr) {
+        std::perror(argv[1]);
+        return 1;
+    }
+
+    char magic[sizeof(traceMagic)];
+    uint32_t fields[3];
+    std::vector<std::string> names;
+    if (std::fread(magic, sizeof(magic), 1, file) != 1 || std::memcmp(magic, traceMagic, sizeof(magic)) != 0 ||
+        std::fread(fields, sizeof(fields), 1, file) != 1 || fields[0] != traceVersion ||
+        fields[1] != sizeof(encstrset_trace_record) || !readNames(file, fields[2], names)) {
+        std::fprintf(stderr, "%s: not a trace file of this version\n", argv[1]);
+        std::fclose(file);
+        return 1;
+    }
+
+    encstrset_trace_record record;
+    while (std::fread(&record, sizeof(record), 1, file) == 1) {
+        printRecord(record, names);
+    }
+    std::fclose(file);
+    return 0;
+}
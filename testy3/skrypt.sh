@@ -57,12 +57,15 @@ function run_test() {
     g++ -Wall -Wextra -O2 -std=c++17 -c "$input_file" -o test_obj.o
   fi
 
-  g++ test_obj.o encstrset.o -o compiled_test
+  g++ test_obj.o "${objects[@]}" -o compiled_test
 
   ./compiled_test 1>"$temp_out" 2>"$temp_err"
+  status=$?
   rm compiled_test 2> /dev/null
 
-    if [[ ! -s "$temp_out" ]]; then
+    if [[ $status != 0 ]]; then
+        echo -ne "${RED}kod wyjscia nieprawidlowy (${status})${NOCOLOR}\n"
+    elif [[ ! -s "$temp_out" ]]; then
         echo -ne "${GREEN}stdout ok (empty)${NOCOLOR}, "
 
         if cmp -s "$error_file" "$temp_err" ; then
@@ -84,11 +87,15 @@ trap 'rm -f "$temp_out"' INT TERM HUP EXIT
 trap 'rm -f "$temp_err"' INT TERM HUP EXIT
 
 cd "$2" || { echo "Failed cd to project dir"; exit 1; }
-echo "Compilation of encstrset.cc..."
-g++ -Wall -Wextra -O2 -std=c++17 -c encstrset.cc -o encstrset.o
+echo "Compilation of encstrset*.cc..."
+objects=()
+for source in encstrset*.cc; do
+  g++ -Wall -Wextra -O2 -std=c++17 -c "$source" -o "${source%.cc}.o"
+  objects+=("${source%.cc}.o")
+done
 
 traverse_folder "$tests"
 
-rm test_obj.o encstrset.o 2> /dev/null
+rm test_obj.o "${objects[@]}" 2> /dev/null
 
 echo "total: ${total}, correct ${correct}"